@@ -0,0 +1,118 @@
+/**
+ * @file alsaif-lookup.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Benchmark of control element lookup of alsaif.c. Sound cards of
+ * growing number of control elements are built in memory, no sound card
+ * is opened, and every element is looked up by numid the way reads,
+ * writes and events of the element look it up. alsaif.c is compiled in
+ * to reach its lookup function.
+ *
+ * @{ */
+
+#include "../src/alsaif.c"
+
+#include "bench.h"
+#include "control.h"
+
+#define BENCH_NAME    "alsaif-lookup"
+#define BENCH_LOOKUPS 1000000
+
+static const int bench_sizes[] = { 32, 128, 512, 2048 };
+
+
+static alsaif_card *bench_card_new  (int, int);
+static int          bench_lookup    (alsaif_card *, int);
+
+
+/* Nothing is recorded, action.c is linked in for record.c only */
+enum rule_type
+control_find_section(const char *name)
+{
+  return rule_unknown;
+}
+
+int
+main(int argc, char **argv)
+{
+  alsaif_card *card;
+  int i;
+
+  for (i = 0;  i < G_N_ELEMENTS(bench_sizes);  i++)
+  {
+    card = bench_card_new(i, bench_sizes[i]);
+
+    if (bench_lookup(card, bench_sizes[i]) < 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Build sound card with numids 1..n, like the control elements of
+ * a card are numbered by ALSA
+ *
+ * @param num  card number
+ * @param n    control elements
+ *
+ * @return  the card
+ */
+static alsaif_card *
+bench_card_new(int num, int n)
+{
+  alsaif_card *card = g_new0(alsaif_card, 1);
+  alsaif_elem *elem;
+  int i;
+
+  card->num = num;
+  alsaif_card_add_to_array(card);
+
+  for (i = 1;  i <= n;  i++)
+  {
+    elem = g_new0(alsaif_elem, 1);
+    elem->alsaif_card = card;
+    elem->numid = i;
+    alsaif_card_add_elem(card, elem);
+  }
+
+  return card;
+}
+
+/**
+ * Look up the card and its elements round robin
+ *
+ * @param card  the card
+ * @param n     control elements of the card
+ *
+ * @return  0 if success, -1 if an element wasn't found
+ */
+static int
+bench_lookup(alsaif_card *card, int n)
+{
+  int64_t start;
+  long found = 0;
+  int i;
+
+  start = bench_now();
+
+  for (i = 0;  i < BENCH_LOOKUPS;  i++)
+  {
+    if (alsaif_card_find_elem(alsaif_cards_find(card->num), i % n + 1))
+      found++;
+  }
+
+  bench_report(BENCH_NAME, "alsaif_card_find_elem", n, BENCH_LOOKUPS,
+               bench_now() - start);
+
+  if (found != BENCH_LOOKUPS)
+  {
+    fprintf(stderr, "%s: found %ld elements of %d\n", BENCH_NAME, found,
+            BENCH_LOOKUPS);
+    return -1;
+  }
+
+  return 0;
+}
+
+/** @} */
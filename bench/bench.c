@@ -0,0 +1,177 @@
+/**
+ * @file bench.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Timing and reporting of the benchmarks, shared by the programs run by
+ * 'make bench' so that their results can be collected and compared.
+ * With BENCH_DBUS also the audio_actions messages of the benchmarks and
+ * the tests are built here.
+ *
+ * @{ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+
+/**
+ * Get current time
+ * @return  monotonic time in nanoseconds
+ */
+int64_t
+bench_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Print result of a measurement as a line of JSON
+ *
+ * @param bench  benchmark program
+ * @param name   the measurement
+ * @param n      size of the data
+ * @param ops    operations timed
+ * @param nsec   their total time
+ */
+void
+bench_report(const char *bench, const char *name, long n, long ops,
+             int64_t nsec)
+{
+  printf("{\"bench\":\"%s\",\"name\":\"%s\",\"n\":%ld,\"ops\":%ld,"
+         "\"nsec\":%lld,\"ns_per_op\":%.1f}\n",
+         bench, name, n, ops, (long long)nsec,
+         ops ? (double)nsec / ops : 0.0);
+  fflush(stdout);
+}
+
+static int
+latency_cmp(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Sort latencies and print their percentiles
+ * @param usec  the latencies in microseconds, sorted in place
+ * @param len   number of the latencies
+ */
+void
+bench_latencies(int64_t *usec, size_t len)
+{
+  static const int percentiles[] = { 50, 90, 99, 100 };
+  size_t i;
+
+  if (!len)
+    return;
+
+  qsort(usec, len, sizeof(*usec), latency_cmp);
+
+  printf("latency usec:");
+
+  for (i = 0;  i < sizeof(percentiles) / sizeof(percentiles[0]);  i++)
+  {
+    printf(" p%d %lld", percentiles[i],
+           (long long)usec[(len - 1) * percentiles[i] / 100]);
+  }
+
+  putchar('\n');
+}
+
+#ifdef BENCH_DBUS
+
+#define POLICY_DBUS_INTERFACE       "com.nokia.policy"
+#define POLICY_DBUS_PDPATH          "/com/nokia/policy"
+#define POLICY_DECISION             "decision"
+#define POLICY_ACTIONS              "audio_actions"
+
+/**
+ * Build audio_actions signal
+ *
+ * @param txid  transaction id
+ * @param acts  actions of the signal
+ * @param len   number of actions
+ *
+ * @return  the message, NULL if out of memory
+ */
+DBusMessage *
+bench_actions_new(dbus_uint32_t txid, const struct bench_action *acts,
+                  int len)
+{
+  DBusMessage *msg;
+  DBusMessageIter msgit, arrit, entit, actit, cmdit;
+  int i, j;
+
+  msg = dbus_message_new_signal(POLICY_DBUS_PDPATH "/" POLICY_DECISION,
+                                POLICY_DBUS_INTERFACE, POLICY_ACTIONS);
+
+  if (!msg)
+    return NULL;
+
+  dbus_message_iter_init_append(msg, &msgit);
+  dbus_message_iter_append_basic(&msgit, DBUS_TYPE_UINT32, &txid);
+  dbus_message_iter_open_container(&msgit, DBUS_TYPE_ARRAY, "{saa(sv)}",
+                                   &arrit);
+
+  for (i = 0;  i < len;  i++)
+  {
+    dbus_message_iter_open_container(&arrit, DBUS_TYPE_DICT_ENTRY, NULL,
+                                     &entit);
+    dbus_message_iter_append_basic(&entit, DBUS_TYPE_STRING, &acts[i].name);
+    dbus_message_iter_open_container(&entit, DBUS_TYPE_ARRAY, "a(sv)",
+                                     &actit);
+    dbus_message_iter_open_container(&actit, DBUS_TYPE_ARRAY, "(sv)",
+                                     &cmdit);
+
+    for (j = 0;  j < 4 && acts[i].args[j];  j += 2)
+    {
+      bench_append_arg(&cmdit, acts[i].args[j], DBUS_TYPE_STRING,
+                       &acts[i].args[j + 1]);
+    }
+
+    dbus_message_iter_close_container(&actit, &cmdit);
+    dbus_message_iter_close_container(&entit, &actit);
+    dbus_message_iter_close_container(&arrit, &entit);
+  }
+
+  dbus_message_iter_close_container(&msgit, &arrit);
+
+  return msg;
+}
+
+/**
+ * Append argument to action
+ *
+ * @param cmdit  iterator of the a(sv) array
+ * @param name   argument name
+ * @param type   D-Bus type of the value, string or uint32
+ * @param value  pointer to the value
+ */
+void
+bench_append_arg(DBusMessageIter *cmdit, const char *name, int type,
+                 const void *value)
+{
+  DBusMessageIter argit;
+  DBusMessageIter valit;
+
+  dbus_message_iter_open_container(cmdit, DBUS_TYPE_STRUCT, NULL, &argit);
+  dbus_message_iter_append_basic(&argit, DBUS_TYPE_STRING, &name);
+  dbus_message_iter_open_container(&argit, DBUS_TYPE_VARIANT,
+                                   type == DBUS_TYPE_STRING ? "s" : "u",
+                                   &valit);
+  dbus_message_iter_append_basic(&valit, type, value);
+  dbus_message_iter_close_container(&argit, &valit);
+  dbus_message_iter_close_container(cmdit, &argit);
+}
+
+#endif  /* BENCH_DBUS */
+
+/** @} */
@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Results of the benchmarks of 'make bench', one JSON object per line:
+ *
+ * {"bench":"rules","name":"config_parse","n":10000,"ops":10000,
+ *  "nsec":12345678,"ns_per_op":1234.6}
+ *
+ * bench is the program, name the measurement and n the size of the data
+ * it was made with, e.g. the control elements of the config. ops is the
+ * operations timed, nsec their total time.
+ */
+
+/* Action of audio_actions message, unset arguments are left out */
+struct bench_action {
+  const char *name;
+  /* argument names and string values in turn */
+  const char *args[4];
+};
+
+int64_t bench_now       (void);
+void    bench_report    (const char *bench, const char *name, long n,
+                         long ops, int64_t nsec);
+void    bench_latencies (int64_t *usec, size_t len);
+
+/* The message builders with BENCH_DBUS, need libdbus */
+#ifdef BENCH_DBUS
+#include <dbus/dbus.h>
+
+DBusMessage *bench_actions_new (dbus_uint32_t txid,
+                                const struct bench_action *acts, int len);
+void         bench_append_arg  (DBusMessageIter *cmdit, const char *name,
+                                int type, const void *value);
+#endif
+
+
+#endif  /* BENCH_H */
@@ -0,0 +1,208 @@
+/**
+ * @file dbus-parse.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Benchmark of audio_actions signal parsing. The D-Bus backend is
+ * compiled in, dbusif.c by default or gdbusif.c with BENCH_GDBUS, and
+ * the same message is parsed over and over. The parsed actions are
+ * counted instead of queued, so only the parser is measured. n of the
+ * result is the actions of the message.
+ *
+ * @{ */
+
+#ifdef BENCH_GDBUS
+#include "../src/gdbusif.c"
+#define BENCH_NAME "dbus-parse-gdbus"
+#else
+#include "../src/dbusif.c"
+#define BENCH_NAME "dbus-parse-libdbus"
+#endif
+
+#include "bench.h"
+
+#define BENCH_ITERATIONS 200000
+
+/* Actions of the benchmark message, a typical call setup decision */
+static const struct bench_action bench_actions[] = {
+  { "com.nokia.policy.audio_route",
+    { "type", "sink", "device", "ihfandheadset" } },
+  { "com.nokia.policy.audio_route",
+    { "type", "source", "device", "microphone" } },
+  { "com.nokia.policy.context",
+    { "variable", "call", "value", "active" } },
+  { "com.nokia.policy.context",
+    { "variable", "jack", "value", "headset" } },
+};
+
+#define BENCH_ACTIONS (sizeof(bench_actions) / sizeof(bench_actions[0]))
+
+static int pushed;
+
+
+/* The actions are counted, not applied */
+int
+queue_push(struct action_data *data)
+{
+  pushed++;
+  return 0;
+}
+
+int
+queue_ack(queue_ack_cb cb, void *data, int success, int64_t start)
+{
+  return 0;
+}
+
+enum rule_type
+control_find_section(const char *name)
+{
+  return rule_unknown;
+}
+
+void
+control_foreach_route(control_state_cb cb, void *data)
+{
+}
+
+void
+control_foreach_rule(control_rule_cb cb, void *data)
+{
+}
+
+void
+control_foreach_elem(control_elem_cb cb, void *data)
+{
+}
+
+int
+control_get_outband(int *lineno, int *msec)
+{
+  return FALSE;
+}
+
+void
+context_foreach(control_state_cb cb, void *data)
+{
+}
+
+#ifdef BENCH_GDBUS
+
+typedef GVariant bench_msg;
+
+/**
+ * Build audio_actions parameters the way GDBus builds them for received
+ * messages, i.e. from the serialized message
+ */
+static GVariant *
+bench_msg_new()
+{
+  GVariantBuilder arr;
+  GVariantBuilder args;
+  GVariant *acts;
+  GVariant *params;
+  GDBusMessage *msg;
+  guchar *blob;
+  gsize len;
+  unsigned i;
+
+  g_variant_builder_init(&arr, G_VARIANT_TYPE("a{saa(sv)}"));
+
+  for (i = 0;  i < BENCH_ACTIONS;  i++)
+  {
+    g_variant_builder_init(&args, G_VARIANT_TYPE("a(sv)"));
+    g_variant_builder_add(&args, "(sv)", bench_actions[i].args[0],
+                          g_variant_new_string(bench_actions[i].args[1]));
+    g_variant_builder_add(&args, "(sv)", bench_actions[i].args[2],
+                          g_variant_new_string(bench_actions[i].args[3]));
+
+    acts = g_variant_builder_end(&args);
+    g_variant_builder_add(&arr, "{s@aa(sv)}", bench_actions[i].name,
+                          g_variant_new_array(NULL, &acts, 1));
+  }
+
+  msg = g_dbus_message_new_signal(POLICY_DBUS_PDPATH "/" POLICY_DECISION,
+                                  POLICY_DBUS_INTERFACE, POLICY_ACTIONS);
+  g_dbus_message_set_body(msg, g_variant_new("(ua{saa(sv)})", 1, &arr));
+
+  blob = g_dbus_message_to_blob(msg, &len, G_DBUS_CAPABILITY_FLAGS_NONE, NULL);
+  g_object_unref(msg);
+
+  msg = g_dbus_message_new_from_blob(blob, len, G_DBUS_CAPABILITY_FLAGS_NONE,
+                                     NULL);
+  g_free(blob);
+
+  params = g_variant_ref(g_dbus_message_get_body(msg));
+  g_object_unref(msg);
+
+  return params;
+}
+
+static void
+bench_msg_free(GVariant *params)
+{
+  g_variant_unref(params);
+}
+
+#else  /* BENCH_GDBUS */
+
+typedef DBusMessage bench_msg;
+
+/**
+ * Build audio_actions signal
+ */
+static DBusMessage *
+bench_msg_new()
+{
+  return bench_actions_new(1, bench_actions, BENCH_ACTIONS);
+}
+
+static void
+bench_msg_free(DBusMessage *msg)
+{
+  dbus_message_unref(msg);
+}
+
+#endif  /* BENCH_GDBUS */
+
+int
+main(int argc, char **argv)
+{
+  struct options options;
+  bench_msg *msg;
+  int64_t start;
+  int i;
+
+  memset(&options, 0, sizeof(options));
+
+  if (dbusif_init(&options) < 0)
+  {
+    fputs("Can't initialize D-Bus interface\n", stderr);
+    return 1;
+  }
+
+  msg = bench_msg_new();
+
+  /* Warm up and check that all the actions are parsed */
+  handle_action_message(msg);
+
+  if (pushed != BENCH_ACTIONS)
+  {
+    fprintf(stderr, "%s: parsed %d actions of %zu\n",
+            BENCH_NAME, pushed, BENCH_ACTIONS);
+    return 1;
+  }
+
+  start = bench_now();
+
+  for (i = 0;  i < BENCH_ITERATIONS;  i++)
+    handle_action_message(msg);
+
+  bench_report(BENCH_NAME, "handle_action_message", BENCH_ACTIONS,
+               BENCH_ITERATIONS, bench_now() - start);
+
+  bench_msg_free(msg);
+
+  return 0;
+}
+
+/** @} */
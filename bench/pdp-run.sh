@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Run alsaped on simulated sound cards against the policy daemon emulator,
+# both on a private session bus. Build them first with
+#   make bench/alsaped-sim bench/pdp
+#
+# Usage: bench/pdp-run.sh config_file [pdp options]
+#
+# e.g.   bench/pdp-run.sh conf/leste/nokia-n900.conf -n 10000 \
+#          -a route:sink:ihf,headset -a context:call:active,inactive
+#
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 config_file [pdp options]" >&2
+  exit 1
+fi
+
+dir=$(dirname "$0")
+config=$1
+shift
+
+exec dbus-run-session -- sh -c '
+  dir=$1
+  "$dir/alsaped-sim" -S -f "$2" &
+  alsaped=$!
+  shift 2
+  "$dir/pdp" "$@"
+  status=$?
+  kill $alsaped
+  exit $status' pdp-run "$dir" "$config" "$@"
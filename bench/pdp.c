@@ -0,0 +1,513 @@
+/**
+ * @file pdp.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Policy decision point emulator. Stands in for OHM: owns the name of
+ * the policy daemon, accepts the registration of alsaped, sends it
+ * audio_actions decisions and collects the status signals. The latency
+ * of every decision, from sending to the status, is measured and the
+ * percentiles are reported.
+ *
+ * Every -a option adds an action to the decisions, the values of the
+ * action are used in turn. The decisions are sent at the given rate, or
+ * by default the next one when the status of the previous one arrives.
+ * Run it with alsaped on a private session bus, see pdp-run.sh.
+ *
+ * Usage: pdp [-n count] [-r rate] [-t sec] -a kind:name:value[,value...]...
+ *
+ * @{ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#include "bench.h"
+
+#define POLICY_DBUS_INTERFACE       "com.nokia.policy"
+#define POLICY_DBUS_PDPATH          "/com/nokia/policy"
+#define POLICY_DBUS_PDNAME          "org.freedesktop.ohm"
+
+#define POLICY_DECISION             "decision"
+#define POLICY_ACTIONS              "audio_actions"
+#define POLICY_STATUS               "status"
+#define POLICY_REGISTER             "register"
+
+/* Action of the decisions */
+struct pdp_action {
+  /* action name and argument names of audio_actions */
+  const char *action;
+  const char *args[2];
+  char  *name;
+  char **values;
+  int    values_len;
+};
+
+/* Sent decision */
+struct pdp_decision {
+  gint64 sent;
+  gint64 status;
+  guint32 success;
+};
+
+/* Private structure */
+static struct {
+  DBusConnection *conn;
+  GArray *actions;
+  /* the actions as sent in the decision being built */
+  struct bench_action *msg_actions;
+  struct pdp_decision *decisions;
+  int count;
+  /* decisions per second, 0 to send on status */
+  int rate;
+  int timeout;
+  int sent;
+  int received;
+  int failed;
+  gint64 start;
+  /* last time something happened, for the timeout */
+  gint64 progress;
+  GSource *sender;
+  GMainLoop *main_loop;
+} priv;
+
+
+static int      action_add      (char *);
+static DBusHandlerResult filter (DBusConnection *, DBusMessage *, void *);
+static void     register_handle (DBusMessage *);
+static void     status_handle   (DBusMessage *);
+static void     send_schedule   (void);
+static gboolean sender_dispatch (GSource *, GSourceFunc, gpointer);
+static int      decision_send   (int);
+static gboolean timeout_cb      (gpointer);
+static void     pdp_report      (void);
+
+
+static GSourceFuncs sender_funcs = {
+  .dispatch = sender_dispatch
+};
+
+
+static void
+usage_exit(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-n count] [-r rate] [-t sec] "
+          "-a kind:name:value[,value...]...\n"
+          "\ta action\tadd action to the decisions, kind is route, context\n"
+          "\t\t\tor section, the values are used in turn\n"
+          "\tn count\t\tnumber of decisions, 1000 by default\n"
+          "\tr rate\t\tdecisions per second, by default the next decision\n"
+          "\t\t\tis sent when the status of the previous one arrives\n"
+          "\tt sec\t\tgive up if nothing happens in sec seconds, 10 by "
+          "default\n", name);
+  exit(EINVAL);
+}
+
+int
+main(int argc, char **argv)
+{
+  DBusError error;
+  char *endptr;
+  int c;
+
+  priv.actions = g_array_new(FALSE, TRUE, sizeof(struct pdp_action));
+  priv.count = 1000;
+  priv.timeout = 10;
+
+  while ((c = getopt(argc, argv, "a:n:r:t:")) != -1)
+  {
+    switch (c)
+    {
+      case 'a':
+        if (action_add(optarg) < 0)
+          usage_exit(argv[0]);
+        break;
+
+      case 'n':
+        priv.count = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || *endptr || priv.count <= 0)
+          usage_exit(argv[0]);
+        break;
+
+      case 'r':
+        priv.rate = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || *endptr || priv.rate < 0)
+          usage_exit(argv[0]);
+        break;
+
+      case 't':
+        priv.timeout = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || *endptr || priv.timeout <= 0)
+          usage_exit(argv[0]);
+        break;
+
+      default:
+        usage_exit(argv[0]);
+    }
+  }
+
+  if (optind != argc || !priv.actions->len)
+    usage_exit(argv[0]);
+
+  priv.msg_actions = g_new0(struct bench_action, priv.actions->len);
+  priv.decisions = g_new0(struct pdp_decision, priv.count);
+  priv.main_loop = g_main_loop_new(NULL, FALSE);
+
+  dbus_error_init(&error);
+
+  if (!(priv.conn = dbus_bus_get(DBUS_BUS_SESSION, &error)))
+  {
+    fprintf(stderr, "Can't connect to the session bus: %s\n", error.message);
+    return EIO;
+  }
+
+  dbus_connection_setup_with_g_main(priv.conn, NULL);
+
+  if (!dbus_connection_add_filter(priv.conn, filter, NULL, NULL))
+  {
+    fputs("Can't add D-Bus filter function\n", stderr);
+    return EIO;
+  }
+
+  dbus_bus_add_match(priv.conn,
+                     "type='signal',interface='" POLICY_DBUS_INTERFACE "',"
+                     "member='" POLICY_STATUS "',"
+                     "path='" POLICY_DBUS_PDPATH "/" POLICY_DECISION "'",
+                     &error);
+
+  if (dbus_error_is_set(&error))
+  {
+    fprintf(stderr, "Can't subscribe %s signals: %s\n", POLICY_STATUS,
+            error.message);
+    return EIO;
+  }
+
+  /* alsaped registers when the name appears */
+  if (dbus_bus_request_name(priv.conn, POLICY_DBUS_PDNAME,
+                            DBUS_NAME_FLAG_DO_NOT_QUEUE, &error) !=
+      DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
+  {
+    fprintf(stderr, "Can't own D-Bus name '%s'%s%s\n", POLICY_DBUS_PDNAME,
+            dbus_error_is_set(&error) ? ": " : "",
+            dbus_error_is_set(&error) ? error.message : "");
+    return EIO;
+  }
+
+  priv.sender = g_source_new(&sender_funcs, sizeof(GSource));
+  g_source_attach(priv.sender, NULL);
+
+  priv.progress = g_get_monotonic_time();
+  g_timeout_add_seconds(1, timeout_cb, NULL);
+
+  g_main_loop_run(priv.main_loop);
+
+  if (priv.received < priv.count)
+  {
+    fprintf(stderr, "Gave up, %s\n", priv.start ?
+            "status signals are missing" : "alsaped didn't register");
+  }
+
+  if (priv.start)
+    pdp_report();
+
+  return priv.received < priv.count || priv.failed ? EIO : 0;
+}
+
+/**
+ * Add action to the decisions
+ * @param spec  kind:name:value[,value...]
+ * @return      0 if success, -1 if error
+ */
+static int
+action_add(char *spec)
+{
+  struct pdp_action act;
+  char **parts;
+
+  memset(&act, 0, sizeof(act));
+  parts = g_strsplit(spec, ":", 3);
+
+  if (g_strv_length(parts) != 3 || !*parts[1] || !*parts[2])
+  {
+    g_strfreev(parts);
+    return -1;
+  }
+
+  if (!strcmp(parts[0], "route"))
+  {
+    act.action  = "com.nokia.policy.audio_route";
+    act.args[0] = "type";
+    act.args[1] = "device";
+  }
+  else if (!strcmp(parts[0], "context"))
+  {
+    act.action  = "com.nokia.policy.context";
+    act.args[0] = "variable";
+    act.args[1] = "value";
+  }
+  else if (!strcmp(parts[0], "section"))
+  {
+    act.action  = "com.nokia.policy.section";
+    act.args[0] = "section";
+    act.args[1] = "entry";
+  }
+  else
+  {
+    g_strfreev(parts);
+    return -1;
+  }
+
+  act.name = g_strdup(parts[1]);
+  act.values = g_strsplit(parts[2], ",", -1);
+  act.values_len = g_strv_length(act.values);
+  g_array_append_val(priv.actions, act);
+
+  g_strfreev(parts);
+
+  return 0;
+}
+
+/**
+ * Handle registration method calls and status signals
+ */
+static DBusHandlerResult
+filter(DBusConnection *conn, DBusMessage *msg, void *user_data)
+{
+  if (dbus_message_is_method_call(msg, POLICY_DBUS_INTERFACE,
+                                  POLICY_REGISTER))
+  {
+    register_handle(msg);
+    return DBUS_HANDLER_RESULT_HANDLED;
+  }
+
+  if (dbus_message_is_signal(msg, POLICY_DBUS_INTERFACE, POLICY_STATUS))
+  {
+    status_handle(msg);
+    return DBUS_HANDLER_RESULT_HANDLED;
+  }
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/**
+ * Accept registration of enforcement point and start sending decisions
+ * @param msg  the method call
+ */
+static void
+register_handle(DBusMessage *msg)
+{
+  DBusMessage *reply;
+  const char *name = NULL;
+
+  dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &name,
+                        DBUS_TYPE_INVALID);
+
+  if ((reply = dbus_message_new_method_return(msg)))
+  {
+    dbus_connection_send(priv.conn, reply, NULL);
+    dbus_message_unref(reply);
+  }
+
+  printf("pdp: '%s' registered\n", name ? name : "?");
+
+  if (priv.start)
+    return;
+
+  priv.start = priv.progress = g_get_monotonic_time();
+  send_schedule();
+}
+
+/**
+ * Collect status of decision
+ * @param msg  the status signal
+ */
+static void
+status_handle(DBusMessage *msg)
+{
+  struct pdp_decision *decision;
+  dbus_uint32_t txid, status;
+
+  if (!dbus_message_get_args(msg, NULL,
+                             DBUS_TYPE_UINT32, &txid,
+                             DBUS_TYPE_UINT32, &status,
+                             DBUS_TYPE_INVALID) ||
+      txid < 1 || txid > priv.sent)
+  {
+    fputs("Unexpected status signal\n", stderr);
+    return;
+  }
+
+  decision = &priv.decisions[txid - 1];
+
+  if (decision->status)
+    return;
+
+  decision->status = priv.progress = g_get_monotonic_time();
+  decision->success = status;
+
+  if (!status)
+    priv.failed++;
+
+  if (++priv.received == priv.count)
+    g_main_loop_quit(priv.main_loop);
+  else if (!priv.rate)
+    send_schedule();
+}
+
+/**
+ * Wake up the sender when the next decision is due
+ */
+static void
+send_schedule()
+{
+  if (priv.sent == priv.count)
+    return;
+
+  if (!priv.rate)
+    g_source_set_ready_time(priv.sender, 0);
+  else
+    g_source_set_ready_time(priv.sender, priv.start +
+                            (gint64)priv.sent * G_USEC_PER_SEC / priv.rate);
+}
+
+/**
+ * Send the decisions which are due
+ */
+static gboolean
+sender_dispatch(GSource *source, GSourceFunc cb, gpointer data)
+{
+  gint64 now = g_get_monotonic_time();
+
+  g_source_set_ready_time(source, -1);
+
+  while (priv.sent < priv.count)
+  {
+    if (priv.rate &&
+        priv.start + (gint64)priv.sent * G_USEC_PER_SEC / priv.rate > now)
+    {
+      break;
+    }
+
+    if (decision_send(priv.sent) < 0)
+    {
+      g_main_loop_quit(priv.main_loop);
+      return G_SOURCE_REMOVE;
+    }
+
+    priv.sent++;
+
+    /* The next one is sent when the status of this one arrives */
+    if (!priv.rate)
+      return G_SOURCE_CONTINUE;
+  }
+
+  send_schedule();
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Send audio_actions decision
+ * @param n  number of the decision, transaction ID is n + 1
+ * @return   0 if success, -1 if error
+ */
+static int
+decision_send(int n)
+{
+  struct pdp_action *act;
+  struct bench_action *msg_act;
+  DBusMessage *msg;
+  guint i;
+
+  for (i = 0;  i < priv.actions->len;  i++)
+  {
+    act = &g_array_index(priv.actions, struct pdp_action, i);
+    msg_act = &priv.msg_actions[i];
+
+    msg_act->name    = act->action;
+    msg_act->args[0] = act->args[0];
+    msg_act->args[1] = act->name;
+    msg_act->args[2] = act->args[1];
+    msg_act->args[3] = act->values[n % act->values_len];
+  }
+
+  /* Transaction ID 0 would get no status */
+  msg = bench_actions_new(n + 1, priv.msg_actions, priv.actions->len);
+
+  if (!msg)
+  {
+    fputs("Can't create audio_actions signal\n", stderr);
+    return -1;
+  }
+
+  priv.decisions[n].sent = g_get_monotonic_time();
+
+  if (!dbus_connection_send(priv.conn, msg, NULL))
+  {
+    fputs("Can't send audio_actions signal: out of memory\n", stderr);
+    dbus_message_unref(msg);
+    return -1;
+  }
+
+  dbus_message_unref(msg);
+
+  return 0;
+}
+
+/**
+ * Give up if nothing has happened for a while
+ */
+static gboolean
+timeout_cb(gpointer data)
+{
+  if (g_get_monotonic_time() - priv.progress >
+      (gint64)priv.timeout * G_USEC_PER_SEC)
+  {
+    g_main_loop_quit(priv.main_loop);
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Print the throughput and the latency percentiles of the decisions
+ */
+static void
+pdp_report()
+{
+  struct pdp_decision *decision;
+  GArray *latencies;
+  gint64 latency, last = priv.start;
+  int i;
+
+  latencies = g_array_sized_new(FALSE, FALSE, sizeof(gint64), priv.count);
+
+  for (i = 0;  i < priv.sent;  i++)
+  {
+    decision = &priv.decisions[i];
+
+    if (!decision->status)
+      continue;
+
+    latency = decision->status - decision->sent;
+    g_array_append_val(latencies, latency);
+
+    if (decision->status > last)
+      last = decision->status;
+  }
+
+  printf("pdp: %d decisions, %d status, %d failed, %.0f decisions/s\n",
+         priv.sent, priv.received, priv.failed,
+         last > priv.start ? priv.received * 1e6 / (last - priv.start) : 0);
+
+  bench_latencies((int64_t *)latencies->data, latencies->len);
+
+  g_array_free(latencies, TRUE);
+}
+
+/** @} */
@@ -0,0 +1,358 @@
+/**
+ * @file replay.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Replay of policy decisions recorded with 'alsaped -R'. The recorded
+ * actions are queued the way dbusif queues them, at the recorded pace or
+ * as fast as they are applied, and applied by the rules of the config
+ * file to simulated sound cards. The latency of every decision, from
+ * queueing to acknowledgement, is measured and the percentiles are
+ * reported.
+ *
+ * Usage: replay [-f] [-t] [-d usec] [-v] config_file recording
+ *
+ * @{ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "action.h"
+#include "alsaif.h"
+#include "alsasim.h"
+#include "config.h"
+#include "control.h"
+#include "logging.h"
+#include "queue.h"
+#include "record.h"
+#include "worker.h"
+
+#include "bench.h"
+
+/* Recorded decision */
+struct replay_decision {
+  struct record_header header;
+  char *actions;
+  /* queued and acknowledged, microseconds */
+  gint64 queued;
+  gint64 acked;
+};
+
+/* Private structure */
+static struct {
+  GArray *decisions;
+  /* next decision to queue */
+  guint next;
+  guint acked;
+  int actions;
+  int failed;
+  /* queue the next decision when the previous one is acknowledged */
+  int fast;
+  /* start of the replay and of the recording */
+  gint64 start;
+  guint64 recorded_start;
+  GSource *feeder;
+  GMainLoop *main_loop;
+} priv;
+
+
+static int      replay_load      (const char *);
+static void     replay_schedule  (void);
+static gboolean feeder_dispatch  (GSource *, GSourceFunc, gpointer);
+static void     decision_queue   (struct replay_decision *);
+static void     ack_cb           (void *, int);
+static void     replay_report    (void);
+
+
+static GSourceFuncs feeder_funcs = {
+  .dispatch = feeder_dispatch
+};
+
+
+static void
+usage_exit(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-f] [-t] [-d usec] [-v] config_file recording\n"
+          "\tf\t\treplay as fast as the decisions are applied\n"
+          "\tt\t\tapply ALSA settings on worker threads\n"
+          "\td usec\t\ttime a control element write takes\n"
+          "\tv\t\tlog rule execution\n", name);
+  exit(EINVAL);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct options options;
+  char *endptr;
+  int c;
+
+  memset(&options, 0, sizeof(options));
+  options.log_mask = LOG_FLAG_ERROR;
+
+  while ((c = getopt(argc, argv, "ftd:v")) != -1)
+  {
+    switch (c)
+    {
+      case 'f':
+        priv.fast = TRUE;
+        break;
+
+      case 't':
+        options.worker = TRUE;
+        break;
+
+      case 'd':
+        alsasim_set_delay(strtoul(optarg, &endptr, 10));
+        if (endptr == optarg || *endptr)
+          usage_exit(argv[0]);
+        break;
+
+      case 'v':
+        options.log_mask = LOG_MASK_ALL;
+        options.log_rule_execution = TRUE;
+        break;
+
+      default:
+        usage_exit(argv[0]);
+    }
+  }
+
+  if (argc - optind != 2)
+    usage_exit(argv[0]);
+
+  options.config_path = argv[optind];
+
+  if (log_init(&options) < 0 ||
+      config_init(&options) < 0 ||
+      control_init(&options) < 0 ||
+      alsaif_init(&options) < 0 ||
+      queue_init(&options) < 0 ||
+      worker_init(&options) < 0)
+  {
+    fputs("Error during initialization\n", stderr);
+    return EINVAL;
+  }
+
+  control_set_cb();
+
+  if (config_parse() < 0 || control_compile() < 0)
+  {
+    fprintf(stderr, "Can't load %s\n", options.config_path);
+    return EINVAL;
+  }
+
+  alsaif_create();
+
+  if (log_create() < 0 || worker_create() < 0)
+  {
+    fputs("Thread creation failed\n", stderr);
+    return errno;
+  }
+
+  if (replay_load(argv[optind + 1]) < 0)
+  {
+    fprintf(stderr, "Can't read %s: %s\n", argv[optind + 1], strerror(errno));
+    return errno;
+  }
+
+  if (!priv.decisions->len)
+  {
+    fputs("Nothing to replay\n", stderr);
+    return 0;
+  }
+
+  priv.main_loop = g_main_loop_new(NULL, FALSE);
+  priv.feeder = g_source_new(&feeder_funcs, sizeof(GSource));
+  g_source_attach(priv.feeder, NULL);
+
+  priv.start = g_get_monotonic_time();
+  priv.recorded_start = g_array_index(priv.decisions,
+                                      struct replay_decision, 0).header.usec;
+  replay_schedule();
+
+  g_main_loop_run(priv.main_loop);
+
+  replay_report();
+
+  return priv.failed ? EIO : 0;
+}
+
+/**
+ * Read the recorded decisions
+ * @param path  the recording
+ * @return      0 if success, -1 if error
+ */
+static int
+replay_load(const char *path)
+{
+  struct replay_decision decision;
+  char actions[RECORD_ACTIONS_MAX];
+  FILE *file;
+  int ret;
+
+  if (!(file = fopen(path, "r")))
+    return -1;
+
+  priv.decisions = g_array_new(FALSE, TRUE, sizeof(struct replay_decision));
+  memset(&decision, 0, sizeof(decision));
+
+  while ((ret = record_read(file, &decision.header, actions)) > 0)
+  {
+    decision.actions = g_malloc(decision.header.len);
+    memcpy(decision.actions, actions, decision.header.len);
+    g_array_append_val(priv.decisions, decision);
+  }
+
+  fclose(file);
+
+  return ret;
+}
+
+/**
+ * Wake up the feeder when the next decision is due
+ */
+static void
+replay_schedule()
+{
+  struct replay_decision *decision;
+
+  if (priv.next == priv.decisions->len)
+    return;
+
+  decision = &g_array_index(priv.decisions, struct replay_decision,
+                            priv.next);
+
+  if (priv.fast)
+    g_source_set_ready_time(priv.feeder, 0);
+  else
+    g_source_set_ready_time(priv.feeder, priv.start +
+                            (decision->header.usec - priv.recorded_start));
+}
+
+/**
+ * Queue the decisions which are due
+ */
+static gboolean
+feeder_dispatch(GSource *source, GSourceFunc cb, gpointer data)
+{
+  struct replay_decision *decision;
+  gint64 now = g_get_monotonic_time();
+
+  g_source_set_ready_time(source, -1);
+
+  while (priv.next < priv.decisions->len)
+  {
+    decision = &g_array_index(priv.decisions, struct replay_decision,
+                              priv.next);
+
+    if (!priv.fast &&
+        priv.start + (decision->header.usec - priv.recorded_start) > now)
+    {
+      break;
+    }
+
+    priv.next++;
+    decision_queue(decision);
+
+    /* The next one is queued when this one is acknowledged */
+    if (priv.fast)
+      return G_SOURCE_CONTINUE;
+  }
+
+  replay_schedule();
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Queue the actions of decision like dbusif does
+ * @param decision  the decision
+ */
+static void
+decision_queue(struct replay_decision *decision)
+{
+  struct action_data data;
+  int success = decision->header.status == RECORD_QUEUED;
+  int offs, size, kind, i;
+
+  decision->queued = g_get_monotonic_time();
+
+  for (i = 0, offs = 0;  i < decision->header.count;  i++, offs += size)
+  {
+    /* The strings are terminated in place, they are copied when queued */
+    size = action_unpack(decision->actions + offs,
+                         decision->header.len - offs, &kind, &data);
+
+    if (size < 0)
+    {
+      log_error("Invalid action in decision %u", decision->header.txid);
+      success = FALSE;
+      break;
+    }
+
+    if (queue_push(&data) < 0)
+      success = FALSE;
+
+    priv.actions++;
+  }
+
+  queue_ack(ack_cb, decision, success, decision->queued);
+}
+
+/**
+ * Queue acknowledgement callback
+ *
+ * @param data     the decision
+ * @param success  whether the actions were applied
+ */
+static void
+ack_cb(void *data, int success)
+{
+  struct replay_decision *decision = data;
+
+  decision->acked = g_get_monotonic_time();
+
+  if (!success)
+    priv.failed++;
+
+  if (++priv.acked == priv.decisions->len)
+    g_main_loop_quit(priv.main_loop);
+  else if (priv.fast)
+    replay_schedule();
+}
+
+/**
+ * Print the latency percentiles of the decisions
+ */
+static void
+replay_report()
+{
+  struct replay_decision *decision;
+  GArray *latencies;
+  gint64 latency;
+  guint i;
+
+  latencies = g_array_sized_new(FALSE, FALSE, sizeof(gint64),
+                                priv.decisions->len);
+
+  for (i = 0;  i < priv.decisions->len;  i++)
+  {
+    decision = &g_array_index(priv.decisions, struct replay_decision, i);
+    latency = decision->acked - decision->queued;
+    g_array_append_val(latencies, latency);
+  }
+
+  printf("replay: %u decisions, %d actions, %d failed, %d writes, %.3f s\n",
+         priv.decisions->len, priv.actions, priv.failed, alsasim_writes(),
+         (g_get_monotonic_time() - priv.start) / 1e6);
+  bench_latencies((int64_t *)latencies->data, latencies->len);
+
+  g_array_free(latencies, TRUE);
+}
+
+/** @} */
@@ -0,0 +1,315 @@
+/**
+ * @file rules.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Benchmark of the config parser and the rule engine. A config with n
+ * control elements on four cards is generated, with a pair of sink route
+ * entries for every ten controls, setting them on and off. It's parsed,
+ * the cards are simulated by alsasim.c, the entries are looked up and
+ * their rules run, writing the controls or skipping the writes when the
+ * controls already have the values. control.c is compiled in to reach
+ * its lookup and rule execution functions.
+ *
+ * Usage: rules [n ...], 100, 1000 and 10000 controls by default. The
+ * daemon state can't be torn down, so every n is run by a child process.
+ *
+ * @{ */
+
+#include "../src/control.c"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "alsasim.h"
+#include "bench.h"
+#include "config.h"
+
+#define BENCH_NAME        "rules"
+#define BENCH_LOOKUPS     1000000
+#define BENCH_RUNS        100000
+
+/* Sound cards and controls set by an entry of the config */
+#define BENCH_CARDS       4
+#define BENCH_ENTRY_ELEMS 10
+
+static const long bench_sizes[] = { 100, 1000, 10000 };
+
+
+static int  bench_run          (long);
+static int  bench_config_write (int, long);
+static int  bench_lookup       (long);
+static int  bench_rules        (long);
+
+
+int
+main(int argc, char **argv)
+{
+  long n;
+  int status;
+  int i, count;
+  pid_t pid;
+
+  count = argc > 1 ? argc - 1 : (int)G_N_ELEMENTS(bench_sizes);
+
+  for (i = 0;  i < count;  i++)
+  {
+    n = argc > 1 ? strtol(argv[i + 1], NULL, 10) : bench_sizes[i];
+
+    if (n < BENCH_ENTRY_ELEMS)
+    {
+      fprintf(stderr, "%s: at least %d controls needed\n", BENCH_NAME,
+              BENCH_ENTRY_ELEMS);
+      return EINVAL;
+    }
+
+    if ((pid = fork()) < 0)
+    {
+      perror("fork");
+      return errno;
+    }
+
+    if (!pid)
+      exit(bench_run(n) < 0 ? 1 : 0);
+
+    if (waitpid(pid, &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status))
+    {
+      fprintf(stderr, "%s: benchmark of %ld controls failed\n",
+              BENCH_NAME, n);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Run the benchmarks on generated config
+ * @param n  control elements of the config
+ * @return   0 if success, -1 if error
+ */
+static int
+bench_run(long n)
+{
+  struct options options;
+  char *path;
+  int64_t start;
+  int fd, ret;
+
+  memset(&options, 0, sizeof(options));
+  options.log_mask = LOG_FLAG_ERROR;
+
+  if ((fd = g_file_open_tmp("alsaped-bench-XXXXXX.conf", &path, NULL)) < 0)
+  {
+    fputs("Can't create config file\n", stderr);
+    return -1;
+  }
+
+  ret = bench_config_write(fd, n);
+  options.config_path = path;
+
+  if (ret < 0 ||
+      log_init(&options) < 0 ||
+      config_init(&options) < 0 ||
+      control_init(&options) < 0 ||
+      alsaif_init(&options) < 0)
+  {
+    fputs("Error during initialization\n", stderr);
+    unlink(path);
+    return -1;
+  }
+
+  control_set_cb();
+
+  start = bench_now();
+  ret = config_parse();
+  bench_report(BENCH_NAME, "config_parse", n, n, bench_now() - start);
+
+  unlink(path);
+  g_free(path);
+
+  if (ret < 0)
+    return -1;
+
+  start = bench_now();
+  ret = control_compile();
+  bench_report(BENCH_NAME, "control_compile", n, n, bench_now() - start);
+
+  if (ret < 0)
+    return -1;
+
+  alsaif_create();
+
+  if (bench_lookup(n) < 0 || bench_rules(n) < 0)
+    return -1;
+
+  return 0;
+}
+
+/**
+ * Write config of n controls
+ *
+ * @param fd  the file, it's closed
+ * @param n   control elements
+ *
+ * @return  0 if success, -1 if error
+ */
+static int
+bench_config_write(int fd, long n)
+{
+  FILE *file;
+  long i, k;
+  int ret;
+
+  if (!(file = fdopen(fd, "w")))
+  {
+    close(fd);
+    return -1;
+  }
+
+  for (i = 0;  i < n;  i++)
+  {
+    fprintf(file, "[control]\nid = c%ld\ncard = Bench Card %ld\n"
+            "name = \"Control %ld\"\n\n", i, i % BENCH_CARDS, i);
+  }
+
+  fputs("[sink-route]\n", file);
+
+  for (i = 0;  i < n / BENCH_ENTRY_ELEMS;  i++)
+  {
+    for (k = 0;  k < BENCH_ENTRY_ELEMS;  k++)
+    {
+      fprintf(file, "on%ld = c%ld: on\noff%ld = c%ld: off\n",
+              i, i * BENCH_ENTRY_ELEMS + k, i, i * BENCH_ENTRY_ELEMS + k);
+    }
+  }
+
+  ret = ferror(file) ? -1 : 0;
+
+  if (fclose(file) != 0)
+    ret = -1;
+
+  return ret;
+}
+
+/**
+ * Look up the entries of the config round robin
+ * @param n  control elements of the config
+ * @return   0 if success, -1 if an entry wasn't found
+ */
+static int
+bench_lookup(long n)
+{
+  long entries = n / BENCH_ENTRY_ELEMS * 2;
+  gchar **names = g_new0(gchar *, entries + 1);
+  int64_t start;
+  long i, found = 0;
+
+  for (i = 0;  i < entries;  i++)
+    names[i] = g_strdup_printf("%s%ld", i & 1 ? "off" : "on", i / 2);
+
+  start = bench_now();
+
+  for (i = 0;  i < BENCH_LOOKUPS;  i++)
+  {
+    if (control_find_entry(names[i % entries]))
+      found++;
+  }
+
+  bench_report(BENCH_NAME, "control_find_entry", n, BENCH_LOOKUPS,
+               bench_now() - start);
+
+  g_strfreev(names);
+
+  if (found != BENCH_LOOKUPS)
+  {
+    fprintf(stderr, "%s: found %ld entries of %d\n", BENCH_NAME, found,
+            BENCH_LOOKUPS);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Run the rules of the entries, switching the controls on and off, and
+ * again with the controls having the values already
+ *
+ * @param n  control elements of the config
+ * @return   0 if success, -1 if error
+ */
+static int
+bench_rules(long n)
+{
+  long pairs = n / BENCH_ENTRY_ELEMS;
+  struct rule_def **on = g_new(struct rule_def *, pairs);
+  struct rule_def **off = g_new(struct rule_def *, pairs);
+  char name[16];
+  int64_t start;
+  int writes, ret = 0;
+  long i;
+
+  for (i = 0;  i < pairs;  i++)
+  {
+    snprintf(name, sizeof(name), "on%ld", i);
+    on[i] = *entry_def_rules(control_find_entry(name), rule_sink);
+    snprintf(name, sizeof(name), "off%ld", i);
+    off[i] = *entry_def_rules(control_find_entry(name), rule_sink);
+
+    if (rule_def_run(on[i]) < 0)
+      ret = -1;
+  }
+
+  /* Every run changes the values, the controls are on before even rounds */
+  writes = alsasim_writes();
+  start = bench_now();
+
+  for (i = 0;  i < BENCH_RUNS;  i++)
+  {
+    if (rule_def_run((i / pairs) & 1 ? on[i % pairs] : off[i % pairs]) < 0)
+      ret = -1;
+  }
+
+  bench_report(BENCH_NAME, "rule_def_run_write", n,
+               BENCH_RUNS * BENCH_ENTRY_ELEMS, bench_now() - start);
+
+  if (alsasim_writes() - writes != BENCH_RUNS * BENCH_ENTRY_ELEMS)
+  {
+    fprintf(stderr, "%s: %d writes of %d\n", BENCH_NAME,
+            alsasim_writes() - writes, BENCH_RUNS * BENCH_ENTRY_ELEMS);
+    ret = -1;
+  }
+
+  for (i = 0;  i < pairs;  i++)
+  {
+    if (rule_def_run(on[i]) < 0)
+      ret = -1;
+  }
+
+  writes = alsasim_writes();
+  start = bench_now();
+
+  for (i = 0;  i < BENCH_RUNS;  i++)
+  {
+    if (rule_def_run(on[i % pairs]) < 0)
+      ret = -1;
+  }
+
+  bench_report(BENCH_NAME, "rule_def_run_skip", n,
+               BENCH_RUNS * BENCH_ENTRY_ELEMS, bench_now() - start);
+
+  if (alsasim_writes() != writes)
+  {
+    fprintf(stderr, "%s: %d writes of 0\n", BENCH_NAME,
+            alsasim_writes() - writes);
+    ret = -1;
+  }
+
+  g_free(on);
+  g_free(off);
+
+  return ret;
+}
+
+/** @} */
@@ -0,0 +1,183 @@
+/**
+ * @file action.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement policy actions.
+ * Helpers shared by the interfaces which receive policy actions.
+ *
+ * @{ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "control.h"
+#include "logging.h"
+#include "sockif.h"
+
+#include "action.h"
+
+/**
+ * Build action from its arguments. Section name is resolved to rule
+ * type here, so the action is dispatched without further lookups.
+ *
+ * @param kind   "route", "context" or "section"
+ * @param name   route type, context variable or section name
+ * @param value  route device, variable value or section entry
+ * @param data   pointer to return the action, strings are not copied
+ *
+ * @return  0 if success, -1 if error
+ */
+int
+action_build(const char *kind, const char *name, const char *value,
+             struct action_data *data)
+{
+  if (!strcmp(kind, "route"))
+  {
+    if (!strcmp(name, "sink"))
+      data->rule_type = rule_sink;
+    else if (!strcmp(name, "source"))
+      data->rule_type = rule_source;
+    else
+    {
+      log_error("Invalid audio route type '%s'", name);
+      errno = EINVAL;
+      return -1;
+    }
+
+    data->route_dev = value;
+  }
+  else if (!strcmp(kind, "context"))
+  {
+    data->rule_type = rule_context;
+    data->variable  = name;
+    data->value     = value;
+  }
+  else if (!strcmp(kind, "section"))
+  {
+    data->rule_type = control_find_section(name);
+
+    /* Context has its own action with variable and value */
+    if (data->rule_type == rule_unknown || data->rule_type == rule_context)
+    {
+      log_error("Invalid section '%s'", name);
+      errno = EINVAL;
+      return -1;
+    }
+
+    data->route_dev = value;
+  }
+  else
+  {
+    log_error("Invalid action '%s'", kind);
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Pack action the way the actions of control socket requests are packed,
+ * struct sockif_action followed by the name and the value.
+ *
+ * @param buf    buffer to pack the action to
+ * @param len    size of the buffer
+ * @param kind   "route", "context" or "section"
+ * @param name   route type, context variable or section name
+ * @param value  route device, variable value or section entry
+ *
+ * @return  size of the packed action or -1 if error
+ */
+int
+action_pack(char *buf, int len, const char *kind, const char *name,
+            const char *value)
+{
+  struct sockif_action act;
+  size_t name_len  = strlen(name);
+  size_t value_len = strlen(value);
+
+  if (!strcmp(kind, "route"))
+    act.kind = sockif_route;
+  else if (!strcmp(kind, "context"))
+    act.kind = sockif_context;
+  else if (!strcmp(kind, "section"))
+    act.kind = sockif_section;
+  else
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (name_len > UINT8_MAX || value_len > UINT8_MAX ||
+      sizeof(act) + name_len + value_len > len)
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  act.name_len  = name_len;
+  act.value_len = value_len;
+
+  memcpy(buf, &act, sizeof(act));
+  memcpy(buf + sizeof(act), name, name_len);
+  memcpy(buf + sizeof(act) + name_len, value, value_len);
+
+  return sizeof(act) + name_len + value_len;
+}
+
+/**
+ * Unpack action packed by action_pack() or sent to the control socket.
+ * The strings are null terminated in place, they are moved over the
+ * action header to make room for the terminators.
+ *
+ * @param buf   the packed action
+ * @param len   bytes left in the buffer
+ * @param kind  pointer to return the kind, enum sockif_cmd
+ * @param data  pointer to return the action
+ *
+ * @return  size of the packed action or -1 if error
+ */
+int
+action_unpack(char *buf, int len, int *kind, struct action_data *data)
+{
+  static const char *kinds[] = {
+    [sockif_route]   = "route",
+    [sockif_context] = "context",
+    [sockif_section] = "section"
+  };
+
+  struct sockif_action act;
+  char *name, *value;
+  int size;
+
+  if (len < sizeof(act))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memcpy(&act, buf, sizeof(act));
+  size = sizeof(act) + act.name_len + act.value_len;
+
+  if (size > len || act.kind <= sockif_unknown || act.kind >= sockif_batch)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  name  = buf;
+  value = name + act.name_len + 1;
+  memmove(name, buf + sizeof(act), act.name_len);
+  name[act.name_len] = '\0';
+  memmove(value, buf + sizeof(act) + act.name_len, act.value_len);
+  value[act.value_len] = '\0';
+
+  *kind = act.kind;
+
+  if (action_build(kinds[act.kind], name, value, data) < 0)
+    return -1;
+
+  return size;
+}
+
+/** @} */
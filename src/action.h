@@ -0,0 +1,19 @@
+#ifndef ACTION_H
+#define ACTION_H
+
+#include "dbusif.h"
+
+int action_build  (const char *kind,
+                   const char *name,
+                   const char *value,
+                   struct action_data *data);
+int action_pack   (char *buf, int len,
+                   const char *kind,
+                   const char *name,
+                   const char *value);
+int action_unpack (char *buf, int len,
+                   int *kind,
+                   struct action_data *data);
+
+
+#endif  /* ACTION_H */
@@ -9,9 +9,11 @@
 
 #include <alsa/asoundlib.h>
 #include <glib.h>
+#include <errno.h>
 
 #include "options.h"
 #include "logging.h"
+#include "trace.h"
 
 #include "alsaif.h"
 
@@ -73,8 +75,10 @@ static alsaif_card *alsaif_cards_find(int);
 static alsaif_elem *alsaif_card_find_elem(alsaif_card *, int);
 static int alsaif_ctl_get_value(alsaif_elem *, long *);
 static int alsaif_ctl_set_value(alsaif_elem *, long *);
+static int alsaif_ctl_open(snd_ctl_t **, int);
 static alsaif_card *alsaif_card_new(int);
 static const char *alsaif_card_to_str(alsaif_card *, char *, int);
+static const char *alsaif_value_to_str(alsaif_elem *, long, char *, int);
 static gboolean control_event_cb(GIOChannel *, GIOCondition, gpointer);
 static void alsaif_card_add_to_array(alsaif_card *);
 static void alsaif_card_add_controls(alsaif_card *);
@@ -200,6 +204,150 @@ fail:
   return -1;
 }
 
+/**
+ * Get the numbers of the sound cards added to alsaif
+ *
+ * @param nums  array to store the numbers
+ * @param len   length of the array
+ *
+ * @return  number of the sound cards stored
+ */
+int
+alsaif_card_nums(int *nums, int len)
+{
+  alsaif_card *card;
+  int count = 0;
+  int i;
+
+  for (i = 0;  i < CARDS_COUNT;  i++)
+  {
+    for (card = priv.cards[i];  card && count < len;  card = card->next)
+      nums[count++] = card->num;
+  }
+
+  return count;
+}
+
+/**
+ * Prepare ALSA control element write to be applied with
+ * alsaif_write_apply(). Everything the write needs is copied, so it may
+ * be applied from another thread.
+ *
+ * @param card_num  Sound card number
+ * @param numid     Control element numid
+ * @param value     Pointer to the value
+ * @param write     Pointer to store the write
+ *
+ * @return  -1 if error, 0 if success, 1 if the element is not present
+ */
+int
+alsaif_write_prepare(int card_num, int numid, long *value,
+                     struct alsaif_write *write)
+{
+  alsaif_card *card;
+  alsaif_elem *elem;
+
+  if (!value || !write)
+    return -1;
+
+  if (card_num == -1 || numid == -1)
+    return 1;
+
+  card = alsaif_cards_find(card_num);
+  elem = card ? alsaif_card_find_elem(card, numid) : NULL;
+
+  if (!elem)
+  {
+    log_error("%s(): Can't find control element (card=%d,numid=%d)",
+              __func__, card_num, numid);
+    return -1;
+  }
+
+  write->card_num  = card_num;
+  write->numid     = elem->numid;
+  write->val_type  = elem->val_type;
+  write->index     = elem->index;
+  write->val_count = elem->val_count;
+  write->value     = *value;
+
+  return 0;
+}
+
+/**
+ * Apply prepared control element write. The thread calling this
+ * function has ctl handles of its own, opened on the first write to the
+ * sound card, and opened again if the card went away meanwhile. If
+ * there's more than one value for control element, all values are set to
+ * the same.
+ *
+ * @param ctl    Pointer to the ctl handle of the card, opened if NULL
+ * @param write  The write prepared with alsaif_write_prepare()
+ *
+ * @return  -1 on error, 0 on success
+ */
+int
+alsaif_write_apply(snd_ctl_t **ctl, struct alsaif_write *write)
+{
+  snd_ctl_elem_value_t *elem_value;
+  unsigned int i;
+  int ret;
+
+  if (!*ctl && alsaif_ctl_open(ctl, write->card_num) < 0)
+    return -1;
+
+  snd_ctl_elem_value_alloca(&elem_value);
+  snd_ctl_elem_value_set_numid(elem_value, write->numid);
+
+  for (i = 0;  write->val_count > i;  i++)
+  {
+    switch (write->val_type)
+    {
+      case SND_CTL_ELEM_TYPE_INTEGER:
+        snd_ctl_elem_value_set_integer(elem_value, write->index + i,
+                                       write->value);
+        break;
+      case SND_CTL_ELEM_TYPE_ENUMERATED:
+        snd_ctl_elem_value_set_enumerated(elem_value, write->index + i,
+                                          write->value);
+        break;
+      case SND_CTL_ELEM_TYPE_BOOLEAN:
+        snd_ctl_elem_value_set_boolean(elem_value, write->index + i,
+                                       write->value);
+        break;
+      default:
+        return -1;
+    }
+  }
+
+  trace(ctl_write, log_get_txid(), write->card_num, write->numid,
+        write->value);
+
+  ret = snd_ctl_elem_write(*ctl, elem_value);
+
+  /* The card was removed, or reset, after the handle was opened */
+  if (ret == -ENODEV || ret == -EBADFD)
+  {
+    log_info("ALSA ctl of card %d is gone, opening it again",
+             write->card_num);
+    snd_ctl_close(*ctl);
+    *ctl = NULL;
+
+    if (alsaif_ctl_open(ctl, write->card_num) == 0)
+      ret = snd_ctl_elem_write(*ctl, elem_value);
+  }
+
+  trace(ctl_write_done, log_get_txid(), write->card_num, write->numid, ret);
+
+  if (ret < 0)
+  {
+    log_error("Failed to write value for numid %u of card %d: %s",
+              write->numid, write->card_num, snd_strerror(ret));
+    return -1;
+  }
+
+  return 0;
+}
+
 /**
  * Get control element value descriptor
  *
@@ -241,6 +389,33 @@ fail:
   return SND_CTL_ELEM_TYPE_NONE;
 }
 
+/**
+ * Open ctl handle of sound card for alsaif_write_apply()
+ *
+ * @param ctl       Pointer to store the handle, NULL on error
+ * @param card_num  Sound card number
+ *
+ * @return  -1 on error, 0 on success
+ */
+static int
+alsaif_ctl_open(snd_ctl_t **ctl, int card_num)
+{
+  char ctl_name[16];
+  int ret;
+
+  snprintf(ctl_name, sizeof(ctl_name), "hw:%d", card_num);
+  ret = snd_ctl_open(ctl, ctl_name, 0);
+
+  if (ret < 0)
+  {
+    log_error("Can't open '%s' ALSA ctl: %s", ctl_name, snd_strerror(ret));
+    *ctl = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
 /**
  * Add all sound cards data to alsaif.
  * @return  Zero if success, otherwise a negative error code
@@ -488,6 +663,7 @@ control_event_cb(GIOChannel *source, GIOCondition condition, gpointer data)
   char elem_str[256];
   char elem_value_str[256];
   long value;
+  int value_valid = TRUE;
   int ret;
 
   snd_ctl = snd_hctl_ctl(card->hctl);
@@ -508,6 +684,7 @@ control_event_cb(GIOChannel *source, GIOCondition condition, gpointer data)
 
   numid = snd_ctl_event_elem_get_numid(snd_ctl_event);
   event_mask = snd_ctl_event_elem_get_mask(snd_ctl_event);
+  trace(ctl_event, log_get_txid(), card->num, numid, event_mask);
   elem = alsaif_card_find_elem(card, numid);
 
   if (event_mask == SND_CTL_EVENT_MASK_REMOVE)
@@ -534,42 +711,29 @@ control_event_cb(GIOChannel *source, GIOCondition condition, gpointer data)
     if (!elem)
       return TRUE;
 
-    elem_value_str[0] = 0;
-
-    if (alsaif_ctl_get_value(elem, &value) >= 0)
+    if (alsaif_ctl_get_value(elem, &value) < 0)
+      value_valid = FALSE;
+    else if (priv.event_cb)  /* -> alsa_event_cb() */
     {
-      switch (elem->val_type)
-      {
-        case SND_CTL_ELEM_TYPE_INTEGER:
-          snprintf(elem_value_str, sizeof(elem_value_str),
-                  "[%ld]", value);
-          break;
-        case SND_CTL_ELEM_TYPE_ENUMERATED:
-          if ((unsigned int)value >= elem->descriptor.enum_t.count)
-          {
-            snprintf(elem_value_str, sizeof(elem_value_str),
-                    "[<invalid>]");
-          }
-          else
-          {
-            snprintf(elem_value_str, sizeof(elem_value_str),
-                    "[%s]", elem->descriptor.enum_t.names[value]);
-          }
-          break;
-        case SND_CTL_ELEM_TYPE_BOOLEAN:
-          snprintf(elem_value_str, sizeof(elem_value_str),
-                  "[%s]", value ? "on" : "off");
-          break;
-        default:
-          snprintf(elem_value_str, sizeof(elem_value_str),
-                  "[<unsupported>]");
-      }
+      alsaif_event event;
+
+      memset(&event, 0, sizeof(event));
+
+      event.type = EVENT_CTL_ELEM_VALUE;
+      event.elem.card_num = card->num;
+      event.elem.numid    = elem->numid;
+      event.elem.value    = value;
+
+      priv.event_cb(&event);
     }
 
+    /* The value is formatted only if the info level is enabled */
     if (priv.opts.log_val)
     {
       log_info("Element value changed %s %s",
-          alsaif_elem_to_str(elem, elem_str, sizeof(elem_str)), elem_value_str);
+          alsaif_elem_to_str(elem, elem_str, sizeof(elem_str)),
+          value_valid ? alsaif_value_to_str(elem, value, elem_value_str,
+                                            sizeof(elem_value_str)) : "");
     }
 
     return TRUE;
@@ -605,6 +769,41 @@ alsaif_card_to_str(alsaif_card *card, char *str, int size)
   return size_needed <= size ? str : "<buffer overflow>";
 }
 
+/**
+ * Put control element value to string.
+ * This is needed for logging.
+ *
+ * @param elem   alsaif_elem instance
+ * @param value  the value of the element
+ * @param str    pointer to the string buffer
+ * @param size   buffer size
+ *
+ * @return  Reference to the string
+ */
+static const char *
+alsaif_value_to_str(alsaif_elem *elem, long value, char *str, int size)
+{
+  switch (elem->val_type)
+  {
+    case SND_CTL_ELEM_TYPE_INTEGER:
+      snprintf(str, size, "[%ld]", value);
+      break;
+    case SND_CTL_ELEM_TYPE_ENUMERATED:
+      if ((unsigned int)value >= elem->descriptor.enum_t.count)
+        snprintf(str, size, "[<invalid>]");
+      else
+        snprintf(str, size, "[%s]", elem->descriptor.enum_t.names[value]);
+      break;
+    case SND_CTL_ELEM_TYPE_BOOLEAN:
+      snprintf(str, size, "[%s]", value ? "on" : "off");
+      break;
+    default:
+      snprintf(str, size, "[<unsupported>]");
+  }
+
+  return str;
+}
+
 /**
  * Add ALSA hctl element to alsaif_card controls
  *
@@ -695,11 +894,15 @@ alsaif_ctl_get_value(alsaif_elem *elem, long *value)
   snd_ctl_elem_value_t *elem_value;
   int ret;
 
+  trace(ctl_read, log_get_txid(), elem->alsaif_card->num, elem->numid);
+
   snd_ctl_elem_value_alloca(&elem_value);
   ret = snd_hctl_elem_read(elem->hctl, elem_value);
 
   if (ret < 0)
   {
+    trace(ctl_read_done, log_get_txid(), elem->alsaif_card->num,
+          elem->numid, 0L, ret);
     log_error("Failed to read value for %s: %s", elem->name, snd_strerror(ret));
     return -1;
   }
@@ -717,10 +920,13 @@ alsaif_ctl_get_value(alsaif_elem *elem, long *value)
       break;
     default:
       *value = 0;
-      return -1;
+      ret = -1;
   }
 
-  return 0;
+  trace(ctl_read_done, log_get_txid(), elem->alsaif_card->num, elem->numid,
+        *value, ret);
+
+  return ret < 0 ? -1 : 0;
 }
 
 /**
@@ -741,7 +947,10 @@ alsaif_ctl_set_value(alsaif_elem *elem, long *value)
 
   snd_ctl_elem_value_alloca(&elem_value);
 
-  for (i = 0;  elem->val_count > i;  i++)
+  trace(ctl_write, log_get_txid(), elem->alsaif_card->num, elem->numid,
+        *value);
+
+  for (i = 0, ret = 0;  elem->val_count > i && ret >= 0;  i++)
   {
     switch (elem->val_type)
     {
@@ -759,13 +968,16 @@ alsaif_ctl_set_value(alsaif_elem *elem, long *value)
     }
 
     ret = snd_hctl_elem_write(elem->hctl, elem_value);
+  }
 
-    if (ret < 0)
-    {
-      log_error("Failed to write value for %s: %s",
-                 elem->name, snd_strerror(ret));
-      return -1;
-    }
+  trace(ctl_write_done, log_get_txid(), elem->alsaif_card->num, elem->numid,
+        ret);
+
+  if (ret < 0)
+  {
+    log_error("Failed to write value for %s: %s",
+               elem->name, snd_strerror(ret));
+    return -1;
   }
 
   return 0;
@@ -14,7 +14,9 @@ enum alsaif_event_type {
   /** All control elements were added to a sound card */
   EVENT_CONTROLS_ADDED  = 1 << 1,
   /** Single control element was added just added */
-  EVENT_CTL_ELEM_ADDED  = 1 << 2
+  EVENT_CTL_ELEM_ADDED  = 1 << 2,
+  /** Control element value was changed */
+  EVENT_CTL_ELEM_VALUE  = 1 << 3
 };
 
 struct alsaif_event_card {
@@ -31,6 +33,8 @@ struct alsaif_event_elem {
   int   subdev;
   int   card_num;
   int   numid;
+  /* new value for EVENT_CTL_ELEM_VALUE */
+  long  value;
 };
 
 struct _alsaif_event {
@@ -57,12 +61,27 @@ union _value_descriptor {
   struct value_descriptor_int  int_t;
 };
 
+/** Control element write which can be applied from another thread */
+struct alsaif_write {
+  int                 card_num;
+  unsigned int        numid;
+  snd_ctl_elem_type_t val_type;
+  unsigned int        index;
+  unsigned int        val_count;
+  long                value;
+};
+
 
 void alsaif_set_cb    (alsaif_event_cb cb);
 int  alsaif_create    (void);
 int  alsaif_init      (struct options *options);
 int  alsaif_get_value (int cardnum, int numid, long *value);
 int  alsaif_set_value (int cardnum, int numid, long *value);
+int  alsaif_card_nums (int *nums, int len);
+
+int  alsaif_write_prepare (int cardnum, int numid, long *value,
+                           struct alsaif_write *write);
+int  alsaif_write_apply   (snd_ctl_t **ctl, struct alsaif_write *write);
 
 snd_ctl_elem_type_t
 alsaif_get_value_descriptor(int cardnum,
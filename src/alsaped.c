@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <sched.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <pwd.h>
 
 #include "logging.h"
@@ -19,6 +20,11 @@
 #include "alsaif.h"
 #include "dbusif.h"
 #include "config.h"
+#include "queue.h"
+#include "worker.h"
+#include "sockif.h"
+#include "stats.h"
+#include "timeline.h"
 
 
 static struct {
@@ -30,14 +36,18 @@ static struct {
 
 static void parse_options (int, char **, struct options *);
 static void sig_handler   (int);
+static gboolean stats_signal_cb (gpointer);
 static int  daemonize     (uid_t, const char *);
 static void set_rt_prio   (int prio);
+static int  read_line     (char *buf, size_t size);
 
 
 static gboolean
 stdin_handler(GIOChannel *source, GIOCondition condition, gpointer data)
 {
   char buf;
+  char line[256];
+  char *entry;
   ssize_t bytes_read;
   static long value = 0;
 
@@ -80,6 +90,19 @@ stdin_handler(GIOChannel *source, GIOCondition condition, gpointer data)
       control_run_rules_for_entry(rule_sink, "ihf");
       break;
 
+    case 'S':
+      /* S<section> <entry> */
+      if (read_line(line, sizeof(line)) < 0 ||
+          !(entry = strchr(line, ' ')))
+      {
+        log_error("Usage: S<section> <entry>");
+        break;
+      }
+
+      *entry++ = '\0';
+      control_trigger(line, entry);
+      break;
+
     case 'V':
       alsaif_get_value(0, 1, &value);
       printf("value = %ld\n", value);
@@ -92,6 +115,43 @@ stdin_handler(GIOChannel *source, GIOCondition condition, gpointer data)
   return TRUE;
 }
 
+/**
+ * Read the rest of the line from stdin
+ *
+ * @param buf   buffer to store the line without trailing newline
+ * @param size  buffer size
+ *
+ * @return  -1 on error or if the line is too long, 0 otherwise
+ */
+static int
+read_line(char *buf, size_t size)
+{
+  size_t len = 0;
+  ssize_t bytes_read;
+  char c;
+
+  while (len < size)
+  {
+    bytes_read = read(STDIN_FILENO, &c, 1);
+
+    if (bytes_read < 0 && errno == EINTR)  /* Interrupted system call */
+      continue;
+
+    if (bytes_read != 1)
+      return -1;
+
+    if (c == '\n')
+    {
+      buf[len] = '\0';
+      return 0;
+    }
+
+    buf[len++] = c;
+  }
+
+  return -1;
+}
+
 static void
 setup_interact()
 {
@@ -136,13 +196,16 @@ int main(int argc, char **argv)
       config_init(&options) < 0 ||
       control_init(&options) < 0 ||
       alsaif_init(&options) < 0 ||
-      dbusif_init(&options) < 0)
+      queue_init(&options) < 0 ||
+      worker_init(&options) < 0 ||
+      dbusif_init(&options) < 0 ||
+      sockif_init(&options) < 0)
   {
     fputs("Error during initialization\n", stderr);
     return EINVAL;
   }
 
-  if (options.daemon && !options.list_and_exit &&
+  if (options.daemon && !options.list_and_exit && !options.check_and_exit &&
       daemonize(options.uid, options.work_dir) < 0)
   {
     retval = errno;
@@ -150,6 +213,14 @@ int main(int argc, char **argv)
     return retval;
   }
 
+  /* After daemonize(), threads don't survive fork() */
+  if (log_create() < 0)
+    log_error("Logger thread creation failed: %s", strerror(errno));
+
+  /* After daemonize() too, the parent would close it at exit */
+  if (timeline_open(options.timeline) < 0)
+    return EIO;
+
   priv.main_loop = g_main_loop_new(NULL, FALSE);
   if (!priv.main_loop)
   {
@@ -161,27 +232,45 @@ int main(int argc, char **argv)
   {
     control_set_cb();
 
-    if (config_parse() < 0)
+    if (config_parse() < 0 || control_compile() < 0)
     {
       log_error("Configuration file error");
       return errno;
     }
   }
 
+  if (options.check_and_exit)
+    return control_conflicts() ? EINVAL : 0;
+
   alsaif_create();
 
   if (options.list_and_exit)
     return 0;
 
+  if (worker_create() < 0)
+  {
+    log_error("Worker thread creation failed");
+    return errno;
+  }
+
   if (dbusif_create() < 0)
   {
     log_error("D-Bus interface creation failed");
     return errno;
   }
 
+  if (sockif_create() < 0)
+  {
+    log_error("Control socket creation failed");
+    return errno;
+  }
+
   if (options.interact)
     setup_interact();
 
+  /* Dumped from the main loop, not from the signal handler */
+  g_unix_signal_add(SIGUSR1, stats_signal_cb, NULL);
+
   if (options.rt_prio)
     set_rt_prio(options.rt_prio);
 
@@ -198,7 +287,7 @@ static void
 help_exit(int argc, char **argv, int status)
 {
   printf(
-    "Usage: %s [-h] [-d] [-u user] [-p priority] [-f config_file] [-l] [-v] [-r] [-b] [-e] [-m error,info,warning]\n",
+    "Usage: %s [-h] [-d] [-u user] [-p priority] [-f config_file] [-l] [-c] [-w msec] [-t] [-s socket] [-R file] [-T file] [-S] [-v] [-r] [-b] [-e] [-m error,info,warning]\n",
     basename(argv[0]));
   puts("\th\t\tprint this help message and exit");
   puts("\td\t\trun as a daemon");
@@ -208,6 +297,16 @@ help_exit(int argc, char **argv, int status)
   puts("\tf config_file\tconfig file path. If not specified the");
   puts("\t\t\tdefault config file is /etc/alsaped.conf");
   puts("\tl\t\tprint the list of the detected ALSA controls and exit");
+  puts("\tc\t\tcheck the config file, report the controls set by");
+  puts("\t\t\tseveral sections and exit");
+  puts("\tw msec\t\tmerge the policy actions received within msec and");
+  puts("\t\t\tapply them at once, instead of on idle");
+  puts("\tt\t\tapply ALSA settings on worker threads, one per card");
+  puts("\ts socket\taccept policy actions on unix socket");
+  puts("\tR file\t\trecord the policy decisions received over D-Bus");
+  puts("\tT file\t\twrite a timeline of the decisions in Chrome trace");
+  puts("\t\t\tformat, for chrome://tracing and Perfetto");
+  puts("\tS\t\tuse the session bus instead of the system bus");
   puts("\tv\t\tlog the value changes of the ALSA controls");
   puts("\tr\t\tlog the parsed rules");
   puts("\tb\t\tlog D-Bus message related information");
@@ -225,7 +324,7 @@ parse_options(int argc, char **argv, struct options *options)
   char *args;
   int c;
 
-  while ((c = getopt(argc, argv, "diu:f:hp:lvrbem:")) != -1)
+  while ((c = getopt(argc, argv, "diu:f:hp:lcw:ts:R:T:Svrbem:")) != -1)
   {
     switch (c)
     {
@@ -235,6 +334,11 @@ parse_options(int argc, char **argv, struct options *options)
         options->dbusif.log = TRUE;
         break;
 
+      case 'c':
+        /* Check config file and exit */
+        options->check_and_exit = TRUE;
+        break;
+
       case 'd':
         /* Run as a daemon */
         options->daemon = TRUE;
@@ -286,17 +390,17 @@ parse_options(int argc, char **argv, struct options *options)
         {
           if (!strncmp(args, "error", 5))
           {
-            options->log_mask |= LOG_LEVEL_ERROR;
+            options->log_mask |= LOG_FLAG_ERROR;
             args += 5;
           }
           else if (!strncmp(args, "warning", 7))
           {
-            options->log_mask |= LOG_LEVEL_WARNING;
+            options->log_mask |= LOG_FLAG_WARNING;
             args += 7;
           }
           else if (!strncmp(args, "info", 4))
           {
-            options->log_mask |= LOG_LEVEL_INFO;
+            options->log_mask |= LOG_FLAG_INFO;
             args += 4;
           }
           else
@@ -330,6 +434,37 @@ parse_options(int argc, char **argv, struct options *options)
         options->log_parsed_rules = TRUE;
         break;
 
+      case 't':
+        /* Apply ALSA settings on a worker thread */
+        options->worker = TRUE;
+        break;
+
+      case 's':
+        /* Control socket path */
+        if (!optarg || !*optarg)
+          help_exit(argc, argv, EINVAL);
+        options->sockif.path = optarg;
+        break;
+
+      case 'R':
+        /* Record the received policy decisions */
+        if (!optarg || !*optarg)
+          help_exit(argc, argv, EINVAL);
+        options->dbusif.record = optarg;
+        break;
+
+      case 'T':
+        /* Write timeline of the decisions */
+        if (!optarg || !*optarg)
+          help_exit(argc, argv, EINVAL);
+        options->timeline = optarg;
+        break;
+
+      case 'S':
+        /* Use the session bus */
+        options->dbusif.session = TRUE;
+        break;
+
       case 'u':
         /* If daemonized, run as user */
         if (!optarg && !*optarg)
@@ -353,6 +488,17 @@ parse_options(int argc, char **argv, struct options *options)
 
         break;
 
+      case 'w':
+        /* Coalescing window of policy actions */
+        if (!optarg)
+          help_exit(argc, argv, EINVAL);
+
+        options->dbusif.window = strtol(optarg, &endptr, 10);
+        if (endptr == optarg || *endptr || options->dbusif.window < 0)
+          help_exit(argc, argv, EINVAL);
+
+        break;
+
       case 'v':
         /* Log ALSA ctls changes */
         options->log_mask = LOG_MASK_ALL;
@@ -364,6 +510,10 @@ parse_options(int argc, char **argv, struct options *options)
     }
   }
 
+  /* The controls set by sections of equal priority are warnings */
+  if (options->check_and_exit)
+    options->log_mask |= LOG_FLAG_WARNING;
+
   if (!options->daemon && options->uid)
     puts("Warning: -d is not present; ignoring -u option");
 }
@@ -381,6 +531,18 @@ sig_handler(int signal)
   g_main_loop_quit(priv.main_loop);
 }
 
+/**
+ * SIGUSR1 callback: log the statistics
+ */
+static gboolean
+stats_signal_cb(gpointer data)
+{
+  stats_dump();
+  control_stats_dump();
+
+  return G_SOURCE_CONTINUE;
+}
+
 static int
 daemonize(uid_t uid, const char *cwd)
 {
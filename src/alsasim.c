@@ -0,0 +1,339 @@
+/**
+ * @file alsasim.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Simulated ALSA interface. Implements alsaif.h without sound hardware:
+ * a sound card is simulated for every card of the config file and a
+ * control element for every control defined for it. The elements are
+ * enumerated, their items are the values the rules set, so every rule
+ * resolves. A write can be made to take time like a write to a slow
+ * codec.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "alsaif.h"
+#include "control.h"
+#include "logging.h"
+
+#include "alsasim.h"
+
+#define CARDS_COUNT 32
+
+/* Simulated control element */
+struct sim_elem {
+  value_descriptor descriptor;
+  long value;
+};
+
+/* Simulated sound card */
+struct sim_card {
+  struct sim_elem *elems;
+  int elems_len;
+};
+
+/* Private structure */
+static struct {
+  alsaif_event_cb event_cb;
+  struct sim_card cards[CARDS_COUNT];
+  int cards_len;
+  useconds_t delay;
+  atomic_int writes;
+} priv;
+
+
+static void sim_card_add  (struct card_def *, void *);
+static void sim_elem_init (struct sim_elem *, struct elem_def *);
+static struct sim_elem *sim_elem_find (int, int);
+static int  sim_write     (int, int, long);
+
+
+/**
+ * Initialize alsaif options
+ * @param options  options parsed from command line
+ * @return  always zero
+ */
+int
+alsaif_init(struct options *options)
+{
+  return 0;
+}
+
+/**
+ * Set alsaif callback function
+ * @param cb  the callback
+ */
+void
+alsaif_set_cb(alsaif_event_cb cb)
+{
+  priv.event_cb = cb;
+}
+
+/**
+ * Set time a control element write takes
+ * @param usec  the time in microseconds
+ */
+void
+alsasim_set_delay(useconds_t usec)
+{
+  priv.delay = usec;
+}
+
+/**
+ * Get number of control element writes
+ * @return  the writes done so far
+ */
+int
+alsasim_writes()
+{
+  return atomic_load(&priv.writes);
+}
+
+/**
+ * Simulate the sound cards of the parsed config file
+ * @return  always zero
+ */
+int
+alsaif_create()
+{
+  control_foreach_card(sim_card_add, NULL);
+  return 0;
+}
+
+/**
+ * Simulate sound card and report it with its control elements
+ *
+ * @param card_def  card definition of the config file
+ * @param data      unused
+ */
+static void
+sim_card_add(struct card_def *card_def, void *data)
+{
+  struct sim_card *card;
+  struct elem_def *elem_def;
+  alsaif_event event;
+  char id[16], name[32];
+  int num, i;
+
+  if (priv.cards_len == CARDS_COUNT)
+  {
+    log_error("Too many sound cards to simulate");
+    return;
+  }
+
+  num  = priv.cards_len++;
+  card = &priv.cards[num];
+
+  for (elem_def = card_def->elem_list;  elem_def;  elem_def = elem_def->next)
+    card->elems_len++;
+
+  card->elems = g_new0(struct sim_elem, card->elems_len);
+
+  /* Wildcards of the config file match anything, simulate something */
+  snprintf(id, sizeof(id), "sim%d", num);
+  snprintf(name, sizeof(name), "Simulated %d", num);
+
+  memset(&event, 0, sizeof(event));
+  event.type      = EVENT_SOUNDCARD_ADDED;
+  event.card.id   = strcmp(card_def->id, "*") ? card_def->id : id;
+  event.card.name = strcmp(card_def->name, "*") ? card_def->name : name;
+  event.card.num  = num;
+  priv.event_cb(&event);
+
+  for (i = 0, elem_def = card_def->elem_list;  elem_def;
+       i++, elem_def = elem_def->next)
+  {
+    sim_elem_init(&card->elems[i], elem_def);
+
+    memset(&event, 0, sizeof(event));
+    event.type          = EVENT_CTL_ELEM_ADDED;
+    event.elem.ifname   = strcmp(elem_def->ifname, "*") ?
+                          elem_def->ifname : "MIXER";
+    event.elem.name     = strcmp(elem_def->name, "*") ?
+                          elem_def->name : "Simulated";
+    event.elem.index    = elem_def->index  < 0 ? 0 : elem_def->index;
+    event.elem.dev      = elem_def->dev    < 0 ? 0 : elem_def->dev;
+    event.elem.subdev   = elem_def->subdev < 0 ? 0 : elem_def->subdev;
+    event.elem.card_num = num;
+    event.elem.numid    = i + 1;
+    priv.event_cb(&event);
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.type     = EVENT_CONTROLS_ADDED;
+  event.card.num = num;
+  priv.event_cb(&event);
+
+  log_info("Simulated card %d '%s' with %d controls", num,
+           card_def->name, card->elems_len);
+}
+
+/**
+ * Make the values set by the rules of control element the items of the
+ * simulated element
+ *
+ * @param elem      simulated element
+ * @param elem_def  element definition of the config file
+ */
+static void
+sim_elem_init(struct sim_elem *elem, struct elem_def *elem_def)
+{
+  struct value_descriptor_enum *desc = &elem->descriptor.enum_t;
+  struct rule_def *rule;
+  int count = 0;
+  int i;
+
+  for (rule = elem_def->rule;  rule;  rule = rule->elem_rule)
+    count++;
+
+  desc->names = g_new0(char *, count);
+
+  for (rule = elem_def->rule;  rule;  rule = rule->elem_rule)
+  {
+    for (i = 0;  i < desc->count;  i++)
+    {
+      if (!strcmp(desc->names[i], rule->value_str))
+        break;
+    }
+
+    if (i == desc->count)
+      desc->names[desc->count++] = rule->value_str;
+  }
+}
+
+/**
+ * Find simulated control element
+ *
+ * @param card_num  sound card number
+ * @param numid     control element numid
+ *
+ * @return  the element or NULL if not found
+ */
+static struct sim_elem *
+sim_elem_find(int card_num, int numid)
+{
+  if (card_num < 0 || card_num >= priv.cards_len ||
+      numid < 1 || numid > priv.cards[card_num].elems_len)
+  {
+    log_error("%s(): Can't find control element (card=%d,numid=%d)",
+              __func__, card_num, numid);
+    return NULL;
+  }
+
+  return &priv.cards[card_num].elems[numid - 1];
+}
+
+/* The functions below behave like the ones of alsaif.c */
+
+snd_ctl_elem_type_t
+alsaif_get_value_descriptor(int card_num, int numid,
+                            value_descriptor **descriptor)
+{
+  struct sim_elem *elem;
+
+  if (!descriptor || !(elem = sim_elem_find(card_num, numid)))
+    return 0;
+
+  *descriptor = &elem->descriptor;
+
+  return SND_CTL_ELEM_TYPE_ENUMERATED;
+}
+
+int
+alsaif_get_value(int card_num, int numid, long *value)
+{
+  struct sim_elem *elem;
+
+  if (!value || !(elem = sim_elem_find(card_num, numid)))
+    return -1;
+
+  *value = elem->value;
+
+  return 0;
+}
+
+int
+alsaif_set_value(int card_num, int numid, long *value)
+{
+  if (!value)
+    return -1;
+
+  if (card_num == -1 || numid == -1)
+    return 0;
+
+  return sim_write(card_num, numid, *value);
+}
+
+int
+alsaif_card_nums(int *nums, int len)
+{
+  int i;
+
+  for (i = 0;  i < priv.cards_len && i < len;  i++)
+    nums[i] = i;
+
+  return i;
+}
+
+int
+alsaif_write_prepare(int card_num, int numid, long *value,
+                     struct alsaif_write *write)
+{
+  if (!value || !write)
+    return -1;
+
+  if (card_num == -1 || numid == -1)
+    return 1;
+
+  if (!sim_elem_find(card_num, numid))
+    return -1;
+
+  memset(write, 0, sizeof(*write));
+  write->card_num  = card_num;
+  write->numid     = numid;
+  write->val_type  = SND_CTL_ELEM_TYPE_ENUMERATED;
+  write->val_count = 1;
+  write->value     = *value;
+
+  return 0;
+}
+
+int
+alsaif_write_apply(snd_ctl_t **ctl, struct alsaif_write *write)
+{
+  return sim_write(write->card_num, write->numid, write->value);
+}
+
+/**
+ * Write simulated control element. Each card is written by one thread
+ * at a time, so only the write counter is shared.
+ *
+ * @param card_num  sound card number
+ * @param numid     control element numid
+ * @param value     the value
+ *
+ * @return  -1 if error, 0 if success
+ */
+static int
+sim_write(int card_num, int numid, long value)
+{
+  struct sim_elem *elem;
+
+  if (!(elem = sim_elem_find(card_num, numid)))
+    return -1;
+
+  if (priv.delay)
+    usleep(priv.delay);
+
+  elem->value = value;
+  atomic_fetch_add(&priv.writes, 1);
+
+  return 0;
+}
+
+/** @} */
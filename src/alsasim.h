@@ -0,0 +1,10 @@
+#ifndef ALSASIM_H
+#define ALSASIM_H
+
+#include <unistd.h>
+
+void alsasim_set_delay (useconds_t usec);
+int  alsasim_writes    (void);
+
+
+#endif  /* ALSASIM_H */
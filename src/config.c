@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <fnmatch.h>
 
 #include "control.h"
 #include "logging.h"
@@ -31,6 +32,10 @@ enum section_type {
   section_context,
   /* [default] */
   section_default,
+  /* [section name] */
+  section_custom,
+  /* [priority] */
+  section_priority,
   section_max
 };
 
@@ -62,6 +67,9 @@ struct ruldef {
 struct section {
   enum section_type type;
   int  lineno;
+  /* name and rule type of rule sections */
+  char *name;
+  enum rule_type rule_type;
   union {
     void           *any;
     struct elemdef *elem;
@@ -107,6 +115,15 @@ struct entrytbl {
   struct entrytbl_elem **array;
 };
 
+/* List of strings produced by template expansion */
+struct strlist {
+  int len;
+  char **array;
+};
+
+/* Upper limit for the number of strings a single template expands to */
+#define TEMPLATE_MAX 1024
+
 /* Private structure */
 static struct {
   char *path;
@@ -118,21 +135,27 @@ static struct {
 
 
 static int preprocess_buffer         (int, char *, char *);
-static int section_header            (int, char *, enum section_type *);
-static int section_open              (enum section_type, struct section *);
+static int section_header            (int, char *, enum section_type *,
+                                      char **);
+static int section_open              (int, enum section_type, char *,
+                                      struct section *);
 static int section_close             (struct section *);
 static int elemdef_parse             (int, char *, struct elemdef *);
 static int ruldef_parse_outband      (int, char *, struct ruldef *);
 static int ruldef_parse_suspend      (int, char *line, struct ruldef *);
 static int ruldef_parse_alsa_setting (int, char *, struct ruldef *);
 static int ruldef_parse_deflt        (int, char *, struct ruldef *);
-static int create_rule_outband       (enum section_type, struct ruldef *, int);
-static int create_rule_suspend       (enum section_type, struct ruldef *, int);
-static int create_rule_alsa_setting  (enum section_type, struct ruldef *, int);
+static int priority_parse            (int, char *);
+static int create_rule_outband       (struct section *, struct ruldef *, int);
+static int create_rule_suspend       (struct section *, struct ruldef *, int);
+static int create_rule_alsa_setting  (struct section *, struct ruldef *, int);
 static int create_deflt              (struct ruldef *, int);
-static int create_elem               (struct elemdef *);
+static int create_elem               (struct elemdef *, int);
 static int num_parse                 (int, const char *, unsigned int *);
 static int valid_entry               (int, char *);
+static int template_expand           (int, const char *, struct strlist *);
+static void strlist_free             (struct strlist *);
+static int strlist_add               (int, struct strlist *, const char *);
 
 static int elemtbl_add_elem          (struct elemtbl *, char *,
                                       struct card_def *, char *,
@@ -149,6 +172,7 @@ static struct ruldef    *ruldef_create        (void);
 static struct elemdef   *elemdef_free         (struct elemdef *);
 static struct ruldef    *ruldef_free          (struct ruldef *);
 static struct entry_def *entrytbl_get_entry   (struct entrytbl *, char *);
+static struct entry_def *section_get_entry    (struct section *, char *, int);
 
 static struct card_def  *cardtbl_get_card_def (struct cardtbl *,
                                                char *, char *);
@@ -156,6 +180,10 @@ static struct card_def  *cardtbl_get_card_def (struct cardtbl *,
 static struct elem_def  *elemtbl_find_by_id   (struct elemtbl *, char *,
                                                struct card_def **);
 
+static int               elemtbl_match        (struct elemtbl *, int,
+                                               const char *,
+                                               struct elemtbl *);
+
 /**
  * Initialize config options
  * @param options  Options parsed from command line
@@ -191,6 +219,7 @@ int config_parse()
   char line[BUFSIZE];
   int lineno, ret;
   enum section_type newsect;
+  char *newname;
   struct elemdef *elemdef;
   struct ruldef  *rule;
   int status = 0;
@@ -215,7 +244,7 @@ int config_parse()
     if (*line == '\0')
       continue;
 
-    if (section_header(lineno, line, &newsect))
+    if (section_header(lineno, line, &newsect, &newname))
     {
       if (section_close(&section) < 0)
         status = -1;
@@ -223,7 +252,7 @@ int config_parse()
       section.type = newsect;
       section.lineno = lineno;
 
-      if (section_open(newsect, &section) < 0)
+      if (section_open(lineno, newsect, newname, &section) < 0)
         status = -1;
 
       continue;
@@ -240,6 +269,7 @@ int config_parse()
       case section_sink:
       case section_source:
       case section_context:
+      case section_custom:
         rule = section.def.rule;
 
         if ((ret = ruldef_parse_outband(lineno, line, rule)) < 0)
@@ -247,7 +277,7 @@ int config_parse()
 
         if (ret == 0)
         {
-          if (create_rule_outband(section.type, rule, lineno) < 0)
+          if (create_rule_outband(&section, rule, lineno) < 0)
             goto invalid;
 
           break;
@@ -258,14 +288,14 @@ int config_parse()
 
         if (ret == 0)
         {
-          if (create_rule_suspend(section.type, rule, lineno) < 0)
+          if (create_rule_suspend(&section, rule, lineno) < 0)
             goto invalid;
 
           break;
         }
 
         if ((ret = ruldef_parse_alsa_setting(lineno, line, rule)) == 0 &&
-            create_rule_alsa_setting(section.type, rule, lineno) >= 0)
+            create_rule_alsa_setting(&section, rule, lineno) >= 0)
         {
             break;
         }
@@ -282,6 +312,10 @@ invalid:
           status = -1;
         }
         break;
+      case section_priority:
+        if (priority_parse(lineno, line) < 0)
+          status = -1;
+        break;
       default:
         break;
     }
@@ -311,7 +345,7 @@ invalid:
 static int
 preprocess_buffer(int lineno, char *inbuf, char *outbuf)
 {
-  char c;
+  unsigned char c;
   int quote;
   int status = 0;
 
@@ -356,15 +390,21 @@ preprocess_buffer(int lineno, char *inbuf, char *outbuf)
  * @param lineno  config file line number
  * @param line    line from config file
  * @param type    pointer to return section type
+ * @param name    pointer to return the name of [section name]
  *
  * @return  1 if line is a header of section, 0 otherwise
  */
 static int
-section_header(int lineno, char *line, enum section_type *type)
+section_header(int lineno, char *line, enum section_type *type, char **name)
 {
-  if (line[0] != '[')
+  size_t len = strlen(line);
+
+  /* Lines like "[lr]-dac-switch:Off" are glob patterns, not headers */
+  if (line[0] != '[' || line[len - 1] != ']')
     return 0;
 
+  *name = NULL;
+
   if (!strcmp(line, "[control]"))
     *type = section_control;
   else if (!strcmp(line, "[sink-route]"))
@@ -375,6 +415,16 @@ section_header(int lineno, char *line, enum section_type *type)
     *type = section_context;
   else if (!strcmp(line, "[default]"))
     *type = section_default;
+  else if (!strcmp(line, "[priority]"))
+    *type = section_priority;
+  else if (!strncmp(line, "[section", 8) && len > 9)
+  {
+    /* Blanks are already removed: "[section accessory]" is
+     * "[sectionaccessory]" here */
+    line[len - 1] = '\0';
+    *name = line + 8;
+    *type = section_custom;
+  }
   else
   {
     *type = section_unknown;
@@ -387,14 +437,18 @@ section_header(int lineno, char *line, enum section_type *type)
 /**
  * Allocate section structure
  *
- * @param type  section type
- * @param sec   section structure
+ * @param lineno  config file line number
+ * @param type    section type
+ * @param name    section name for [section name], NULL otherwise
+ * @param sec     section structure
  *
  * @return  -1 if error, 0 if OK
  */
 static int
-section_open(enum section_type type, struct section *sec)
+section_open(int lineno, enum section_type type, char *name,
+             struct section *sec)
 {
+  enum rule_type rule_type;
   int status;
 
   if (!sec)
@@ -408,13 +462,68 @@ section_open(enum section_type type, struct section *sec)
       break;
 
     case section_sink:
+      sec->name = strdup("sink-route");
+      sec->rule_type = rule_sink;
+      sec->def.rule = ruldef_create();
+      status = 0;
+      break;
+
     case section_source:
+      sec->name = strdup("source-route");
+      sec->rule_type = rule_source;
+      sec->def.rule = ruldef_create();
+      status = 0;
+      break;
+
     case section_context:
+      sec->name = strdup("context");
+      sec->rule_type = rule_context;
+      sec->def.rule = ruldef_create();
+      status = 0;
+      break;
+
+    case section_custom:
+      if (!valid_entry(lineno, name))
+      {
+        type = section_unknown;
+        status = -1;
+        break;
+      }
+
+      /* The section may be continued in another [section name] */
+      rule_type = control_find_section(name);
+
+      if (rule_type == rule_unknown)
+        rule_type = control_define_section(name);
+      else if (rule_type < rule_max)
+      {
+        log_error("Section name '%s' is reserved in line %d", name, lineno);
+        rule_type = -1;
+      }
+
+      if ((int)rule_type < 0)
+      {
+        type = section_unknown;
+        status = -1;
+        break;
+      }
+
+      sec->name = strdup(name);
+      sec->rule_type = rule_type;
+      sec->def.rule = ruldef_create();
+      status = 0;
+      break;
+
     case section_default:
       sec->def.rule = ruldef_create();
       status = 0;
       break;
 
+    case section_priority:
+      sec->def.any = NULL;
+      status = 0;
+      break;
+
     default:
       type = section_unknown;
       sec->def.any = NULL;
@@ -442,7 +551,7 @@ section_close(struct section *sec)
   switch(sec->type)
   {
     case section_control:
-      status = create_elem(sec->def.elem);
+      status = create_elem(sec->def.elem, sec->lineno);
       sec->def.elem = elemdef_free(sec->def.elem);
       break;
     case section_unknown:
@@ -453,42 +562,87 @@ section_close(struct section *sec)
       sec->def.rule = ruldef_free(sec->def.rule);
   }
 
+  free(sec->name);
+
   sec->type = section_unknown;
+  sec->name = NULL;
+  sec->rule_type = rule_unknown;
   sec->def.any = NULL;
 
   return status;
 }
 
 /**
- * Add parsed control element to daemon
+ * Add parsed control element to daemon. Templates in id and name are
+ * expanded here, so a single section may define a group of controls.
+ *
  * @param elemdef  parsed control element definition
+ * @param lineno   config file reference (section header)
+ *
  * @return  0 on success, -1 on error
  */
 static int
-create_elem(struct elemdef *elemdef)
+create_elem(struct elemdef *elemdef, int lineno)
 {
   struct card_def *card_def;
-  int status;
+  struct strlist ids;
+  struct strlist names;
+  char *id, *name;
+  int status = 0;
+  int i;
 
-  if (priv.log_parsed_rules)
+  memset(&ids, 0, sizeof(ids));
+  memset(&names, 0, sizeof(names));
+
+  if (template_expand(lineno, elemdef->id, &ids) < 0 ||
+      template_expand(lineno, elemdef->name, &names) < 0)
   {
-    log_info(
-        "Create elem: id='%s' card='%s', ifname='%s', name='%s' index=%u device=%u, subdev=%u",
-        elemdef->id    ? elemdef->id    : "<null>",
-        elemdef->card  ? elemdef->card  : "<null>",
-        elemdef->iface ? elemdef->iface : "<null>",
-        elemdef->name  ? elemdef->name  : "<null>",
-        elemdef->index, elemdef->dev, elemdef->subdev);
+    status = -1;
+    goto out;
   }
 
-  if ((card_def = cardtbl_get_card_def(priv.cardtbl, NULL, elemdef->card)))
+  if (ids.len != names.len && names.len != 1)
   {
-    status = elemtbl_add_elem(
-        priv.elemtbl, elemdef->id, card_def, elemdef->iface, elemdef->name,
-        elemdef->index, elemdef->dev, elemdef->subdev);
-  }
-  else
+    log_error("Control id expands to %d items, but name to %d (section in line %d)",
+              ids.len, names.len, lineno);
     status = -1;
+    goto out;
+  }
+
+  for (i = 0;  i < ids.len;  i++)
+  {
+    id   = ids.array[i];
+    name = names.array[names.len == 1 ? 0 : i];
+
+    if (priv.log_parsed_rules)
+    {
+      log_info(
+          "Create elem: id='%s' card='%s', ifname='%s', name='%s' index=%u device=%u, subdev=%u",
+          id             ? id             : "<null>",
+          elemdef->card  ? elemdef->card  : "<null>",
+          elemdef->iface ? elemdef->iface : "<null>",
+          name           ? name           : "<null>",
+          elemdef->index, elemdef->dev, elemdef->subdev);
+    }
+
+    if (id && strpbrk(id, "*?[]"))
+    {
+      log_error("Invalid control id '%s' in section at line %d", id, lineno);
+      status = -1;
+      continue;
+    }
+
+    if (!(card_def = cardtbl_get_card_def(priv.cardtbl, NULL, elemdef->card)) ||
+        elemtbl_add_elem(priv.elemtbl, id, card_def, elemdef->iface, name,
+                         elemdef->index, elemdef->dev, elemdef->subdev) < 0)
+    {
+      status = -1;
+    }
+  }
+
+out:
+  strlist_free(&ids);
+  strlist_free(&names);
 
   return status;
 }
@@ -496,77 +650,74 @@ create_elem(struct elemdef *elemdef)
 /**
  * Add parsed set value rule to daemon
  *
- * @param section  section type
+ * @param section  section the rule belongs to
  * @param rule     rule definition parsed from config file
  * @param lineno   config file reference
  *
  * @return         0 if success, -1 if error
  */
 static int
-create_rule_alsa_setting(enum section_type section,
+create_rule_alsa_setting(struct section *section,
                          struct ruldef *rule,
                          int lineno)
 {
   enum rule_type rule_type;
   const char *rule_type_str;
   struct entry_def *entry_def;
-  struct card_def *card_def;
-  struct elem_def *elem_def;
+  struct elemtbl_elem *elem;
+  struct elemtbl matches;
   int status;
+  int i;
 
-  switch (section)
-  {
-    case section_sink:
-      rule_type = rule_sink;
-      rule_type_str = "sink-route";
-      break;
-    case section_source:
-      rule_type = rule_source;
-      rule_type_str = "source-route";
-      break;
-    case section_context:
-      rule_type = rule_context;
-      rule_type_str = "context";
-      break;
-    default:
-      rule_type = rule_unknown;
-      rule_type_str = "<unknown>";
-      break;
-  }
+  rule_type = section->rule_type;
+  rule_type_str = section->name ? section->name : "<unknown>";
 
-  if (priv.log_parsed_rules)
+  if (rule_type == rule_unknown ||
+      !(entry_def = section_get_entry(section, rule->entry, lineno)))
   {
-    log_info(
-        "Create rule: type=%s entry='%s' action=alsa_setting, elemid='%s' value='%s'",
-        rule_type_str,
-        rule->entry  ? rule->entry  : "<null>",
-        rule->elemid ? rule->elemid : "<null>",
-        rule->value  ? rule->value  : "<null>");
+    return -1;
   }
 
-  if (rule_type == rule_unknown ||
-      !(entry_def = entrytbl_get_entry(priv.entrytbl, rule->entry)) ||
-      !(elem_def = elemtbl_find_by_id(priv.elemtbl, rule->elemid, &card_def)) ||
-      !control_define_rule_alsa_setting(rule_type, entry_def, card_def,
-                                        elem_def, rule->value, lineno))
+  memset(&matches, 0, sizeof(matches));
+  status = elemtbl_match(priv.elemtbl, lineno, rule->elemid, &matches);
+
+  for (i = 0;  i < matches.len;  i++)
   {
-    return -1;
+    elem = matches.array[i];
+
+    if (priv.log_parsed_rules)
+    {
+      log_info(
+          "Create rule: type=%s entry='%s' action=alsa_setting, elemid='%s' value='%s'",
+          rule_type_str,
+          rule->entry  ? rule->entry  : "<null>",
+          elem->id,
+          rule->value  ? rule->value  : "<null>");
+    }
+
+    if (!control_define_rule_alsa_setting(rule_type, entry_def, elem->card,
+                                          elem->elem, rule->value, lineno))
+    {
+      status = -1;
+    }
   }
 
-  return 0;
+  free(matches.array);
+
+  return status;
 }
 
 /**
  * Add outband execution rule to daemon
  *
- * @param section  section type
+ * @param section  section the rule belongs to
  * @param rule     rule definition parsed from config
  * @param lineno   config file reference
  *
  * @return         -1 if error, 0 if success
  */
 static int
-create_rule_outband(enum section_type section,
+create_rule_outband(struct section *section,
                     struct ruldef *rule,
                     int lineno)
 {
@@ -575,25 +726,8 @@ create_rule_outband(enum section_type section,
   struct entry_def *entry_def;
   int status;
 
-  switch (section)
-  {
-    case section_sink:
-      rule_type = rule_sink;
-      rule_type_str = "sink-route";
-      break;
-    case section_source:
-      rule_type = rule_source;
-      rule_type_str = "source-route";
-      break;
-    case section_context:
-      rule_type = rule_context;
-      rule_type_str = "context";
-      break;
-    default:
-      rule_type = rule_unknown;
-      rule_type_str = "<unknown>";
-      break;
-  }
+  rule_type = section->rule_type;
+  rule_type_str = section->name ? section->name : "<unknown>";
 
   if (rule->action == action_outband_execution ||
       rule->action == action_outband_cancellation)
@@ -620,7 +754,7 @@ create_rule_outband(enum section_type section,
     rule_type = rule_unknown;
 
   if (rule_type == rule_unknown ||
-      !(entry_def = entrytbl_get_entry(priv.entrytbl, rule->entry)) ||
+      !(entry_def = section_get_entry(section, rule->entry, lineno)) ||
       !control_define_rule_outband(rule_type, entry_def, rule->delay, lineno))
   {
     return -1;
@@ -632,14 +766,14 @@ create_rule_outband(enum section_type section,
 /**
  * Add suspend execution rule to daemon
  *
- * @param section  section type
+ * @param section  section the rule belongs to
  * @param rule     rule definition parsed from config
  * @param lineno   config file reference
  *
  * @return         -1 if error, 0 if success
  */
 static int
-create_rule_suspend(enum section_type section,
+create_rule_suspend(struct section *section,
                     struct ruldef *rule,
                     int lineno)
 {
@@ -648,25 +782,8 @@ create_rule_suspend(enum section_type section,
   const char *rule_type_str;
   int status;
 
-  switch (section)
-  {
-    case section_sink:
-      rule_type = rule_sink;
-      rule_type_str = "sink-route";
-      break;
-    case section_source:
-      rule_type = rule_source;
-      rule_type_str = "source-route";
-      break;
-    case section_context:
-      rule_type = rule_context;
-      rule_type_str = "context";
-      break;
-    default:
-      rule_type = rule_unknown;
-      rule_type_str = "<unknown>";
-      break;
-  }
+  rule_type = section->rule_type;
+  rule_type_str = section->name ? section->name : "<unknown>";
 
   if (priv.log_parsed_rules)
   {
@@ -678,7 +795,7 @@ create_rule_suspend(enum section_type section,
   }
 
   if (rule_type == rule_unknown ||
-      !(entry_def = entrytbl_get_entry(priv.entrytbl, rule->entry)) ||
+      !(entry_def = section_get_entry(section, rule->entry, lineno)) ||
       !control_define_rule_suspend(rule_type, entry_def, rule->delay, lineno))
   {
     return -1;
@@ -696,25 +813,32 @@ create_rule_suspend(enum section_type section,
 static int
 create_deflt(struct ruldef *rule, int lineno)
 {
-  struct card_def *card_def;
-  struct elem_def *elem_def;
+  struct elemtbl_elem *elem;
+  struct elemtbl matches;
+  int status;
+  int i;
 
-  if (priv.log_parsed_rules)
+  memset(&matches, 0, sizeof(matches));
+  status = elemtbl_match(priv.elemtbl, lineno, rule->elemid, &matches);
+
+  for (i = 0;  i < matches.len;  i++)
   {
-    log_info("Create deflt: elemid='%s' value='%s'",
-        rule->elemid ? rule->elemid : "<null>",
-        rule->value  ? rule->value  : "<null>");
-  }
+    elem = matches.array[i];
 
-  elem_def = elemtbl_find_by_id(priv.elemtbl, rule->elemid, &card_def);
+    if (priv.log_parsed_rules)
+    {
+      log_info("Create deflt: elemid='%s' value='%s'",
+          elem->id,
+          rule->value  ? rule->value  : "<null>");
+    }
 
-  if (!elem_def)
-    return -1;
+    if (!control_define_deflt(elem->card, elem->elem, rule->value, lineno))
+      status = -1;
+  }
 
-  if (control_define_deflt(card_def, elem_def, rule->value, lineno))
-    return 0;
+  free(matches.array);
 
-  return -1;
+  return status;
 }
 
 /**
@@ -783,34 +907,38 @@ elemdef_parse(int lineno, char *line, struct elemdef *elemdef)
 
   if (!strncmp(line, "id=", 3))
   {
+    free(elemdef->id);
     elemdef->id = strdup(line + 3);
     if (!elemdef->id)
       status = -1;
   }
   else if (!strncmp(line, "card=", 5))
   {
+    free(elemdef->card);
     elemdef->card = strdup(line + 5);
     if (!elemdef->card)
       status = -1;
   }
   else if (!strncmp(line, "interface=", 10))
   {
+    free(elemdef->iface);
     elemdef->iface = strdup(line + 10);
     if (!elemdef->iface)
       status = -1;
   }
   else if (!strncmp(line, "name=", 5))
   {
+    free(elemdef->name);
     elemdef->name = strdup(line + 5);
     if (!elemdef->name)
       status = -1;
   }
   else if (!strncmp(line, "index=", 6))
-    status = num_parse(lineno, line + 6, &elemdef->index) < 0;
+    status = num_parse(lineno, line + 6, &elemdef->index);
   else if (!strncmp(line, "device=", 7))
-    status = num_parse(lineno, line + 7, &elemdef->dev) < 0;
+    status = num_parse(lineno, line + 7, &elemdef->dev);
   else if (!strncmp(line, "sub-device=", 11))
-    status = num_parse(lineno, line + 11, &elemdef->subdev) < 0;
+    status = num_parse(lineno, line + 11, &elemdef->subdev);
   else
   {
     status = -1;
@@ -935,6 +1063,7 @@ ruldef_parse_alsa_setting(int lineno, char *line, struct ruldef *rule)
 static int
 ruldef_parse_outband(int lineno, char *line, struct ruldef *rule)
 {
+  static const char keyword[] = "@outband_execution@delay";
   char *equal, *colon;
   int status;
 
@@ -952,8 +1081,11 @@ ruldef_parse_outband(int lineno, char *line, struct ruldef *rule)
 
   if ((colon = strchr(equal + 1, ':')))
   {
-    if (strncmp(equal + 1, "@outband_execution@delay", colon - equal - 1))
+    if (colon - equal - 1 != sizeof(keyword) - 1 ||
+        strncmp(equal + 1, keyword, sizeof(keyword) - 1))
+    {
       return 1;
+    }
 
     *equal = '\0';
     *colon = '\0';
@@ -994,6 +1126,7 @@ ruldef_parse_outband(int lineno, char *line, struct ruldef *rule)
 static int
 ruldef_parse_suspend(int lineno, char *line, struct ruldef *rule)
 {
+  static const char keyword[] = "@suspend_execution@sleep";
   char *equal;
   char *colon;
   int status;
@@ -1008,7 +1141,8 @@ ruldef_parse_suspend(int lineno, char *line, struct ruldef *rule)
 
   if (!(equal = strchr(line, '=')) ||
       !(colon = strchr(equal + 1, ':')) ||
-      strncmp(equal + 1, "@suspend_execution@sleep", colon - equal - 1))
+      colon - equal - 1 != sizeof(keyword) - 1 ||
+      strncmp(equal + 1, keyword, sizeof(keyword) - 1))
   {
     return 1;
   }
@@ -1066,6 +1200,53 @@ ruldef_parse_deflt(int lineno, char *line, struct ruldef *rule)
   return 0;
 }
 
+/**
+ * Parse priority of rule section. The section has to be defined before.
+ *
+ * @param lineno  config file line number
+ * @param line    string to parse
+ *
+ * @return        -1 if error, 0 if OK
+ */
+static int
+priority_parse(int lineno, char *line)
+{
+  char *equal;
+  char *end;
+  long priority;
+
+  /*
+   * Line example:
+   * context=10
+   */
+
+  if (!(equal = strchr(line, '=')))
+  {
+    log_error("Invalid definition '%s' in line %d", line, lineno);
+    return -1;
+  }
+
+  *equal = '\0';
+  priority = strtol(equal + 1, &end, 10);
+
+  if (end == equal + 1 || *end)
+  {
+    log_error("Invalid number '%s' in line %d", equal + 1, lineno);
+    return -1;
+  }
+
+  if (control_set_priority(line, priority) < 0)
+  {
+    log_error("Unknown section '%s' in line %d", line, lineno);
+    return -1;
+  }
+
+  if (priv.log_parsed_rules)
+    log_info("Set priority: section='%s' priority=%ld", line, priority);
+
+  return 0;
+}
+
 /**
  * Check if entry is valid
  *
@@ -1084,6 +1265,10 @@ valid_entry(int lineno, char *entry)
 
   while((c = *entry++) != '\0')
   {
+    /* '+' joins the terms of context entries */
+    if (c == '+' && isalpha(*entry))
+      continue;
+
     if (!isalpha(c) && !isdigit(c) && c != '-' && c != '_')
       goto invalid;
   }
@@ -1095,6 +1280,183 @@ invalid:
   return 0;
 }
 
+/**
+ * Append a copy of the string to the list
+ *
+ * @param lineno  config file reference
+ * @param list    the list
+ * @param str     string to add, may be NULL
+ *
+ * @return        0 on success, -1 if the list is too long
+ */
+static int
+strlist_add(int lineno, struct strlist *list, const char *str)
+{
+  if (list->len >= TEMPLATE_MAX)
+  {
+    log_error("Template expands to more than %d items in line %d",
+              TEMPLATE_MAX, lineno);
+    return -1;
+  }
+
+  list->array = realloc(list->array, sizeof(*list->array) * (list->len + 1));
+
+  if (!list->array)
+  {
+    log_error("%s(): memory (re)allocation failed", __func__);
+    exit(errno);
+  }
+
+  list->array[list->len++] = str ? strdup(str) : NULL;
+
+  return 0;
+}
+
+/**
+ * Free strings stored in the list
+ * @param list  the list
+ */
+static void
+strlist_free(struct strlist *list)
+{
+  int i;
+
+  for (i = 0;  i < list->len;  i++)
+    free(list->array[i]);
+
+  free(list->array);
+  list->array = NULL;
+  list->len = 0;
+}
+
+/**
+ * Replace a brace group of the template with one of its alternatives
+ * and expand the rest of the template.
+ *
+ * @param lineno   config file reference
+ * @param tmpl     template string
+ * @param open     opening brace of the group in tmpl
+ * @param close    closing brace of the group in tmpl
+ * @param alt      alternative to put in place of the group
+ * @param alt_len  length of the alternative
+ * @param list     list to append the expansion to
+ *
+ * @return         0 on success, -1 on error
+ */
+static int
+template_substitute(int lineno, const char *tmpl,
+                    const char *open, const char *close,
+                    const char *alt, int alt_len,
+                    struct strlist *list)
+{
+  size_t len;
+  char *str;
+  int status;
+
+  len = (open - tmpl) + alt_len + strlen(close + 1) + 1;
+
+  if (!(str = malloc(len)))
+  {
+    log_error("%s(): memory allocation error", __func__);
+    exit(errno);
+  }
+
+  snprintf(str, len, "%.*s%.*s%s",
+           (int)(open - tmpl), tmpl, alt_len, alt, close + 1);
+
+  status = template_expand(lineno, str, list);
+  free(str);
+
+  return status;
+}
+
+/**
+ * Expand template to the list of strings.
+ *
+ * Two kinds of brace groups are recognized: alternatives "{,b-}" and
+ * numbered ranges "{1..4}". With several groups all the combinations are
+ * produced, the leftmost group varying slowest. A string without braces
+ * expands to itself.
+ *
+ * @param lineno  config file reference
+ * @param tmpl    template string, may be NULL
+ * @param list    list to append the expansion to
+ *
+ * @return        0 on success, -1 on error
+ */
+static int
+template_expand(int lineno, const char *tmpl, struct strlist *list)
+{
+  const char *open, *close, *alt, *end;
+  char *dots, *last;
+  char num[32];
+  long from, to, n;
+
+  if (!tmpl)
+    return strlist_add(lineno, list, NULL);
+
+  open  = strchr(tmpl, '{');
+  close = strchr(tmpl, '}');
+
+  if (!open && !close)
+    return strlist_add(lineno, list, tmpl);
+
+  if (!open || !close || close < open ||
+      memchr(open + 1, '{', close - open - 1))
+  {
+    log_error("Unbalanced braces in '%s' in line %d", tmpl, lineno);
+    return -1;
+  }
+
+  from = strtol(open + 1, &dots, 10);
+
+  if (dots > open + 1 && !strncmp(dots, "..", 2))
+  {
+    /* Numbered range: {from..to} */
+    to = strtol(dots + 2, &last, 10);
+
+    if (last == dots + 2 || last != close)
+    {
+      log_error("Invalid range in '%s' in line %d", tmpl, lineno);
+      return -1;
+    }
+
+    for (n = from;  ;  n += from <= to ? 1 : -1)
+    {
+      snprintf(num, sizeof(num), "%ld", n);
+
+      if (template_substitute(lineno, tmpl, open, close,
+                              num, strlen(num), list) < 0)
+      {
+        return -1;
+      }
+
+      if (n == to)
+        break;
+    }
+
+    return 0;
+  }
+
+  /* Alternatives: {a,b,c} */
+  for (alt = open + 1;  ;  alt = end + 1)
+  {
+    if (!(end = memchr(alt, ',', close - alt)))
+      end = close;
+
+    if (template_substitute(lineno, tmpl, open, close,
+                            alt, end - alt, list) < 0)
+    {
+      return -1;
+    }
+
+    if (end == close)
+      break;
+  }
+
+  return 0;
+}
+
 /**
  * Allocate, initialize and return cardtbl
  * @return  pointer to allocated cardtbl struct or NULL
@@ -1350,6 +1712,110 @@ elemtbl_find_by_id(struct elemtbl *tbl, char *elemid, struct card_def **card_def
   return NULL;
 }
 
+/**
+ * Find all control element definitions matching the pattern.
+ *
+ * The pattern is expanded as a template first (see template_expand()),
+ * then every alternative is matched against control ids as a shell glob,
+ * e.g. "{,b-}line-dac-volume" or "*-dac-switch". Found controls are added
+ * to 'matches' in definition order, each of them only once. The array of
+ * 'matches' must be freed by caller, its elements are owned by 'tbl'.
+ *
+ * @param tbl      elemtbl to search in
+ * @param lineno   config file reference
+ * @param pattern  control id pattern
+ * @param matches  table to store the result
+ *
+ * @return  0 if every alternative matched something, -1 otherwise
+ */
+static int
+elemtbl_match(struct elemtbl *tbl, int lineno, const char *pattern,
+              struct elemtbl *matches)
+{
+  struct strlist patterns;
+  struct elemtbl_elem *elem;
+  int status = 0;
+  int found;
+  int i, j, k;
+
+  if (!tbl || !pattern)
+    return -1;
+
+  memset(&patterns, 0, sizeof(patterns));
+
+  if (template_expand(lineno, pattern, &patterns) < 0)
+    return -1;
+
+  for (i = 0;  i < patterns.len;  i++)
+  {
+    found = 0;
+
+    for (j = 0;  j < tbl->len;  j++)
+    {
+      elem = tbl->array[j];
+
+      if (fnmatch(patterns.array[i], elem->id, 0))
+        continue;
+
+      found++;
+
+      for (k = 0;  k < matches->len;  k++)
+      {
+        if (matches->array[k] == elem)
+          break;
+      }
+
+      if (k < matches->len)
+        continue;
+
+      matches->array = realloc(matches->array,
+                               sizeof(*matches->array) * (matches->len + 1));
+
+      if (!matches->array)
+      {
+        log_error("%s(): memory (re)allocation failed", __func__);
+        exit(errno);
+      }
+
+      matches->array[matches->len++] = elem;
+    }
+
+    if (!found)
+    {
+      log_error("Unknown control '%s' in line %d", patterns.array[i], lineno);
+      status = -1;
+    }
+  }
+
+  strlist_free(&patterns);
+
+  return status;
+}
+
+/**
+ * Get rule entry of the section. Entries combining several terms with '+'
+ * are allowed only in [context].
+ *
+ * @param section     section the rule belongs to
+ * @param entry_name  name of the entry
+ * @param lineno      config file reference
+ *
+ * @return  entry_def instance or NULL
+ */
+static struct entry_def *
+section_get_entry(struct section *section, char *entry_name, int lineno)
+{
+  if (section->rule_type != rule_context && entry_name &&
+      strchr(entry_name, '+'))
+  {
+    log_error("Combined entry '%s' is allowed only in [context] (line %d)",
+              entry_name, lineno);
+    return NULL;
+  }
+
+  return entrytbl_get_entry(priv.entrytbl, entry_name);
+}
+
 /**
  * Allocate, initialize and return entrytbl
  * @return  pointer to allocated entrytbl struct or NULL
@@ -1443,7 +1909,7 @@ entrytbl_get_entry(struct entrytbl *tbl, char *entry_name)
   return elem->entry;
 
 fail:
-  free(elem->entry);
+  free(elem->name);
   free(elem);
 
   return NULL;
@@ -0,0 +1,582 @@
+/**
+ * @file context.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement context state store.
+ * Context variables received over D-Bus are kept here. A context rule
+ * entry is a predicate over several variables, e.g.
+ * "call-active+jack-headset". Every "variable-value" term gets a bit in
+ * the state bitmask and the list of rules it takes part in, so a context
+ * change re-evaluates only the rules depending on the changed term.
+ * Only the variables used in the rules are kept, and of their values only
+ * the ones used in the rules and the current one, so clients can't grow
+ * the store with arbitrary names.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+
+#include "context.h"
+
+#define STATE_WORD_BITS 64
+
+/* Longest "variable-value" term looked up without allocation */
+#define TERM_NAME_MAX 128
+
+/* "variable-value" term of context rules */
+struct context_term {
+  char *name;
+  int   id;
+  /* rules the term takes part in */
+  struct context_rule **rules;
+  int   rules_len;
+};
+
+/* Context rule: entry which is applied when all its terms are true */
+struct context_rule {
+  struct entry_def *entry;
+  int  *terms;
+  int   terms_len;
+};
+
+/* Context variable */
+struct context_var {
+  char *name;
+  /* current value, owned by 'values' or 'other' */
+  const char *value;
+  /* id of the term which is true for current value, or -1 */
+  int   term;
+  /* values used in rules -> term id + 1 */
+  GHashTable *values;
+  /* the current value if it isn't used in rules, buffer reused */
+  char *other;
+  size_t other_size;
+};
+
+/* Private structure */
+static struct {
+  /* terms indexed by name */
+  GHashTable *terms;
+  /* terms indexed by id */
+  struct context_term **term_array;
+  int terms_len;
+  /* context variables indexed by name */
+  GHashTable *vars;
+  /* names of the variables used in the rules */
+  GHashTable *var_names;
+  /* rules indexed by entry */
+  GHashTable *rules;
+  /* bitmask of true terms */
+  guint64 *state;
+  int state_len;
+} priv;
+
+
+static struct context_term *context_term_get    (const char *, int);
+static struct context_var  *context_var_get     (const char *);
+static int                  context_var_used    (const char *);
+static int                  context_var_names   (const char *);
+static void                 context_rule_free   (struct context_rule *);
+static int                  context_other_set   (struct context_var *,
+                                                 const char *);
+static int                  context_term_lookup (const char *, const char *);
+static int                  context_rule_true   (struct context_rule *);
+
+
+/**
+ * Initialize context state store
+ * @return  always zero
+ */
+int
+context_init()
+{
+  priv.terms = g_hash_table_new(g_str_hash, g_str_equal);
+  priv.vars  = g_hash_table_new(g_str_hash, g_str_equal);
+  priv.var_names = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+  priv.rules = g_hash_table_new(g_direct_hash, g_direct_equal);
+  return 0;
+}
+
+/**
+ * Add context rule entry to the store. The entry name is a list of
+ * "variable-value" terms joined with '+'.
+ *
+ * @param entry  rule entry having context rules
+ * @return       0 on success, -1 on error
+ */
+int
+context_define_rule(struct entry_def *entry)
+{
+  struct context_rule *rule;
+  struct context_term *term;
+  struct context_rule **rules;
+  const char *name, *end;
+  int *terms;
+  int i;
+
+  if (!entry || !entry->name)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!(rule = malloc(sizeof(*rule))))
+  {
+    log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+    return -1;
+  }
+
+  memset(rule, 0, sizeof(*rule));
+  rule->entry = entry;
+
+  for (name = entry->name;  ;  name = end + 1)
+  {
+    if (!(end = strchr(name, '+')))
+      end = name + strlen(name);
+
+    if (!(term = context_term_get(name, end - name)))
+    {
+      context_rule_free(rule);
+      return -1;
+    }
+
+    if (!(terms = realloc(rule->terms,
+                          sizeof(*terms) * (rule->terms_len + 1))))
+      goto fail;
+
+    rule->terms = terms;
+
+    if (!(rules = realloc(term->rules,
+                          sizeof(*rules) * (term->rules_len + 1))))
+      goto fail;
+
+    term->rules = rules;
+
+    for (i = 0;  i < term->rules_len && term->rules[i] != rule;  i++)
+      ;
+
+    if (i == term->rules_len)
+      term->rules[term->rules_len++] = rule;
+
+    rule->terms[rule->terms_len++] = term->id;
+
+    if (!*end)
+      break;
+  }
+
+  for (i = 0;  i < rule->terms_len;  i++)
+  {
+    if (context_var_names(priv.term_array[rule->terms[i]]->name) < 0)
+    {
+      context_rule_free(rule);
+      return -1;
+    }
+  }
+
+  g_hash_table_insert(priv.rules, entry, rule);
+
+  return 0;
+
+fail:
+  log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+  context_rule_free(rule);
+  return -1;
+}
+
+/**
+ * Update context variable and apply the rules affected by the change.
+ * Only the rules depending on the term made true by the new value are
+ * evaluated; nothing is done if the value is the same as before, or if
+ * no rule uses the variable.
+ *
+ * @param variable  context variable name
+ * @param value     new value of the variable
+ * @param cb        function applying rule entry
+ *
+ * @return  0 on success, -1 if some of the rules failed
+ */
+int
+context_set(const char *variable, const char *value, context_rule_cb cb)
+{
+  struct context_var *var;
+  struct context_term *term;
+  gpointer key, id;
+  int retval = 0;
+  int i;
+
+  if (!variable || !value)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!context_var_used(variable))
+    return 0;
+
+  if (!(var = context_var_get(variable)))
+    return -1;
+
+  if (!g_hash_table_lookup_extended(var->values, value, &key, &id))
+  {
+    if ((i = context_term_lookup(variable, value)) >= 0)
+    {
+      /* First time seen value of rules: resolve it to the term once */
+      if (!(key = strdup(value)))
+      {
+        log_error("%s(): Can't allocate memory: %s", __func__,
+                  strerror(errno));
+        return -1;
+      }
+
+      id = GINT_TO_POINTER(i + 1);
+      g_hash_table_insert(var->values, key, id);
+    }
+    else
+    {
+      if (var->other && var->value == var->other &&
+          !strcmp(var->other, value))
+      {
+        return 0;
+      }
+
+      if (context_other_set(var, value) < 0)
+        return -1;
+
+      key = var->other;
+      id  = GINT_TO_POINTER(0);
+    }
+  }
+
+  if (var->value == key && key != var->other)
+    return 0;
+
+  if (var->term >= 0)
+    priv.state[var->term / STATE_WORD_BITS] &=
+        ~((guint64)1 << var->term % STATE_WORD_BITS);
+
+  var->value = key;
+  var->term  = GPOINTER_TO_INT(id) - 1;
+
+  if (var->term < 0)
+    return 0;
+
+  priv.state[var->term / STATE_WORD_BITS] |=
+      (guint64)1 << var->term % STATE_WORD_BITS;
+
+  term = priv.term_array[var->term];
+
+  for (i = 0;  i < term->rules_len;  i++)
+  {
+    if (context_rule_true(term->rules[i]) && cb(term->rules[i]->entry) < 0)
+      retval = -1;
+  }
+
+  return retval;
+}
+
+/**
+ * Get current value of context variable
+ * @param variable  context variable name
+ * @return          the value or NULL if the variable was never set
+ */
+const char *
+context_get(const char *variable)
+{
+  struct context_var *var;
+
+  if (!variable || !(var = g_hash_table_lookup(priv.vars, variable)))
+    return NULL;
+
+  return var->value;
+}
+
+/**
+ * Check if context rule entry applies to the current context
+ * @param entry  rule entry
+ * @return       TRUE if all the terms of entry are true, FALSE otherwise
+ */
+int
+context_entry_true(struct entry_def *entry)
+{
+  struct context_rule *rule;
+
+  if (!entry || !(rule = g_hash_table_lookup(priv.rules, entry)))
+    return FALSE;
+
+  return context_rule_true(rule);
+}
+
+/**
+ * Iterate context variables having a value
+ * @param cb    callback function called with variable name and value
+ * @param data  data passed to the callback
+ */
+void
+context_foreach(control_state_cb cb, void *data)
+{
+  struct context_var *var;
+  GHashTableIter iter;
+
+  g_hash_table_iter_init(&iter, priv.vars);
+
+  while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&var))
+  {
+    if (var->value)
+      cb(var->name, var->value, data);
+  }
+}
+
+/**
+ * Find context term by name, create it if not found
+ *
+ * @param name  term name, not necessarily null terminated
+ * @param len   length of the name
+ *
+ * @return  context_term instance or NULL on error
+ */
+static struct context_term *
+context_term_get(const char *name, int len)
+{
+  struct context_term *term;
+  char *term_name;
+
+  if (!(term_name = strndup(name, len)))
+    goto fail;
+
+  if ((term = g_hash_table_lookup(priv.terms, term_name)))
+  {
+    free(term_name);
+    return term;
+  }
+
+  if (!(term = malloc(sizeof(*term))))
+    goto fail;
+
+  memset(term, 0, sizeof(*term));
+  term->name = term_name;
+  term->id   = priv.terms_len;
+
+  priv.term_array = realloc(priv.term_array,
+                            sizeof(*priv.term_array) * (priv.terms_len + 1));
+
+  if (!priv.term_array)
+    goto fail;
+
+  priv.term_array[priv.terms_len++] = term;
+
+  if (priv.terms_len > priv.state_len * STATE_WORD_BITS)
+  {
+    priv.state = realloc(priv.state, sizeof(*priv.state) * (priv.state_len + 1));
+
+    if (!priv.state)
+      goto fail;
+
+    priv.state[priv.state_len++] = 0;
+  }
+
+  g_hash_table_insert(priv.terms, term->name, term);
+
+  return term;
+
+fail:
+  log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+  return NULL;
+}
+
+/**
+ * Find context variable by name, create it if not found. Only the
+ * variables used in the rules are created, see context_var_used().
+ *
+ * @param name  variable name
+ * @return      context_var instance or NULL on error
+ */
+static struct context_var *
+context_var_get(const char *name)
+{
+  struct context_var *var;
+
+  if ((var = g_hash_table_lookup(priv.vars, name)))
+    return var;
+
+  if (!(var = malloc(sizeof(*var))))
+  {
+    log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+    return NULL;
+  }
+
+  memset(var, 0, sizeof(*var));
+  var->name   = strdup(name);
+  var->term   = -1;
+  var->values = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+  g_hash_table_insert(priv.vars, var->name, var);
+
+  return var;
+}
+
+/**
+ * Check if context variable is used in the rules, i.e. if some term is
+ * "variable-value" of it
+ *
+ * @param name  variable name
+ * @return      TRUE or FALSE
+ */
+static int
+context_var_used(const char *name)
+{
+  return g_hash_table_contains(priv.var_names, name);
+}
+
+/**
+ * Add the variable names of term to the names used in the rules. The
+ * variable and the value may both contain '-', so every prefix of the
+ * term ending before a '-' is a name.
+ *
+ * @param term  "variable-value" term name
+ * @return      0 on success, -1 on error
+ */
+static int
+context_var_names(const char *term)
+{
+  const char *dash;
+  char *name;
+
+  for (dash = strchr(term, '-');  dash;  dash = strchr(dash + 1, '-'))
+  {
+    if (!(name = strndup(term, dash - term)))
+    {
+      log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+      return -1;
+    }
+
+    if (g_hash_table_contains(priv.var_names, name))
+      free(name);
+    else
+      g_hash_table_add(priv.var_names, name);
+  }
+
+  return 0;
+}
+
+/**
+ * Unlink context rule from its terms and free it
+ * @param rule  rule not yet added to the store
+ */
+static void
+context_rule_free(struct context_rule *rule)
+{
+  struct context_term *term;
+  int i, j;
+
+  for (i = 0;  i < rule->terms_len;  i++)
+  {
+    term = priv.term_array[rule->terms[i]];
+
+    for (j = 0;  j < term->rules_len;  j++)
+    {
+      if (term->rules[j] == rule)
+      {
+        memmove(term->rules + j, term->rules + j + 1,
+                sizeof(*term->rules) * (term->rules_len - j - 1));
+        term->rules_len--;
+        break;
+      }
+    }
+  }
+
+  free(rule->terms);
+  free(rule);
+}
+
+/**
+ * Set the current value of context variable to a value not used in the
+ * rules. The value is copied to the buffer of the variable, which grows
+ * only if the value doesn't fit.
+ *
+ * @param var    context variable
+ * @param value  the value
+ *
+ * @return  0 on success, -1 on error
+ */
+static int
+context_other_set(struct context_var *var, const char *value)
+{
+  size_t size = strlen(value) + 1;
+  char *other;
+
+  if (size > var->other_size)
+  {
+    if (!(other = realloc(var->other, size)))
+    {
+      log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+      return -1;
+    }
+
+    var->other = other;
+    var->other_size = size;
+  }
+
+  memcpy(var->other, value, size);
+
+  return 0;
+}
+
+/**
+ * Get id of the term used in rules for the variable value
+ *
+ * @param variable  context variable name
+ * @param value     variable value
+ *
+ * @return  term id or -1 if no rule uses the term
+ */
+static int
+context_term_lookup(const char *variable, const char *value)
+{
+  struct context_term *term;
+  char buf[TERM_NAME_MAX];
+  char *name = buf;
+
+  /* Values not used in rules are looked up on every change */
+  if (snprintf(buf, sizeof(buf), "%s-%s", variable, value) >= sizeof(buf) &&
+      !(name = g_strdup_printf("%s-%s", variable, value)))
+  {
+    return -1;
+  }
+
+  term = g_hash_table_lookup(priv.terms, name);
+
+  if (name != buf)
+    g_free(name);
+
+  return term ? term->id : -1;
+}
+
+/**
+ * Check if all the terms of context rule are true
+ * @param rule  the rule
+ * @return      TRUE or FALSE
+ */
+static int
+context_rule_true(struct context_rule *rule)
+{
+  int term;
+  int i;
+
+  for (i = 0;  i < rule->terms_len;  i++)
+  {
+    term = rule->terms[i];
+
+    if (!(priv.state[term / STATE_WORD_BITS] >> term % STATE_WORD_BITS & 1))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/** @} */
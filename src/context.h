@@ -0,0 +1,19 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "control.h"
+
+/** Called for every context rule entry which becomes applicable */
+typedef int (*context_rule_cb) (struct entry_def *entry);
+
+int         context_init        (void);
+int         context_define_rule (struct entry_def *entry);
+int         context_set         (const char *variable,
+                                 const char *value,
+                                 context_rule_cb cb);
+const char *context_get         (const char *variable);
+int         context_entry_true  (struct entry_def *entry);
+void        context_foreach     (control_state_cb cb, void *data);
+
+
+#endif  /* CONTEXT_H */
@@ -16,22 +16,80 @@
 #include "logging.h"
 #include "alsaif.h"
 #include "dbusif.h"
+#include "context.h"
+#include "queue.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
+#include "worker.h"
 
 #include "control.h"
 
+/* Controls listed by control_stats_dump() */
+#define CONTROL_HOT_COUNT 10
+
 /* Private structure */
 static struct {
   struct card_def  *card_def_list;
   struct entry_def *entry_def_list;
+  /* rule sections indexed by rule type */
+  struct section_def **sections;
+  int sections_len;
+  /* rule sections indexed by name */
+  GHashTable *section_index;
+  /* rule entries indexed by name */
+  GHashTable *entry_index;
+  /* controls to be set at the end of decision */
+  GPtrArray *pending;
+  /* controls whose rules were kept out by a section with higher priority */
+  GPtrArray *blocked;
+  /* TRUE while actions of a decision are applied */
+  int decision;
+  /* rules executed and writes skipped by the decisions being applied
+   * and written, struct decision_count */
+  GArray *decision_counts;
+  int counting;
+  /* number of control conflicts without priority */
+  int conflicts;
   int log_rule_execution;
   int outband_src_id;
+  /* line of the rules and time of the outband execution */
+  int outband_line;
+  gint64 outband_due;
+  /* when the outband execution was set, for the timeline */
+  gint64 outband_start;
 } priv;
 
+/* Rules executed and writes skipped by a decision of the queue */
+struct decision_count {
+  unsigned int decision;
+  int rules;
+  int skipped;
+};
+
 
 static void alsa_event_cb(alsaif_event *);
 static void alsaped_outband_reset();
 static int audio_actions_cb(struct action_data *);
+static int decision_done_cb(void);
+static void decision_count(unsigned int, int, int);
+static int section_route_cb(struct section_def *, struct action_data *);
+static int section_context_cb(struct section_def *, struct action_data *);
+static int context_entry_cb(struct entry_def *);
+static void write_failed_cb(int, int, int, unsigned int);
+static int section_def_add(const char *, const char *,
+                           int (*)(struct section_def *, struct action_data *));
+static struct section_def *section_def_get(enum rule_type);
+static struct rule_def **entry_def_rules(struct entry_def *, enum rule_type);
 static int rule_def_run(struct rule_def *);
+static int rule_def_set(struct rule_def *, unsigned int);
+static void rule_def_stage(struct rule_def *);
+static int rule_def_priority(struct rule_def *);
+static int rule_def_active(struct rule_def *);
+static void rule_def_fields(struct rule_def *, struct log_fields *);
+static int control_flush(void);
+static void control_release(void);
+static int control_find_conflicts(void);
 static int alsaped_outband_set(int, struct rule_def *);
 static int alsaped_suspend(useconds_t, int);
 static gboolean alsaped_outband_cb(gpointer);
@@ -42,27 +100,69 @@ static struct rule_def *rule_def_add_to_list(struct rule_def *,
 
 
 /**
- * Initialize control options
+ * Initialize control options and built-in rule sections
  * @param options  options parsed from command line
- * @return  always zero
+ * @return  0 on success, -1 on error
  */
 int control_init(struct options *options)
 {
   priv.log_rule_execution = options->log_rule_execution;
+  priv.section_index = g_hash_table_new(g_str_hash, g_str_equal);
+  priv.entry_index = g_hash_table_new(g_str_hash, g_str_equal);
+  priv.pending = g_ptr_array_new();
+  priv.blocked = g_ptr_array_new();
+  priv.decision_counts = g_array_new(FALSE, FALSE,
+                                     sizeof(struct decision_count));
+
+  if (context_init() < 0 ||
+      section_def_add("sink-route", "sink", section_route_cb) != rule_sink ||
+      section_def_add("source-route", "source", section_route_cb) != rule_source ||
+      section_def_add("context", "context", section_context_cb) != rule_context)
+  {
+    return -1;
+  }
+
   return 0;
 }
 
 /**
- * Set callbacks for alsaif and dbusif
+ * Set callbacks for alsaif and decision queue
  * @return  always 0
  */
 int control_set_cb()
 {
   alsaif_set_cb(alsa_event_cb);
-  dbusif_set_cb(audio_actions_cb);
+  queue_set_cb(audio_actions_cb, decision_done_cb);
+  worker_set_cb(write_failed_cb);
   return 0;
 }
 
+/**
+ * Prepare the rules read from config file for execution.
+ * Controls set by several sections are reported.
+ *
+ * @return  0 on success, -1 on error
+ */
+int
+control_compile()
+{
+  struct entry_def *entry;
+  int status = 0;
+
+  priv.conflicts = control_find_conflicts();
+
+  for (entry = priv.entry_def_list;  entry;  entry = entry->next)
+  {
+    if (entry->rules_len > rule_context && entry->rules[rule_context] &&
+        context_define_rule(entry) < 0)
+    {
+      status = -1;
+    }
+  }
+
+  return status;
+}
+
 /**
  * Add sound card definition read from config file
  * @param id    sound card id
@@ -194,9 +294,374 @@ control_define_entry(char *name)
   i->next = entry_def;
   entry_def->next = NULL;
 
+  g_hash_table_insert(priv.entry_index, (char *)entry_def->name, entry_def);
+
   return entry_def;
 }
 
+/**
+ * Add rule section to the section index
+ *
+ * @param name     section name
+ * @param label    section name used in log messages
+ * @param handler  function applying actions to the section
+ *
+ * @return  rule type of the section or -1 on error
+ */
+static int
+section_def_add(const char *name,
+                const char *label,
+                int (*handler)(struct section_def *, struct action_data *))
+{
+  struct section_def *section;
+  struct section_def **sections;
+  int rule_type;
+
+  /* Index 0 is reserved for rule_unknown */
+  rule_type = priv.sections_len ? priv.sections_len : rule_unknown + 1;
+  sections = realloc(priv.sections, sizeof(*sections) * (rule_type + 1));
+
+  if (!sections)
+  {
+    log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+    return -1;
+  }
+
+  /* The old array may be freed, the grown one is kept in any case */
+  sections[rule_unknown] = NULL;
+  priv.sections = sections;
+
+  if (!(section = malloc(sizeof(*section))))
+  {
+    log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+    return -1;
+  }
+
+  memset(section, 0, sizeof(*section));
+  section->name      = strdup(name);
+  section->label     = strdup(label);
+  section->rule_type = rule_type;
+  section->handler   = handler;
+
+  if (!section->name || !section->label)
+  {
+    log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+    free(section->name);
+    free(section->label);
+    free(section);
+    return -1;
+  }
+
+  sections[rule_type] = section;
+  priv.sections_len = rule_type + 1;
+
+  g_hash_table_insert(priv.section_index, section->name, section);
+
+  return rule_type;
+}
+
+/**
+ * Add user defined rule section read from config file. Entries of such
+ * sections are applied like routes: the entry in use is not applied twice.
+ *
+ * @param name  section name
+ * @return      rule type of the section or -1 on error
+ */
+int
+control_define_section(const char *name)
+{
+  if (!name)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (g_hash_table_lookup(priv.section_index, name))
+  {
+    log_error("Attempt for multiple definition of section '%s'", name);
+    errno = EAGAIN;  /* EAGAIN == Try again */
+    return -1;
+  }
+
+  return section_def_add(name, name, section_route_cb);
+}
+
+/**
+ * Set priority of rule section read from config file
+ *
+ * @param name      section name
+ * @param priority  priority of the section, the default is 0
+ *
+ * @return  0 on success, -1 on error
+ */
+int
+control_set_priority(const char *name, int priority)
+{
+  struct section_def *section;
+
+  if (!name || !(section = g_hash_table_lookup(priv.section_index, name)))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  section->priority = priority;
+
+  return 0;
+}
+
+/**
+ * Get the number of controls set by several sections of the same priority
+ * @return  number of conflicts found by control_compile()
+ */
+int
+control_conflicts()
+{
+  return priv.conflicts;
+}
+
+/**
+ * Iterate the entries currently in use by route like sections. The
+ * sections are named by their labels, e.g. "sink" and "source".
+ *
+ * @param cb    callback function called with section label and entry
+ * @param data  data passed to the callback
+ */
+void
+control_foreach_route(control_state_cb cb, void *data)
+{
+  struct section_def *section;
+  int i;
+
+  for (i = rule_unknown + 1;  i < priv.sections_len;  i++)
+  {
+    if ((section = priv.sections[i]) && section->current)
+      cb(section->label, section->current->name, data);
+  }
+}
+
+/**
+ * Iterate the sound card definitions of the config file
+ *
+ * @param cb    callback function called with the card definition
+ * @param data  data passed to the callback
+ */
+void
+control_foreach_card(control_card_cb cb, void *data)
+{
+  struct card_def *card;
+
+  for (card = priv.card_def_list;  card;  card = card->next)
+    cb(card, data);
+}
+
+/**
+ * Iterate the alsa setting rules of the config file, defaults included
+ *
+ * @param cb    callback function called with the rule
+ * @param data  data passed to the callback
+ */
+void
+control_foreach_rule(control_rule_cb cb, void *data)
+{
+  struct card_def *card;
+  struct elem_def *elem;
+  struct rule_def *rule;
+
+  for (card = priv.card_def_list;  card;  card = card->next)
+  {
+    for (elem = card->elem_list;  elem;  elem = elem->next)
+    {
+      for (rule = elem->rule;  rule;  rule = rule->elem_rule)
+        cb(rule, data);
+    }
+  }
+}
+
+/**
+ * Iterate the control element definitions of the config file
+ *
+ * @param cb    callback function called with the card and the element
+ * @param data  data passed to the callback
+ */
+void
+control_foreach_elem(control_elem_cb cb, void *data)
+{
+  struct card_def *card;
+  struct elem_def *elem;
+
+  for (card = priv.card_def_list;  card;  card = card->next)
+  {
+    for (elem = card->elem_list;  elem;  elem = elem->next)
+      cb(card, elem, data);
+  }
+}
+
+/**
+ * Get the pending outband execution
+ *
+ * @param lineno  pointer to return the line of the rules to execute
+ * @param msec    pointer to return the time left in milliseconds
+ *
+ * @return  TRUE if an outband execution is pending, FALSE otherwise
+ */
+int
+control_get_outband(int *lineno, int *msec)
+{
+  gint64 left;
+
+  if (!priv.outband_src_id)
+    return FALSE;
+
+  left = priv.outband_due - g_get_monotonic_time();
+
+  *lineno = priv.outband_line;
+  *msec   = left > 0 ? (left + 999) / 1000 : 0;
+
+  return TRUE;
+}
+
+/**
+ * Log the controls which took the most time to write, with the config
+ * file line of the rule which took the most of it
+ */
+void
+control_stats_dump()
+{
+  struct hot_elem {
+    struct elem_def *elem;
+    struct card_def *card;
+    struct rule_def *hottest;
+    unsigned int writes, skipped, failures;
+    guint64 usec;
+  } hot[CONTROL_HOT_COUNT], cur;
+  struct card_def *card;
+  struct elem_def *elem;
+  struct rule_def *rule;
+  guint64 usec, hottest_usec;
+  int len = 0, i;
+
+  for (card = priv.card_def_list;  card;  card = card->next)
+  {
+    for (elem = card->elem_list;  elem;  elem = elem->next)
+    {
+      memset(&cur, 0, sizeof(cur));
+      cur.elem = elem;
+      cur.card = card;
+      hottest_usec = 0;
+
+      for (rule = elem->rule;  rule;  rule = rule->elem_rule)
+      {
+        usec = atomic_load_explicit(&rule->stats.write_usec,
+                                    memory_order_relaxed);
+        cur.writes   += rule->stats.writes;
+        cur.skipped  += rule->stats.skipped;
+        cur.failures += rule->stats.failures;
+        cur.usec     += usec;
+
+        if (!cur.hottest || usec > hottest_usec)
+        {
+          cur.hottest = rule;
+          hottest_usec = usec;
+        }
+      }
+
+      if (!cur.writes)
+        continue;
+
+      /* Insertion into the list sorted by write time */
+      for (i = len;  i > 0 && hot[i - 1].usec < cur.usec;  i--)
+      {
+        if (i < CONTROL_HOT_COUNT)
+          hot[i] = hot[i - 1];
+      }
+
+      if (i < CONTROL_HOT_COUNT)
+      {
+        hot[i] = cur;
+
+        if (len < CONTROL_HOT_COUNT)
+          len++;
+      }
+    }
+  }
+
+  log_notice("hot controls:");
+
+  for (i = 0;  i < len;  i++)
+  {
+    log_notice("'%s' of card '%s': %u writes, %u skipped, %u failed, "
+               "%" G_GUINT64_FORMAT " usec, mostly line %d",
+               hot[i].elem->name, hot[i].card->name, hot[i].writes,
+               hot[i].skipped, hot[i].failures, hot[i].usec,
+               hot[i].hottest->lineno);
+  }
+}
+
+/**
+ * Find rule section by its name
+ * @param name  section name
+ * @return      rule type of the section or rule_unknown
+ */
+enum rule_type
+control_find_section(const char *name)
+{
+  struct section_def *section;
+
+  if (!name || !(section = g_hash_table_lookup(priv.section_index, name)))
+    return rule_unknown;
+
+  return section->rule_type;
+}
+
+/**
+ * Get rule section by rule type
+ * @param rule_type  rule type
+ * @return           section_def instance or NULL
+ */
+static struct section_def *
+section_def_get(enum rule_type rule_type)
+{
+  if (rule_type <= rule_unknown || rule_type >= priv.sections_len)
+    return NULL;
+
+  return priv.sections[rule_type];
+}
+
+/**
+ * Get the list head of entry rules of given type.
+ * The rule lists array of entry is extended if needed.
+ *
+ * @param entry_def  rule entry
+ * @param rule_type  rule type
+ *
+ * @return  pointer to the list head or NULL on error
+ */
+static struct rule_def **
+entry_def_rules(struct entry_def *entry_def, enum rule_type rule_type)
+{
+  struct rule_def **rules;
+
+  if (rule_type >= entry_def->rules_len)
+  {
+    rules = realloc(entry_def->rules, sizeof(*rules) * (rule_type + 1));
+
+    if (!rules)
+    {
+      log_error("%s(): Can't allocate memory: %s", __func__, strerror(errno));
+      return NULL;
+    }
+
+    memset(&rules[entry_def->rules_len], 0,
+           sizeof(*rules) * (rule_type + 1 - entry_def->rules_len));
+
+    entry_def->rules = rules;
+    entry_def->rules_len = rule_type + 1;
+  }
+
+  return &entry_def->rules[rule_type];
+}
+
 /**
  * Create new rule definition and add references to entry_def and elem_def.
  * Previous rule of elem_def is stored as rule_def->elem_next_rule.
@@ -219,21 +684,27 @@ control_define_rule_alsa_setting(enum rule_type rule_type,
                                  const char *value,
                                  int lineno)
 {
+  struct rule_def **rules;
   struct rule_def *rule;
 
   if (!entry_def || !card_def || !elem_def || !value ||
-      rule_type == rule_unknown || rule_type >= rule_max)
+      !section_def_get(rule_type))
   {
     errno = EINVAL;
     return NULL;
   }
 
+  if (!(rules = entry_def_rules(entry_def, rule_type)))
+    return NULL;
+
   rule = rule_def_new();
   if (!rule)
     return NULL;
 
   rule->lineno = lineno;
   rule->action_type = action_alsa_setting;
+  rule->rule_type = rule_type;
+  rule->entry_def = entry_def;
   rule->card_def = card_def;
   rule->elem_def = elem_def;
   /* Save the pointer to elem rule to make a chain we will need later
@@ -241,7 +712,7 @@ control_define_rule_alsa_setting(enum rule_type rule_type,
   rule->elem_rule = elem_def->rule;
   rule->value_str = strdup(value);
 
-  rule_def_add_to_list((struct rule_def *)&entry_def->rules[rule_type], rule);
+  rule_def_add_to_list((struct rule_def *)rules, rule);
   elem_def->rule = rule;
 
   return rule;
@@ -297,16 +768,18 @@ control_define_rule_outband(enum rule_type rule_type,
                             int lineno)
 {
   enum action_type action_type;
+  struct rule_def **rules;
   struct rule_def *rule;
 
-  if (delay_msec > 3000 ||
-      rule_type == rule_unknown ||
-      rule_type >= rule_max)
+  if (!entry_def || delay_msec > 3000 || !section_def_get(rule_type))
   {
     errno = EINVAL;
     return NULL;
   }
 
+  if (!(rules = entry_def_rules(entry_def, rule_type)))
+    return NULL;
+
   if (delay_msec == -1)
   {
     action_type = action_outband_cancellation;
@@ -324,9 +797,11 @@ control_define_rule_outband(enum rule_type rule_type,
 
   rule->lineno = lineno;
   rule->action_type = action_type;
+  rule->rule_type = rule_type;
+  rule->entry_def = entry_def;
   /* Delay is in milliseconds for outband and useconds for suspend */
   rule->delay = delay_msec;
-  rule_def_add_to_list((struct rule_def *)&entry_def->rules[rule_type], rule);
+  rule_def_add_to_list((struct rule_def *)rules, rule);
 
   return rule;
 }
@@ -347,23 +822,29 @@ control_define_rule_suspend(enum rule_type rule_type,
                             int delay_msec,
                             int lineno)
 {
+  struct rule_def **rules;
   struct rule_def *rule;
 
-  if (delay_msec > 500 || rule_type == rule_unknown || rule_type >= rule_max)
+  if (!entry_def || delay_msec > 500 || !section_def_get(rule_type))
   {
     errno = EINVAL;
     return NULL;
   }
 
+  if (!(rules = entry_def_rules(entry_def, rule_type)))
+    return NULL;
+
   rule = rule_def_new();
   if (!rule)
     return NULL;
 
   rule->lineno = lineno;
   rule->action_type = action_suspend_execution;
+  rule->rule_type = rule_type;
+  rule->entry_def = entry_def;
   /* Delay is in useconds for suspend and milliseconds for outband */
   rule->delay = 1000 * delay_msec;
-  rule_def_add_to_list((struct rule_def *)&entry_def->rules[rule_type], rule);
+  rule_def_add_to_list((struct rule_def *)rules, rule);
 
   return rule;
 }
@@ -421,8 +902,7 @@ control_run_rules_for_entry(enum rule_type rule_type,
 {
   struct entry_def *entry;
 
-  if (rule_type == rule_unknown ||
-      rule_type >= rule_max)
+  if (!section_def_get(rule_type))
   {
     errno = EINVAL;
     return -1;
@@ -430,14 +910,46 @@ control_run_rules_for_entry(enum rule_type rule_type,
 
   entry = control_find_entry(entry_name);
 
-  return entry ? rule_def_run(entry->rules[rule_type]) : 0;
+  if (!entry || rule_type >= entry->rules_len)
+    return 0;
+
+  return rule_def_run(entry->rules[rule_type]);
 }
 
-static int
-alsaped_run_context_rules(const char *context)
+/**
+ * Apply an entry of rule section, as if it was requested over D-Bus.
+ * This is the local trigger for user defined sections.
+ *
+ * @param section  section name
+ * @param entry    entry name
+ *
+ * @return  0 on success, -1 on error
+ */
+int
+control_trigger(const char *section, const char *entry)
 {
-  struct entry_def *entry = control_find_entry(context);
-  return entry ? rule_def_run(entry->rules[rule_context]) : 0;
+  struct action_data data;
+  int status;
+
+  memset(&data, 0, sizeof(data));
+  data.rule_type = control_find_section(section);
+  data.route_dev = entry;
+
+  if (data.rule_type == rule_unknown || data.rule_type == rule_context ||
+      !entry)
+  {
+    log_error("Can't trigger entry '%s' of section '%s'",
+              entry ? entry : "<null>", section ? section : "<null>");
+    errno = EINVAL;
+    return -1;
+  }
+
+  status = audio_actions_cb(&data);
+
+  if (decision_done_cb() < 0)
+    status = -1;
+
+  return status;
 }
 
 /**
@@ -492,18 +1004,10 @@ card_def_find_ctl_elem(struct card_def *card, int numid)
 static struct entry_def *
 control_find_entry(const char *name)
 {
-  struct entry_def *entry;
-
   if (!name)
     return NULL;
 
-  for (entry = priv.entry_def_list;  entry;  entry = entry->next)
-  {
-    if (!strcmp(entry->name, name))
-      return entry;
-  }
-
-  return NULL;
+  return g_hash_table_lookup(priv.entry_index, name);
 }
 
 /* How many should be added to match the step? */
@@ -560,6 +1064,9 @@ alsaped_update_elem_values(struct elem_def     *alsaped_elem,
   char *value_str;
   char *end_ptr;
 
+  /* Value of a just appeared control element is not known */
+  alsaped_elem->value_valid = FALSE;
+
   for (rule = alsaped_elem->rule; rule; rule = rule->elem_rule)
   {
     value_str = rule->value_str;
@@ -651,7 +1158,10 @@ card_def_set_defaults(struct card_def *card)
 }
 
 /**
- * Execute actions of a rule.
+ * Execute actions of a rule. While a decision is applied, the control
+ * settings are collected and written at the end of the decision or
+ * before suspending the execution.
+ *
  * @param rule  the rule
  * @return      0 on succes, -1 on error
  */
@@ -662,12 +1172,18 @@ rule_def_run(struct rule_def *rule)
 
   for ( ; rule;  rule = rule->next)
   {
+    decision_count(queue_decision(), 1, 0);
+
     switch (rule->action_type)
     {
       case action_alsa_setting:
-        if (alsaif_set_value(rule->card_def->num,
-                             rule->elem_def->numid,
-                             &rule->value) < 0)
+        rule->stats.executions++;
+        trace(rule, log_get_txid(), rule->lineno, rule->card_def->num,
+              rule->elem_def->numid, rule->value);
+
+        if (priv.decision)
+          rule_def_stage(rule);
+        else if (rule_def_set(rule, queue_decision()) < 0)
           retval = -1;
         continue;
 
@@ -679,7 +1195,11 @@ rule_def_run(struct rule_def *rule)
         break;
 
       case action_suspend_execution:
-        retval = alsaped_suspend(rule->delay, rule->lineno);
+        if (control_flush() < 0)
+          retval = -1;
+
+        if (alsaped_suspend(rule->delay, rule->lineno) < 0)
+          retval = -1;
         break;
 
       default:
@@ -690,6 +1210,324 @@ rule_def_run(struct rule_def *rule)
   return retval;
 }
 
+/**
+ * Set control element value of a rule. The value is not written if the
+ * control element already has it, or if it was set by an entry still in
+ * use of a section with higher priority. Then the control element is
+ * remembered, and the rules are applied again when that entry is no
+ * longer in use, see control_release(). Rules of a control element which
+ * isn't on the sound card are skipped.
+ *
+ * @param rule      alsa setting rule
+ * @param decision  decision of the queue failed if the write fails
+ *
+ * @return  0 on succes, -1 on error
+ */
+static int
+rule_def_set(struct rule_def *rule, unsigned int decision)
+{
+  struct elem_def *elem_def = rule->elem_def;
+  struct rule_def *owner = elem_def->owner;
+  struct log_fields fields;
+
+  if (owner && rule->rule_type != rule_unknown &&
+      owner->rule_type != rule->rule_type &&
+      rule_def_priority(owner) > rule_def_priority(rule) &&
+      rule_def_active(owner))
+  {
+    if (priv.log_rule_execution)
+    {
+      rule_def_fields(rule, &fields);
+      log_rule(&fields, "'%s' is kept by line %d, line %d ignored",
+               elem_def->name, owner->lineno, rule->lineno);
+    }
+
+    if (!elem_def->blocked)
+    {
+      elem_def->blocked = TRUE;
+      g_ptr_array_add(priv.blocked, elem_def);
+    }
+
+    decision_count(decision, 0, 1);
+    rule->stats.skipped++;
+    return 0;
+  }
+
+  elem_def->owner = rule->rule_type != rule_unknown ? rule : NULL;
+  elem_def->target = rule;
+
+  if (elem_def->numid == -1)
+  {
+    if (priv.log_rule_execution)
+    {
+      rule_def_fields(rule, &fields);
+      log_rule(&fields, "'%s' is not on the card, line %d ignored",
+               elem_def->name, rule->lineno);
+    }
+
+    decision_count(decision, 0, 1);
+    rule->stats.skipped++;
+    return 0;
+  }
+
+  if (elem_def->value_valid && elem_def->value == rule->value)
+  {
+    decision_count(decision, 0, 1);
+    rule->stats.skipped++;
+    return 0;
+  }
+
+  if (priv.log_rule_execution)
+  {
+    rule_def_fields(rule, &fields);
+    log_rule(&fields, "setting '%s' to '%s' (line %d)",
+             elem_def->name, rule->value_str, rule->lineno);
+  }
+
+  rule->stats.writes++;
+  elem_def->writer = rule;
+
+  if (worker_set_value(rule->card_def->num, elem_def->numid, &rule->value,
+                       rule->lineno, &rule->stats.write_usec, decision) < 0)
+  {
+    rule->stats.failures++;
+    elem_def->value_valid = FALSE;
+    queue_fail(decision);
+    return -1;
+  }
+
+  elem_def->value = rule->value;
+  elem_def->value_valid = TRUE;
+
+  return 0;
+}
+
+/**
+ * Collect alsa setting rule of a decision. Only the rule of the highest
+ * priority section is kept for a control element, the later one if the
+ * priorities are equal. The write fails the decision of the kept rule.
+ *
+ * @param rule  alsa setting rule
+ */
+static void
+rule_def_stage(struct rule_def *rule)
+{
+  struct elem_def *elem_def = rule->elem_def;
+
+  if (!elem_def->pending)
+    g_ptr_array_add(priv.pending, elem_def);
+  else if (rule_def_priority(elem_def->pending) > rule_def_priority(rule))
+    return;
+
+  elem_def->pending = rule;
+  elem_def->decision = queue_decision();
+  elem_def->txid = log_get_txid();
+}
+
+/**
+ * Write the control element values collected during a decision
+ * @return  0 on succes, -1 on error
+ */
+static int
+control_flush()
+{
+  struct elem_def *elem_def;
+  struct rule_def *rule;
+  uint32_t txid = log_get_txid();
+  int retval = 0;
+  guint i;
+
+  for (i = 0;  i < priv.pending->len;  i++)
+  {
+    elem_def = g_ptr_array_index(priv.pending, i);
+    rule = elem_def->pending;
+    elem_def->pending = NULL;
+
+    /* Logged and traced with the decision which staged the rule */
+    log_set_txid(elem_def->txid);
+
+    if (rule_def_set(rule, elem_def->decision) < 0)
+      retval = -1;
+  }
+
+  log_set_txid(txid);
+  g_ptr_array_set_size(priv.pending, 0);
+
+  return retval;
+}
+
+/**
+ * Stage the rules kept out of control elements whose owner entries are no
+ * longer in use. Of the rules of an element, the one of the section with
+ * the highest priority whose entry is in use gets the element. The
+ * elements still kept by their owner stay remembered.
+ */
+static void
+control_release()
+{
+  struct elem_def *elem_def;
+  struct rule_def *rule;
+  struct rule_def *best;
+  struct log_fields fields;
+  guint i, kept = 0;
+
+  for (i = 0;  i < priv.blocked->len;  i++)
+  {
+    elem_def = g_ptr_array_index(priv.blocked, i);
+
+    if (elem_def->owner && rule_def_active(elem_def->owner))
+    {
+      g_ptr_array_index(priv.blocked, kept++) = elem_def;
+      continue;
+    }
+
+    elem_def->blocked = FALSE;
+
+    for (best = NULL, rule = elem_def->rule;  rule;  rule = rule->elem_rule)
+    {
+      if (rule->rule_type != rule_unknown && rule_def_active(rule) &&
+          (!best || rule_def_priority(rule) > rule_def_priority(best)))
+      {
+        best = rule;
+      }
+    }
+
+    /* Settings of the decision win over the ones of the same priority */
+    if (!best || (elem_def->pending &&
+                  rule_def_priority(elem_def->pending) >=
+                  rule_def_priority(best)))
+    {
+      continue;
+    }
+
+    if (priv.log_rule_execution)
+    {
+      rule_def_fields(best, &fields);
+      log_rule(&fields, "'%s' is released, line %d applied",
+               elem_def->name, best->lineno);
+    }
+
+    rule_def_stage(best);
+  }
+
+  g_ptr_array_set_size(priv.blocked, kept);
+}
+
+/**
+ * Describe rule for structured logging
+ *
+ * @param rule    alsa setting rule
+ * @param fields  pointer to return the description
+ */
+static void
+rule_def_fields(struct rule_def *rule, struct log_fields *fields)
+{
+  fields->line  = rule->lineno;
+  fields->card  = rule->card_def->num;
+  fields->numid = rule->elem_def->numid;
+  fields->entry = rule->entry_def ? rule->entry_def->name : NULL;
+}
+
+/**
+ * Get priority of the section of a rule
+ * @param rule  the rule
+ * @return      section priority, 0 for defaults
+ */
+static int
+rule_def_priority(struct rule_def *rule)
+{
+  struct section_def *section = section_def_get(rule->rule_type);
+
+  return section ? section->priority : 0;
+}
+
+/**
+ * Check if the entry of a rule is still in use
+ * @param rule  the rule
+ * @return      TRUE or FALSE
+ */
+static int
+rule_def_active(struct rule_def *rule)
+{
+  struct section_def *section = section_def_get(rule->rule_type);
+
+  if (!section || !rule->entry_def)
+    return FALSE;
+
+  if (section->rule_type == rule_context)
+    return context_entry_true(rule->entry_def);
+
+  return section->current == rule->entry_def;
+}
+
+/**
+ * Report control elements set by rules of several sections. Such
+ * conflicts are resolved with section priorities at run time; only the
+ * ones between sections of the same priority are counted.
+ *
+ * @return  number of conflicts between sections of the same priority
+ */
+static int
+control_find_conflicts()
+{
+  struct card_def *card;
+  struct elem_def *elem;
+  struct rule_def *rule;
+  struct rule_def **first;
+  struct section_def *a, *b;
+  int conflicts = 0;
+  int i, j;
+
+  first = g_new0(struct rule_def *, priv.sections_len);
+
+  for (card = priv.card_def_list;  card;  card = card->next)
+  {
+    for (elem = card->elem_list;  elem;  elem = elem->next)
+    {
+      memset(first, 0, sizeof(*first) * priv.sections_len);
+
+      /* The chain is in reverse order of definition */
+      for (rule = elem->rule;  rule;  rule = rule->elem_rule)
+      {
+        if (rule->rule_type != rule_unknown)
+          first[rule->rule_type] = rule;
+      }
+
+      for (i = 0;  i < priv.sections_len;  i++)
+      {
+        for (j = i + 1;  first[i] && j < priv.sections_len;  j++)
+        {
+          if (!first[j])
+            continue;
+
+          a = priv.sections[i];
+          b = priv.sections[j];
+
+          if (a->priority != b->priority)
+          {
+            log_info("'%s' of card '%s' is set in sections %s (line %d) "
+                     "and %s (line %d), section %s has priority",
+                     elem->name, card->name, a->name, first[i]->lineno,
+                     b->name, first[j]->lineno,
+                     a->priority > b->priority ? a->name : b->name);
+            continue;
+          }
+
+          log_warning("'%s' of card '%s' is set in sections %s (line %d) "
+                      "and %s (line %d) of the same priority",
+                      elem->name, card->name, a->name, first[i]->lineno,
+                      b->name, first[j]->lineno);
+          conflicts++;
+        }
+      }
+    }
+  }
+
+  g_free(first);
+
+  return conflicts;
+}
+
 /**
  * Execute outband execution rule. It's similar to suspend, but can be
  * cancelled and scheduled on idle.
@@ -717,6 +1555,10 @@ alsaped_outband_set(int msec, struct rule_def *rule)
   else
     priv.outband_src_id = g_idle_add(alsaped_outband_cb, rule);
 
+  priv.outband_line  = rule->lineno;
+  priv.outband_due   = g_get_monotonic_time() + msec * 1000;
+  priv.outband_start = timeline_start();
+
   return priv.outband_src_id ? 0 : -1;
 }
 
@@ -731,6 +1573,9 @@ alsaped_outband_reset()
     if (priv.log_rule_execution)
       log_info("remove outband execution");
 
+    timeline_async("outband cancelled", priv.outband_src_id,
+                   priv.outband_start, NULL);
+
     if (!g_source_remove(priv.outband_src_id))
       log_error("Failed to cancel outband execution");
 
@@ -739,7 +1584,9 @@ alsaped_outband_reset()
 }
 
 /**
- * Delay rules execution.
+ * Delay rules execution. If the worker thread is running, the worker is
+ * suspended instead of the main loop.
+ *
  * @param usec    delay time in microseconds
  * @param lineno  config file line number of this rule
  * @return        0 on success, -1 on error
@@ -747,8 +1594,15 @@ alsaped_outband_reset()
 static int
 alsaped_suspend(useconds_t usec, int lineno)
 {
+  struct log_fields fields = { lineno, -1, -1, NULL };
+  gint64 start;
   int result;
 
+  if (worker_running())
+    return worker_suspend(usec, lineno);
+
+  start = timeline_start();
+
   if (priv.log_rule_execution)
     log_info("suspend execution for %u msec (line %d)", usec / 1000, lineno);
 
@@ -756,6 +1610,8 @@ alsaped_suspend(useconds_t usec, int lineno)
     result = usleep(usec);
   while (result < 0 && errno == EINTR);  /* EINTR == Interrupted system call */
 
+  timeline_span("suspend", start, &fields);
+
   if (result >= 0)
   {
     if (priv.log_rule_execution)
@@ -775,6 +1631,7 @@ alsaped_suspend(useconds_t usec, int lineno)
  * 1. EVENT_SOUNDCARD_ADDED
  * 2. EVENT_CONTROLS_ADDED
  * 3. EVENT_CTL_ELEM_ADDED
+ * 4. EVENT_CTL_ELEM_VALUE
  *
  * @param event  an event to handle
  */
@@ -793,9 +1650,13 @@ alsa_event_cb(alsaif_event *event)
       /*
        * Sound card added.
        *
-       * Initialize card_def->num
+       * Initialize card_def->num, and start its worker thread if the
+       * workers are running already
        */
 
+      if (worker_add_card(event->card.num) < 0)
+        log_error("Can't start worker for card %d", event->card.num);
+
       card_def = card_def_find_by_num(event->card.num);
       if (card_def)
       {
@@ -897,69 +1758,240 @@ alsa_event_cb(alsaif_event *event)
 
       return;
 
+    case EVENT_CTL_ELEM_VALUE:
+      /*
+       * Control element value was changed, maybe by someone else.
+       *
+       * Forget the known value if it doesn't match, so the next rule
+       * setting the element writes it again. The reported value is
+       * kept for introspection only, a write still queued for a worker
+       * may change it.
+       */
+
+      card_def = card_def_find_by_num(event->elem.card_num);
+      elem_def = card_def_find_ctl_elem(card_def, event->elem.numid);
+
+      if (elem_def && (!elem_def->value_valid ||
+                       elem_def->value != event->elem.value))
+      {
+        elem_def->value = event->elem.value;
+        elem_def->value_valid = FALSE;
+      }
+
+      return;
+
     default:
       log_error("%s(): unknown event type %d received", __func__, event->type);
   }
 }
 
 /*
- * D-Bus interface events callback.
+ * Decision queue callback. The action is dispatched to its
+ * rule section through the section index.
+ *
  * @param data  action data
  * @return      0 on success, -1 on error
  */
 static int
 audio_actions_cb(struct action_data *data)
 {
-  static char *source_route = NULL;
-  static char *sink_route   = NULL;
+  struct section_def *section = section_def_get(data->rule_type);
+  struct log_fields fields = { 0, -1, -1, NULL };
+  gint64 start = timeline_start();
+  int retval;
 
-#define CONTEXT_LENGTH 256
-  char context[CONTEXT_LENGTH];
-  char *route_device;
+  if (!section)
+  {
+    log_error("Invalid routing type %d", data->rule_type);
+    return -1;
+  }
+
+  /* Rules executed out of decisions are not counted */
+  priv.decision = TRUE;
+  priv.counting = TRUE;
+  decision_count(queue_decision(), 0, 0);
 
-  switch (data->rule_type)
+  retval = section->handler(section, data);
+
+  /* Context variables are shown by name, entries by section */
+  if (start)
   {
-    case rule_source:
-      route_device = data->route_dev;
-      if (source_route && !strcmp(route_device, source_route))
-      {
-        log_info("Ignoring source route to '%s'. Route already in use.",
-                 route_device);
-        return 0;
-      }
+    fields.entry = data->rule_type == rule_context ? data->value
+                                                   : data->route_dev;
+    timeline_span(data->rule_type == rule_context ? data->variable
+                                                  : section->name,
+                  start, &fields);
+  }
 
-      free(source_route);
-      source_route = strdup(route_device);
-      log_info("Routing source to '%s'", route_device);
+  return retval;
+}
 
-      return control_run_rules_for_entry(rule_source, route_device);
+/*
+ * Decision queue callback for the end of actions. The control element
+ * values of the decision are written once, with the values of the winning
+ * sections. Control elements no longer kept by a section with higher
+ * priority get the values of the sections still in use.
+ *
+ * @return  0 on success, -1 on error
+ */
+static int
+decision_done_cb()
+{
+  struct decision_count *count;
+  gint64 start = timeline_start();
+  int retval;
+  guint i;
+
+  priv.decision = FALSE;
+  control_release();
+  retval = control_flush();
+  timeline_span("flush", start, NULL);
+
+  /* Decisions coalesced by the queue are recorded one by one */
+  for (i = 0;  i < priv.decision_counts->len;  i++)
+  {
+    count = &g_array_index(priv.decision_counts, struct decision_count, i);
+    stats_rules(count->rules, count->skipped);
+  }
 
-    case rule_sink:
-      route_device = data->route_dev;
-      if (sink_route && !strcmp(route_device, sink_route))
-      {
-        log_info("Ignoring sink route to '%s'. Route already in use.",
-                 route_device);
-        return 0;
-      }
+  g_array_set_size(priv.decision_counts, 0);
+  priv.counting = FALSE;
+
+  return retval;
+}
+
+/**
+ * Count rules executed and writes skipped by decision being applied
+ *
+ * @param decision  decision of the queue
+ * @param rules     rules executed
+ * @param skipped   writes skipped
+ */
+static void
+decision_count(unsigned int decision, int rules, int skipped)
+{
+  struct decision_count *count;
+  guint i;
+
+  if (!priv.counting)
+    return;
 
-      free(sink_route);
-      sink_route = strdup(route_device);
-      log_info("Routing sink to '%s'", route_device);
+  /* The actions of a decision are mostly applied together */
+  for (i = priv.decision_counts->len;  i > 0;  i--)
+  {
+    count = &g_array_index(priv.decision_counts, struct decision_count,
+                           i - 1);
 
-      return control_run_rules_for_entry(rule_sink, route_device);
+    if (count->decision == decision)
+      break;
+  }
 
-    case rule_context:
-      snprintf(context, CONTEXT_LENGTH, "%s-%s",
-               data->variable,
-               data->value);
-      log_info("Setting context '%s'", context);
+  if (!i)
+  {
+    g_array_set_size(priv.decision_counts, priv.decision_counts->len + 1);
+    count = &g_array_index(priv.decision_counts, struct decision_count,
+                           priv.decision_counts->len - 1);
+    count->decision = decision;
+    count->rules = count->skipped = 0;
+  }
 
-      return alsaped_run_context_rules(context);
+  count->rules += rules;
+  count->skipped += skipped;
+}
 
-    default:
-      log_error("Invalid routing type %d", data->rule_type);
-      return -1;
+/*
+ * Apply route (or user defined section) entry. The entry is skipped if
+ * it's already in use. The route state is kept as entry, so it's
+ * compared without string operations.
+ *
+ * @param section  rule section
+ * @param data     action data
+ *
+ * @return  0 on success, -1 on error
+ */
+static int
+section_route_cb(struct section_def *section, struct action_data *data)
+{
+  const char *route_device = data->route_dev;
+  struct entry_def *entry = control_find_entry(route_device);
+  struct log_fields fields = { 0, -1, -1, route_device };
+
+  if (entry && entry == section->current)
+  {
+    log_rule(&fields, "Ignoring %s route to '%s'. Route already in use.",
+             section->label, route_device);
+    return 0;
+  }
+
+  section->current = entry;
+  log_rule(&fields, "Routing %s to '%s'", section->label, route_device);
+
+  if (!entry || section->rule_type >= entry->rules_len)
+    return 0;
+
+  return rule_def_run(entry->rules[section->rule_type]);
+}
+
+/*
+ * Update context variable in the context store, which applies the context
+ * entries depending on it.
+ *
+ * @param section  context rule section
+ * @param data     action data
+ *
+ * @return  0 on success, -1 on error
+ */
+static int
+section_context_cb(struct section_def *section, struct action_data *data)
+{
+  log_info("Setting context '%s-%s'", data->variable, data->value);
+
+  return context_set(data->variable, data->value, context_entry_cb);
+}
+
+/*
+ * Context store callback: apply context rules of entry
+ * @param entry  rule entry
+ * @return       0 on success, -1 on error
+ */
+static int
+context_entry_cb(struct entry_def *entry)
+{
+  return rule_def_run(entry->rules[rule_context]);
+}
+
+/*
+ * Worker callback: control element write failed, so its value is unknown
+ * and the decision of the write failed
+ *
+ * @param card_num  sound card number
+ * @param numid     control element numid
+ * @param lineno    config file line of the rule which staged the write
+ * @param decision  decision of the queue
+ */
+static void
+write_failed_cb(int card_num, int numid, int lineno, unsigned int decision)
+{
+  struct elem_def *elem_def;
+  struct rule_def *rule;
+
+  queue_fail(decision);
+
+  elem_def = card_def_find_ctl_elem(card_def_find_by_num(card_num), numid);
+
+  if (elem_def)
+  {
+    elem_def->value_valid = FALSE;
+
+    /* The writer may have changed since, so charge the rule of the write */
+    for (rule = elem_def->rule;  rule;  rule = rule->elem_rule)
+    {
+      if (rule->lineno == lineno)
+      {
+        rule->stats.failures++;
+        break;
+      }
+    }
   }
 }
 
@@ -970,6 +2002,10 @@ static gboolean
 alsaped_outband_cb(gpointer data)
 {
   struct rule_def *rule = data;
+  struct log_fields fields = { rule->lineno, -1, -1, NULL };
+  gint64 start = timeline_start();
+
+  timeline_async("outband", priv.outband_src_id, priv.outband_start, &fields);
   priv.outband_src_id = 0;
 
   if (rule_def_run(rule) >= 0)
@@ -982,6 +2018,8 @@ alsaped_outband_cb(gpointer data)
     log_error("outband execution of rules failed (line %d)", rule->lineno);
   }
 
+  timeline_span("outband execution", start, &fields);
+
   return G_SOURCE_REMOVE;
 }
 
@@ -1,6 +1,8 @@
 #ifndef CONTROL_H
 #define CONTROL_H
 
+#include <stdatomic.h>
+#include <stdint.h>
 #include "options.h"
 
 enum rule_type {
@@ -11,6 +13,8 @@ enum rule_type {
   rule_source,
   /* context rule */
   rule_context,
+  /* number of built-in rule types; sections declared in config file
+   * with [section name] get rule types starting from this value */
   rule_max
 };
 
@@ -46,6 +50,35 @@ struct elem_def {
   int subdev;
   int numid;
   struct rule_def *rule;
+  /* value last written or reported by ALSA, known to be set to the
+   * control element if value_valid */
+  long value;
+  int  value_valid;
+  /* rule whose value the control element should have */
+  struct rule_def *target;
+  /* rule which set the value, NULL for defaults */
+  struct rule_def *owner;
+  /* rule which wrote the value last, its failures are counted */
+  struct rule_def *writer;
+  /* winning rule of the decision being applied, the decision of the
+   * queue which staged it and its txid, logged with the write */
+  struct rule_def *pending;
+  unsigned int decision;
+  uint32_t txid;
+  /* a rule was kept out by the owner, reapplied when it's released */
+  int blocked;
+};
+
+/* Execution counters of alsa setting rule */
+struct rule_stats {
+  unsigned int executions;
+  /* control element writes, and skipped as the element had the value or
+   * was kept by a section with higher priority */
+  unsigned int writes;
+  unsigned int skipped;
+  unsigned int failures;
+  /* time of the writes, added by the worker threads */
+  atomic_ullong write_usec;
 };
 
 /* Rule definition */
@@ -53,6 +86,9 @@ struct rule_def {
   struct rule_def *next;
   enum   action_type action_type;
   int    lineno;
+  /* section and entry of the rule, unset for defaults */
+  enum   rule_type rule_type;
+  struct entry_def *entry_def;
   union {
     /* delay is for suspend and outband rules */
     int delay;
@@ -63,6 +99,7 @@ struct rule_def {
       struct rule_def *elem_rule;
       char  *value_str;
       long   value;
+      struct rule_stats stats;
     };
   };
 };
@@ -71,16 +108,86 @@ struct rule_def {
 struct entry_def {
   struct entry_def *next;
   const char *name;
-  struct rule_def *rules[4];
+  /* rule lists indexed by rule type */
+  struct rule_def **rules;
+  int rules_len;
+};
+
+struct action_data;
+
+/* Rule section definition */
+struct section_def {
+  char *name;
+  /* name used in log messages */
+  char *label;
+  enum rule_type rule_type;
+  /* applies incoming action to the section */
+  int (*handler)(struct section_def *, struct action_data *);
+  /* entry currently in use by route like sections, NULL if none or
+   * if the route has no rules */
+  struct entry_def *current;
+  /* controls set by several sections get the value of the section
+   * with the highest priority */
+  int priority;
 };
 
+/** Called for every name/value pair of the current state */
+typedef void (*control_state_cb) (const char *name,
+                                  const char *value,
+                                  void *data);
+
+/** Called for every sound card definition */
+typedef void (*control_card_cb) (struct card_def *card,
+                                 void *data);
+
+/** Called for every alsa setting rule */
+typedef void (*control_rule_cb) (struct rule_def *rule,
+                                 void *data);
+
+/** Called for every control element definition */
+typedef void (*control_elem_cb) (struct card_def *card,
+                                 struct elem_def *elem,
+                                 void *data);
+
 int control_init                (struct options *options);
 
 int control_set_cb              (void);
 
+int control_compile             (void);
+
 int control_run_rules_for_entry (enum rule_type rule_type,
                                  const char *entry);
 
+int control_trigger             (const char *section,
+                                 const char *entry);
+
+int control_define_section      (const char *name);
+
+int control_set_priority        (const char *name,
+                                 int priority);
+
+int control_conflicts           (void);
+
+void control_foreach_route      (control_state_cb cb,
+                                 void *data);
+
+void control_foreach_card       (control_card_cb cb,
+                                 void *data);
+
+void control_foreach_rule       (control_rule_cb cb,
+                                 void *data);
+
+void control_foreach_elem       (control_elem_cb cb,
+                                 void *data);
+
+int control_get_outband         (int *lineno,
+                                 int *msec);
+
+void control_stats_dump         (void);
+
+enum rule_type
+control_find_section            (const char *name);
+
 struct card_def *
 control_define_card             (const char *id,
                                  const char *name);
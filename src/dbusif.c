@@ -5,6 +5,9 @@
  * ALSA Policy Enforcement D-Bus interface functions.
  * Control alsaped with D-Bus messages. This is the main source of events
  * for the daemon, which reacts according to rules read from config file.
+ * The actions come as audio_actions signals of the policy daemon, or as
+ * method calls of the com.nokia.policy.alsa interface, which are replied
+ * when the actions are applied.
  *
  * @{ */
 
@@ -16,9 +19,16 @@
 #include <string.h>
 #include <dbus/dbus-glib-lowlevel.h>
 
+#include "action.h"
+#include "context.h"
 #include "control.h"
 #include "options.h"
 #include "logging.h"
+#include "queue.h"
+#include "record.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
 
 #include "dbusif.h"
 
@@ -34,6 +44,9 @@
 #define POLICY_DBUS_PDPATH          "/com/nokia/policy"
 #define POLICY_DBUS_PDNAME          "org.freedesktop.ohm"
 
+#define POLICY_ALSA_INTERFACE       "com.nokia.policy.alsa"
+#define POLICY_ALSA_ERROR_FAILED    "com.nokia.policy.alsa.Error.Failed"
+
 #define POLICY_DECISION             "decision"
 #define POLICY_ACTIONS              "audio_actions"
 #define POLICY_STATUS               "status"
@@ -43,6 +56,21 @@
 struct actdsc {
   const char   *name;
   int         (*parser)(DBusMessageIter *);
+  GQuark        quark;
+};
+
+/* Method descriptor */
+struct methdsc {
+  const char   *name;
+  const char   *signature;
+  DBusMessage *(*handler)(DBusMessage *);
+};
+
+/* Property descriptor */
+struct propdsc {
+  const char   *name;
+  const char   *signature;
+  void        (*append)(DBusMessageIter *);
 };
 
 /** Argument descriptor for actions */
@@ -50,6 +78,7 @@ struct argdsc {
   const char   *name;
   int           offs;
   int           type;
+  GQuark        quark;
 };
 
 /** audio_route arguments */
@@ -64,11 +93,15 @@ struct argctx {
   char         *value;
 };
 
+/** user defined section arguments */
+struct argsec {
+  char         *section;
+  char         *entry;
+};
+
 
 /** D-Bus interface data */
 static struct {
-  /** audio_actions signal callback */
-  action_handler cb;
   /** D-Bus connection */
   void *conn;
   /* Signal interface */
@@ -87,6 +120,8 @@ static struct {
   int   regist;
   /** Log D-Bus message related information */
   int   log;
+  /** Connect to the session bus */
+  int   session;
 } priv;
 
 
@@ -95,12 +130,78 @@ static void registration_cb(DBusPendingCall *pend, void *data);
 static DBusHandlerResult filter(DBusConnection *, DBusMessage *, void *);
 static void handle_admin_message(DBusMessage *msg);
 static void handle_action_message(DBusMessage *msg);
+static DBusHandlerResult method_handler(DBusConnection *, DBusMessage *,
+                                        void *);
+static DBusMessage *set_route_method(DBusMessage *msg);
+static DBusMessage *set_context_method(DBusMessage *msg);
+static DBusMessage *apply_batch_method(DBusMessage *msg);
+static DBusMessage *get_state_method(DBusMessage *msg);
+static DBusMessage *get_stats_method(DBusMessage *msg);
+static DBusMessage *get_rule_stats_method(DBusMessage *msg);
+static DBusMessage *get_property_method(DBusMessage *msg);
+static DBusMessage *get_all_properties_method(DBusMessage *msg);
+static DBusMessage *set_property_method(DBusMessage *msg);
+static struct propdsc *property_find(DBusMessage *, const char *,
+                                     const char *, DBusMessage **);
+static void routes_append(DBusMessageIter *);
+static void context_append(DBusMessageIter *);
+static void outband_append(DBusMessageIter *);
+static void controls_append(DBusMessageIter *);
+static void stats_append(DBusMessageIter *);
+static void rule_stats_append(DBusMessageIter *);
+static void control_append_cb(struct card_def *, struct elem_def *, void *);
+static DBusMessage *method_queue(DBusMessage *, struct action_data *, int,
+                                 gint64);
+static void method_reply_cb(void *data, int success);
+static void state_append_cb(const char *, const char *, void *);
+static void stats_append_cb(const char *, const struct stats_summary *,
+                            void *);
+static void rule_stats_append_cb(struct rule_def *, void *);
 static int audio_route_parser(DBusMessageIter *actit);
 static int context_parser(DBusMessageIter *actit);
+static int section_parser(DBusMessageIter *actit);
+static void status_cb(void *data, int success);
 static int signal_status(uint32_t txid, uint32_t status);
 void dbusif_free();
 
 
+static struct actdsc actions[] = {
+  { "com.nokia.policy.audio_route", audio_route_parser },
+  { "com.nokia.policy.context"    , context_parser     },
+  { "com.nokia.policy.section"    , section_parser     },
+  { NULL                          , NULL               }
+};
+
+/* Read-only properties of com.nokia.policy.alsa interface */
+static struct propdsc properties[] = {
+  { "Routes"   , "a{ss}"       , routes_append     },
+  { "Context"  , "a{ss}"       , context_append    },
+  { "Outband"  , "a(uu)"       , outband_append    },
+  { "Controls" , "a(ssuxxb)"   , controls_append   },
+  { "Stats"    , "a(stttttt)"  , stats_append      },
+  { "RuleStats", "a(usssuuuut)", rule_stats_append },
+  { NULL       , NULL          , NULL              }
+};
+
+static struct argdsc route_args[] = {
+  { "type",   G_STRUCT_OFFSET(struct argrt, type),   DBUS_TYPE_STRING },
+  { "device", G_STRUCT_OFFSET(struct argrt, device), DBUS_TYPE_STRING },
+  { NULL,                  0,                        DBUS_TYPE_INVALID}
+};
+
+static struct argdsc context_args[] = {
+  { "variable", G_STRUCT_OFFSET(struct argctx, variable), DBUS_TYPE_STRING },
+  { "value",    G_STRUCT_OFFSET(struct argctx, value)   , DBUS_TYPE_STRING },
+  { NULL,                    0                          , DBUS_TYPE_INVALID}
+};
+
+static struct argdsc section_args[] = {
+  { "section", G_STRUCT_OFFSET(struct argsec, section), DBUS_TYPE_STRING },
+  { "entry",   G_STRUCT_OFFSET(struct argsec, entry)  , DBUS_TYPE_STRING },
+  { NULL,                   0                         , DBUS_TYPE_INVALID}
+};
+
+
 /**
  * Initialize D-Bus interface options
  * @param options  options parsed from command line
@@ -109,7 +210,14 @@ void dbusif_free();
 int
 dbusif_init(struct options *options)
 {
+  static struct argdsc *args[] = {
+    route_args, context_args, section_args, NULL
+  };
+
   struct dbusif_options *opts;
+  struct actdsc *act;
+  struct argdsc **desc;
+  struct argdsc *arg;
   char admrule[512];
   char actrule[512];
   char *ifname;
@@ -143,21 +251,25 @@ dbusif_init(struct options *options)
     return -1;
   }
 
+  /* Action and argument names are matched by quarks while parsing */
+  for (act = actions;  act->name != NULL;  act++)
+    act->quark = g_quark_from_static_string(act->name);
+
+  for (desc = args;  *desc != NULL;  desc++)
+  {
+    for (arg = *desc;  arg->name != NULL;  arg++)
+      arg->quark = g_quark_from_static_string(arg->name);
+  }
+
+  if (record_open(opts->record) < 0)
+    return -1;
+
   priv.log = opts->log;
+  priv.session = opts->session;
 
   return 0;
 }
 
-/**
- * Set D-Bus interface callback function
- * @param cb  callback function
- */
-void
-dbusif_set_cb(action_handler cb)
-{
-  priv.cb = cb;
-}
-
 /**
  * Set filters for NameOwnerChanged and audio_actions/decision signals.
  * Register to Policy Decision Point over D-Bus.
@@ -166,10 +278,16 @@ dbusif_set_cb(action_handler cb)
  */
 int dbusif_create()
 {
+  static DBusObjectPathVTable vtable = {
+    .message_function = method_handler
+  };
+
   DBusError error;
+  int       ret;
 
   dbus_error_init(&error);
-  priv.conn = dbus_bus_get(DBUS_BUS_SYSTEM, &error);
+  priv.conn = dbus_bus_get(priv.session ? DBUS_BUS_SESSION : DBUS_BUS_SYSTEM,
+                           &error);
 
   if (!priv.conn)
   {
@@ -189,6 +307,29 @@ int dbusif_create()
     goto fail;
   }
 
+  if (!dbus_connection_register_object_path(priv.conn, priv.mypath,
+                                            &vtable, NULL))
+  {
+    log_error("Can't register D-Bus object path '%s'", priv.mypath);
+    goto fail;
+  }
+
+  /* Without the well-known name the methods are still available
+   * through the unique name of the connection */
+  ret = dbus_bus_request_name(priv.conn, POLICY_DBUS_MYNAME,
+                              DBUS_NAME_FLAG_DO_NOT_QUEUE, &error);
+
+  if (ret != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
+  {
+    if (dbus_error_is_set(&error))
+      log_warning("Can't own D-Bus name '%s': %s",
+                  POLICY_DBUS_MYNAME, error.message);
+    else
+      log_warning("Can't own D-Bus name '%s'", POLICY_DBUS_MYNAME);
+
+    dbus_error_free(&error);
+  }
+
   dbus_bus_add_match(priv.conn, priv.admrule, &error);
 
   if (dbus_error_is_set(&error))
@@ -227,6 +368,7 @@ void dbusif_free()
   if (priv.conn)
   {
     dbus_connection_remove_filter(priv.conn, filter, NULL);
+    dbus_connection_unregister_object_path(priv.conn, priv.mypath);
     dbus_bus_remove_match(priv.conn, priv.admrule, NULL);
     dbus_bus_remove_match(priv.conn, priv.actrule, NULL);
     dbus_connection_unref(priv.conn);
@@ -420,13 +562,8 @@ handle_admin_message(DBusMessage *msg)
 static void
 handle_action_message(DBusMessage *msg)
 {
-  static struct actdsc actions[] = {
-    { "com.nokia.policy.audio_route", audio_route_parser },
-    { "com.nokia.policy.context"    , context_parser     },
-    { NULL                          , NULL               }
-  };
-
   struct actdsc   *act;
+  GQuark           quark;
   DBusMessageIter  msgit;
   dbus_uint32_t    txid;
   char            *actname;
@@ -434,6 +571,8 @@ handle_action_message(DBusMessage *msg)
   DBusMessageIter  entit;
   DBusMessageIter  actit;
   int              success = TRUE;
+  /* the latency of the decision is measured from here */
+  gint64           start = g_get_monotonic_time();
 
   dbus_message_iter_init(msg, &msgit);
 
@@ -445,6 +584,11 @@ handle_action_message(DBusMessage *msg)
   if (priv.log)
     log_info("got actions (txid:%d)", txid);
 
+  trace(actions, txid);
+  log_set_txid(txid);
+  timeline_instant("audio_actions", NULL);
+  record_begin();
+
   if (!dbus_message_iter_next(&msgit) ||
       dbus_message_iter_get_arg_type(&msgit) != DBUS_TYPE_ARRAY)
   {
@@ -491,9 +635,12 @@ handle_action_message(DBusMessage *msg)
         continue;
       }
 
+      /* Names never interned can't match any of the actions */
+      quark = g_quark_try_string(actname);
+
       for (act = actions;  act->name != NULL;  act++)
       {
-        if (!strcmp(actname, act->name))
+        if (act->quark == quark)
           break;
       }
 
@@ -507,15 +654,20 @@ handle_action_message(DBusMessage *msg)
   while (dbus_message_iter_next(&arrit));
 
 send_signal:
+  /* Rejected and malformed decisions are recorded with their status */
+  record_end(txid, success);
+
   if (priv.log)
   {
     if (success)
-      log_info("actions %s", "succeeded");
+      log_info("actions %s", "queued");
     else
       log_info("actions %s", "failed");
   }
 
-  signal_status(txid, success);
+  /* Status is sent when the queued actions are applied */
+  queue_ack(status_cb, GUINT_TO_POINTER(txid), success, start);
+  log_set_txid(0);
 }
 
 /**
@@ -535,6 +687,7 @@ action_parser(DBusMessageIter *actit, struct argdsc *descs, void *args, int len)
   DBusMessageIter  cmdit;
   DBusMessageIter  valit;
   struct argdsc   *desc;
+  GQuark           quark;
   char            *argname;
   void            *argval;
 
@@ -563,9 +716,11 @@ action_parser(DBusMessageIter *actit, struct argdsc *descs, void *args, int len)
 
     dbus_message_iter_recurse(&argit, &valit);
 
+    quark = g_quark_try_string(argname);
+
     for (desc = descs;  desc->name != NULL;  desc++)
     {
-      if (!strcmp(argname, desc->name))
+      if (desc->quark == quark)
       {
         if (desc->offs + sizeof(void *) > len)
         {
@@ -599,12 +754,6 @@ action_parser(DBusMessageIter *actit, struct argdsc *descs, void *args, int len)
 static int
 audio_route_parser(DBusMessageIter *actit)
 {
-  static struct argdsc descs[] = {
-    { "type",   G_STRUCT_OFFSET(struct argrt, type),   DBUS_TYPE_STRING },
-    { "device", G_STRUCT_OFFSET(struct argrt, device), DBUS_TYPE_STRING },
-    { NULL,                  0,                        DBUS_TYPE_INVALID}
-  };
-
   struct action_data data;
   struct argrt args;
   int result = TRUE;
@@ -614,7 +763,7 @@ audio_route_parser(DBusMessageIter *actit)
 
   do
   {
-    if (!action_parser(actit, descs, &args, sizeof(args)))
+    if (!action_parser(actit, route_args, &args, sizeof(args)))
     {
       log_error("Action parsing failed");
       return FALSE;
@@ -629,22 +778,13 @@ audio_route_parser(DBusMessageIter *actit)
     if (priv.log)
       log_info("Got routing request: '%s' -> '%s'", args.type, args.device);
 
-    if (!strcmp(args.type, "sink"))
-      data.rule_type = rule_sink;
-    else if (!strcmp(args.type, "source"))
-      data.rule_type = rule_source;
-    else
-    {
-      log_error("Invalid audio route type '%s'", args.type);
+    if (action_build("route", args.type, args.device, &data) < 0)
       return FALSE;
-    }
 
-    if (priv.cb)
-    {
-      data.route_dev = args.device;
-      if (priv.cb(&data) < 0)
-        result = FALSE;
-    }
+    record_action("route", args.type, args.device);
+
+    if (queue_push(&data) < 0)
+      result = FALSE;
   }
   while (dbus_message_iter_next(actit));
 
@@ -659,12 +799,6 @@ audio_route_parser(DBusMessageIter *actit)
 static int
 context_parser(DBusMessageIter *actit)
 {
-  static struct argdsc descs[] = {
-    { "variable", G_STRUCT_OFFSET(struct argctx, variable), DBUS_TYPE_STRING },
-    { "value",    G_STRUCT_OFFSET(struct argctx, value)   , DBUS_TYPE_STRING },
-    { NULL,                    0                          , DBUS_TYPE_INVALID}
-  };
-
   struct action_data data;
   struct argctx args;
   int result = TRUE;
@@ -674,7 +808,7 @@ context_parser(DBusMessageIter *actit)
 
   do
   {
-    if (!action_parser(actit, descs, &args, sizeof(args)))
+    if (!action_parser(actit, context_args, &args, sizeof(args)))
     {
       log_error("Action parsing failed");
       return FALSE;
@@ -689,21 +823,770 @@ context_parser(DBusMessageIter *actit)
     if (priv.log)
       log_info("Got context request: '%s' '%s'", args.variable, args.value);
 
-    if (priv.cb)
+    if (action_build("context", args.variable, args.value, &data) < 0)
+      return FALSE;
+
+    record_action("context", args.variable, args.value);
+
+    if (queue_push(&data) < 0)
+      result = FALSE;
+  }
+  while (dbus_message_iter_next(actit));
+
+  return result;
+}
+
+/**
+ * Parse user defined section action
+ * @param actit  D-Bus message iterator
+ * @return       FALSE if error, TRUE if success
+ */
+static int
+section_parser(DBusMessageIter *actit)
+{
+  struct action_data data;
+  struct argsec args;
+  int result = TRUE;
+
+  if (priv.log)
+    log_info("parsing sections");
+
+  do
+  {
+    if (!action_parser(actit, section_args, &args, sizeof(args)))
     {
-      data.rule_type = rule_context;
-      data.variable  = args.variable;
-      data.value     = args.value;
+      log_error("Action parsing failed");
+      return FALSE;
+    }
 
-      if (priv.cb(&data) < 0)
-        result = FALSE;
+    if (!args.section || !args.entry)
+    {
+      log_error("Some of the required action arguments are missing");
+      return FALSE;
     }
+
+    if (priv.log)
+      log_info("Got section request: '%s' -> '%s'", args.section, args.entry);
+
+    if (action_build("section", args.section, args.entry, &data) < 0)
+      return FALSE;
+
+    record_action("section", args.section, args.entry);
+
+    if (queue_push(&data) < 0)
+      result = FALSE;
   }
   while (dbus_message_iter_next(actit));
 
   return result;
 }
 
+/**
+ * Handle method calls of com.nokia.policy.alsa interface and of the
+ * properties interface. Methods which change the state are replied when
+ * their actions are applied.
+ */
+static DBusHandlerResult
+method_handler(DBusConnection *conn, DBusMessage *msg, void *user_data)
+{
+  static struct methdsc alsa_methods[] = {
+    { "SetRoute"  , "ss"    , set_route_method   },
+    { "SetContext", "ss"    , set_context_method },
+    { "ApplyBatch", "a(sss)", apply_batch_method },
+    { "GetState"  , ""      , get_state_method   },
+    { "GetStats"  , ""      , get_stats_method   },
+    { "GetRuleStats", ""    , get_rule_stats_method },
+    { NULL        , NULL    , NULL               }
+  };
+
+  static struct methdsc property_methods[] = {
+    { "Get"       , "ss"    , get_property_method       },
+    { "GetAll"    , "s"     , get_all_properties_method },
+    { "Set"       , "ssv"   , set_property_method       },
+    { NULL        , NULL    , NULL                      }
+  };
+
+  struct methdsc *methods;
+  struct methdsc *meth;
+  const char     *ifname;
+  const char     *member;
+  DBusMessage    *reply;
+
+  if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  ifname = dbus_message_get_interface(msg);
+  member = dbus_message_get_member(msg);
+
+  if (ifname && !strcmp(ifname, DBUS_INTERFACE_PROPERTIES))
+    methods = property_methods;
+  else if (!ifname || !strcmp(ifname, POLICY_ALSA_INTERFACE))
+    methods = alsa_methods;
+  else
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  if (!member)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  for (meth = methods;  meth->name != NULL;  meth++)
+  {
+    if (!strcmp(member, meth->name))
+      break;
+  }
+
+  if (priv.log)
+    log_info("got method call '%s'", member);
+
+  if (!meth->name)
+  {
+    reply = dbus_message_new_error_printf(msg, DBUS_ERROR_UNKNOWN_METHOD,
+                                          "Unknown method '%s'", member);
+  }
+  else if (!dbus_message_has_signature(msg, meth->signature))
+  {
+    reply = dbus_message_new_error_printf(msg, DBUS_ERROR_INVALID_ARGS,
+                                          "Expected signature '%s'",
+                                          meth->signature);
+  }
+  else
+  {
+    /* NULL if the reply is sent when the actions are applied */
+    reply = meth->handler(msg);
+  }
+
+  if (reply)
+  {
+    if (!dbus_connection_send(priv.conn, reply, NULL))
+      log_error("Can't send reply to '%s': out of memory", member);
+
+    dbus_message_unref(reply);
+  }
+
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/**
+ * Handle SetRoute(s type, s device) method call
+ * @param msg  method call message
+ * @return     error reply or NULL if the action was queued
+ */
+static DBusMessage *
+set_route_method(DBusMessage *msg)
+{
+  struct action_data data;
+  gint64 start = g_get_monotonic_time();
+  char *type;
+  char *device;
+
+  dbus_message_get_args(msg, NULL,
+                        DBUS_TYPE_STRING, &type,
+                        DBUS_TYPE_STRING, &device,
+                        DBUS_TYPE_INVALID);
+
+  if (action_build("route", type, device, &data) < 0)
+  {
+    return dbus_message_new_error_printf(msg, DBUS_ERROR_INVALID_ARGS,
+                                         "Invalid route type '%s'", type);
+  }
+
+  return method_queue(msg, &data, 1, start);
+}
+
+/**
+ * Handle SetContext(s variable, s value) method call
+ * @param msg  method call message
+ * @return     error reply or NULL if the action was queued
+ */
+static DBusMessage *
+set_context_method(DBusMessage *msg)
+{
+  struct action_data data;
+  gint64 start = g_get_monotonic_time();
+  char *variable;
+  char *value;
+
+  dbus_message_get_args(msg, NULL,
+                        DBUS_TYPE_STRING, &variable,
+                        DBUS_TYPE_STRING, &value,
+                        DBUS_TYPE_INVALID);
+
+  if (action_build("context", variable, value, &data) < 0)
+  {
+    return dbus_message_new_error_printf(msg, DBUS_ERROR_INVALID_ARGS,
+                                         "Invalid context variable '%s'",
+                                         variable);
+  }
+
+  return method_queue(msg, &data, 1, start);
+}
+
+/**
+ * Handle ApplyBatch(a(sss) actions) method call. Every action is a
+ * ("route", type, device), ("context", variable, value) or
+ * ("section", name, entry) triplet. Nothing is queued if some of the
+ * actions are invalid.
+ *
+ * @param msg  method call message
+ * @return     error reply or NULL if the actions were queued
+ */
+static DBusMessage *
+apply_batch_method(DBusMessage *msg)
+{
+  DBusMessageIter     msgit;
+  DBusMessageIter     arrit;
+  DBusMessageIter     actit;
+  struct action_data *data;
+  DBusMessage        *reply;
+  char               *args[3];
+  gint64              start = g_get_monotonic_time();
+  int                 len;
+  int                 i;
+
+  dbus_message_iter_init(msg, &msgit);
+  dbus_message_iter_recurse(&msgit, &arrit);
+
+  for (len = 0;
+       dbus_message_iter_get_arg_type(&arrit) == DBUS_TYPE_STRUCT;
+       dbus_message_iter_next(&arrit))
+  {
+    len++;
+  }
+
+  data = g_new(struct action_data, len);
+
+  dbus_message_iter_recurse(&msgit, &arrit);
+
+  for (i = 0;  i < len;  i++, dbus_message_iter_next(&arrit))
+  {
+    dbus_message_iter_recurse(&arrit, &actit);
+    dbus_message_iter_get_basic(&actit, &args[0]);
+    dbus_message_iter_next(&actit);
+    dbus_message_iter_get_basic(&actit, &args[1]);
+    dbus_message_iter_next(&actit);
+    dbus_message_iter_get_basic(&actit, &args[2]);
+
+    if (action_build(args[0], args[1], args[2], &data[i]) < 0)
+    {
+      g_free(data);
+      return dbus_message_new_error_printf(msg, DBUS_ERROR_INVALID_ARGS,
+                                           "Invalid action %d ('%s' '%s')",
+                                           i, args[0], args[1]);
+    }
+  }
+
+  reply = method_queue(msg, data, len, start);
+  g_free(data);
+
+  return reply;
+}
+
+/**
+ * Handle GetState() method call. The reply has the current entries of
+ * route like sections and the values of context variables, both as
+ * a{ss} dictionaries.
+ *
+ * @param msg  method call message
+ * @return     the reply or NULL if out of memory
+ */
+static DBusMessage *
+get_state_method(DBusMessage *msg)
+{
+  DBusMessage     *reply;
+  DBusMessageIter  msgit;
+
+  if (!(reply = dbus_message_new_method_return(msg)))
+    return NULL;
+
+  dbus_message_iter_init_append(reply, &msgit);
+  routes_append(&msgit);
+  context_append(&msgit);
+
+  return reply;
+}
+
+/**
+ * Handle GetStats() method call. The reply has the summaries of the
+ * statistics histograms as a(stttttt): name, count, min, p50, p90, p99
+ * and max.
+ *
+ * @param msg  method call message
+ * @return     the reply or NULL if out of memory
+ */
+static DBusMessage *
+get_stats_method(DBusMessage *msg)
+{
+  DBusMessage     *reply;
+  DBusMessageIter  msgit;
+
+  if (!(reply = dbus_message_new_method_return(msg)))
+    return NULL;
+
+  dbus_message_iter_init_append(reply, &msgit);
+  stats_append(&msgit);
+
+  return reply;
+}
+
+/**
+ * Append histogram summary to a(stttttt) array
+ *
+ * @param name     name of the histogram
+ * @param summary  the summary
+ * @param data     D-Bus message iterator of the array
+ */
+static void
+stats_append_cb(const char *name, const struct stats_summary *summary,
+                void *data)
+{
+  DBusMessageIter *arrit = data;
+  DBusMessageIter  strit;
+  const uint64_t  *values[] = { &summary->count, &summary->min,
+                                &summary->p50, &summary->p90,
+                                &summary->p99, &summary->max };
+  int              i;
+
+  dbus_message_iter_open_container(arrit, DBUS_TYPE_STRUCT, NULL, &strit);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_STRING, &name);
+
+  for (i = 0;  i < G_N_ELEMENTS(values);  i++)
+    dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT64, values[i]);
+
+  dbus_message_iter_close_container(arrit, &strit);
+}
+
+/**
+ * Handle GetRuleStats() method call. The reply has the counters of the
+ * alsa setting rules as a(usssuuuut):
+ * line, card, control, entry (empty for defaults), executions, writes,
+ * skipped writes, failures and write time in microseconds.
+ *
+ * @param msg  method call message
+ * @return     the reply or NULL if out of memory
+ */
+static DBusMessage *
+get_rule_stats_method(DBusMessage *msg)
+{
+  DBusMessage     *reply;
+  DBusMessageIter  msgit;
+
+  if (!(reply = dbus_message_new_method_return(msg)))
+    return NULL;
+
+  dbus_message_iter_init_append(reply, &msgit);
+  rule_stats_append(&msgit);
+
+  return reply;
+}
+
+/**
+ * Append rule counters to a(usssuuuut) array
+ *
+ * @param rule  alsa setting rule
+ * @param data  D-Bus message iterator of the array
+ */
+static void
+rule_stats_append_cb(struct rule_def *rule, void *data)
+{
+  DBusMessageIter *arrit = data;
+  DBusMessageIter  strit;
+  dbus_uint32_t    line = rule->lineno;
+  const char      *entry = rule->entry_def ? rule->entry_def->name : "";
+  dbus_uint64_t    usec = atomic_load_explicit(&rule->stats.write_usec,
+                                               memory_order_relaxed);
+
+  dbus_message_iter_open_container(arrit, DBUS_TYPE_STRUCT, NULL, &strit);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT32, &line);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_STRING,
+                                 &rule->card_def->name);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_STRING,
+                                 &rule->elem_def->name);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_STRING, &entry);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT32,
+                                 &rule->stats.executions);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT32,
+                                 &rule->stats.writes);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT32,
+                                 &rule->stats.skipped);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT32,
+                                 &rule->stats.failures);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT64, &usec);
+  dbus_message_iter_close_container(arrit, &strit);
+}
+
+/**
+ * Handle Get(s interface, s name) method call of the properties interface
+ *
+ * @param msg  method call message
+ * @return     the reply or NULL if out of memory
+ */
+static DBusMessage *
+get_property_method(DBusMessage *msg)
+{
+  struct propdsc  *prop;
+  const char      *ifname;
+  const char      *name;
+  DBusMessage     *reply;
+  DBusMessageIter  msgit;
+  DBusMessageIter  varit;
+
+  dbus_message_get_args(msg, NULL,
+                        DBUS_TYPE_STRING, &ifname,
+                        DBUS_TYPE_STRING, &name,
+                        DBUS_TYPE_INVALID);
+
+  if (!(prop = property_find(msg, ifname, name, &reply)))
+    return reply;
+
+  if (!(reply = dbus_message_new_method_return(msg)))
+    return NULL;
+
+  dbus_message_iter_init_append(reply, &msgit);
+  dbus_message_iter_open_container(&msgit, DBUS_TYPE_VARIANT,
+                                   prop->signature, &varit);
+  prop->append(&varit);
+  dbus_message_iter_close_container(&msgit, &varit);
+
+  return reply;
+}
+
+/**
+ * Handle GetAll(s interface) method call of the properties interface
+ *
+ * @param msg  method call message
+ * @return     the reply or NULL if out of memory
+ */
+static DBusMessage *
+get_all_properties_method(DBusMessage *msg)
+{
+  struct propdsc  *prop;
+  const char      *ifname;
+  DBusMessage     *reply;
+  DBusMessageIter  msgit;
+  DBusMessageIter  dictit;
+  DBusMessageIter  entit;
+  DBusMessageIter  varit;
+
+  dbus_message_get_args(msg, NULL,
+                        DBUS_TYPE_STRING, &ifname,
+                        DBUS_TYPE_INVALID);
+
+  if (*ifname && strcmp(ifname, POLICY_ALSA_INTERFACE))
+  {
+    return dbus_message_new_error_printf(msg, DBUS_ERROR_UNKNOWN_INTERFACE,
+                                         "Unknown interface '%s'", ifname);
+  }
+
+  if (!(reply = dbus_message_new_method_return(msg)))
+    return NULL;
+
+  dbus_message_iter_init_append(reply, &msgit);
+  dbus_message_iter_open_container(&msgit, DBUS_TYPE_ARRAY, "{sv}", &dictit);
+
+  for (prop = properties;  prop->name != NULL;  prop++)
+  {
+    dbus_message_iter_open_container(&dictit, DBUS_TYPE_DICT_ENTRY, NULL,
+                                     &entit);
+    dbus_message_iter_append_basic(&entit, DBUS_TYPE_STRING, &prop->name);
+    dbus_message_iter_open_container(&entit, DBUS_TYPE_VARIANT,
+                                     prop->signature, &varit);
+    prop->append(&varit);
+    dbus_message_iter_close_container(&entit, &varit);
+    dbus_message_iter_close_container(&dictit, &entit);
+  }
+
+  dbus_message_iter_close_container(&msgit, &dictit);
+
+  return reply;
+}
+
+/**
+ * Handle Set(s interface, s name, v value) method call of the properties
+ * interface. The properties are read-only.
+ *
+ * @param msg  method call message
+ * @return     the error reply or NULL if out of memory
+ */
+static DBusMessage *
+set_property_method(DBusMessage *msg)
+{
+  const char      *ifname;
+  const char      *name;
+  DBusMessage     *reply;
+
+  dbus_message_get_args(msg, NULL,
+                        DBUS_TYPE_STRING, &ifname,
+                        DBUS_TYPE_STRING, &name,
+                        DBUS_TYPE_INVALID);
+
+  if (!property_find(msg, ifname, name, &reply))
+    return reply;
+
+  return dbus_message_new_error_printf(msg, DBUS_ERROR_PROPERTY_READ_ONLY,
+                                       "Property '%s' is read-only", name);
+}
+
+/**
+ * Find property of com.nokia.policy.alsa interface
+ *
+ * @param msg     method call message
+ * @param ifname  interface of the property, empty for any
+ * @param name    name of the property
+ * @param reply   pointer to return the error reply if not found
+ *
+ * @return  the property or NULL if not found
+ */
+static struct propdsc *
+property_find(DBusMessage *msg, const char *ifname, const char *name,
+              DBusMessage **reply)
+{
+  struct propdsc *prop;
+
+  if (*ifname && strcmp(ifname, POLICY_ALSA_INTERFACE))
+  {
+    *reply = dbus_message_new_error_printf(msg, DBUS_ERROR_UNKNOWN_INTERFACE,
+                                           "Unknown interface '%s'", ifname);
+    return NULL;
+  }
+
+  for (prop = properties;  prop->name != NULL;  prop++)
+  {
+    if (!strcmp(name, prop->name))
+      return prop;
+  }
+
+  *reply = dbus_message_new_error_printf(msg, DBUS_ERROR_UNKNOWN_PROPERTY,
+                                         "Unknown property '%s'", name);
+  return NULL;
+}
+
+/**
+ * Append the current entries of route like sections as a{ss}
+ * @param it  D-Bus message iterator
+ */
+static void
+routes_append(DBusMessageIter *it)
+{
+  DBusMessageIter dictit;
+
+  dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "{ss}", &dictit);
+  control_foreach_route(state_append_cb, &dictit);
+  dbus_message_iter_close_container(it, &dictit);
+}
+
+/**
+ * Append the values of context variables as a{ss}
+ * @param it  D-Bus message iterator
+ */
+static void
+context_append(DBusMessageIter *it)
+{
+  DBusMessageIter dictit;
+
+  dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "{ss}", &dictit);
+  context_foreach(state_append_cb, &dictit);
+  dbus_message_iter_close_container(it, &dictit);
+}
+
+/**
+ * Append the pending outband execution as a(uu): line of the rules and
+ * milliseconds left. The array is empty if none is pending.
+ *
+ * @param it  D-Bus message iterator
+ */
+static void
+outband_append(DBusMessageIter *it)
+{
+  DBusMessageIter arrit;
+  DBusMessageIter strit;
+  dbus_uint32_t   line;
+  dbus_uint32_t   msec;
+  int             lineno;
+  int             left;
+
+  dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "(uu)", &arrit);
+
+  if (control_get_outband(&lineno, &left))
+  {
+    line = lineno;
+    msec = left;
+
+    dbus_message_iter_open_container(&arrit, DBUS_TYPE_STRUCT, NULL, &strit);
+    dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT32, &line);
+    dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT32, &msec);
+    dbus_message_iter_close_container(&arrit, &strit);
+  }
+
+  dbus_message_iter_close_container(it, &arrit);
+}
+
+/**
+ * Append the control elements present as a(ssuxxb): card, control, line
+ * of the rule which set the desired value (0 if none), desired value,
+ * last known value and whether it's known to be set
+ *
+ * @param it  D-Bus message iterator
+ */
+static void
+controls_append(DBusMessageIter *it)
+{
+  DBusMessageIter arrit;
+
+  dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "(ssuxxb)", &arrit);
+  control_foreach_elem(control_append_cb, &arrit);
+  dbus_message_iter_close_container(it, &arrit);
+}
+
+/**
+ * Append control element to a(ssuxxb) array, from the values kept by
+ * alsaped, without reading the element
+ *
+ * @param card  card definition
+ * @param elem  element definition
+ * @param data  D-Bus message iterator of the array
+ */
+static void
+control_append_cb(struct card_def *card, struct elem_def *elem, void *data)
+{
+  DBusMessageIter *arrit = data;
+  DBusMessageIter  strit;
+  dbus_uint32_t    line = elem->target ? elem->target->lineno : 0;
+  dbus_int64_t     desired = elem->target ? elem->target->value : elem->value;
+  dbus_int64_t     value = elem->value;
+  dbus_bool_t      valid = elem->value_valid ? TRUE : FALSE;
+
+  if (card->num < 0 || elem->numid < 0)
+    return;
+
+  dbus_message_iter_open_container(arrit, DBUS_TYPE_STRUCT, NULL, &strit);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_STRING, &card->name);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_STRING, &elem->name);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_UINT32, &line);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_INT64, &desired);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_INT64, &value);
+  dbus_message_iter_append_basic(&strit, DBUS_TYPE_BOOLEAN, &valid);
+  dbus_message_iter_close_container(arrit, &strit);
+}
+
+/**
+ * Append the summaries of the statistics histograms as a(stttttt)
+ * @param it  D-Bus message iterator
+ */
+static void
+stats_append(DBusMessageIter *it)
+{
+  DBusMessageIter arrit;
+
+  dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "(stttttt)", &arrit);
+  stats_foreach(stats_append_cb, &arrit);
+  dbus_message_iter_close_container(it, &arrit);
+}
+
+/**
+ * Append the counters of the alsa setting rules as a(usssuuuut)
+ * @param it  D-Bus message iterator
+ */
+static void
+rule_stats_append(DBusMessageIter *it)
+{
+  DBusMessageIter arrit;
+
+  dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY, "(usssuuuut)",
+                                   &arrit);
+  control_foreach_rule(rule_stats_append_cb, &arrit);
+  dbus_message_iter_close_container(it, &arrit);
+}
+
+/**
+ * Append name/value pair to a{ss} dictionary
+ *
+ * @param name   the key
+ * @param value  the value
+ * @param data   D-Bus message iterator of the dictionary
+ */
+static void
+state_append_cb(const char *name, const char *value, void *data)
+{
+  DBusMessageIter *dictit = data;
+  DBusMessageIter  entit;
+
+  dbus_message_iter_open_container(dictit, DBUS_TYPE_DICT_ENTRY, NULL, &entit);
+  dbus_message_iter_append_basic(&entit, DBUS_TYPE_STRING, &name);
+  dbus_message_iter_append_basic(&entit, DBUS_TYPE_STRING, &value);
+  dbus_message_iter_close_container(dictit, &entit);
+}
+
+/**
+ * Queue actions of method call. The method is replied when the actions
+ * are applied.
+ *
+ * @param msg    method call message
+ * @param data   the actions
+ * @param len    number of actions
+ * @param start  when the method call was received
+ *
+ * @return  always NULL, the reply is sent later
+ */
+static DBusMessage *
+method_queue(DBusMessage *msg, struct action_data *data, int len,
+             gint64 start)
+{
+  int success = TRUE;
+  int i;
+
+  for (i = 0;  i < len;  i++)
+  {
+    if (queue_push(&data[i]) < 0)
+      success = FALSE;
+  }
+
+  queue_ack(method_reply_cb, dbus_message_ref(msg), success, start);
+
+  return NULL;
+}
+
+/**
+ * Queue acknowledgement callback: reply to method call
+ * @param data     method call message
+ * @param success  whether the actions were applied
+ */
+static void
+method_reply_cb(void *data, int success)
+{
+  DBusMessage *msg = data;
+  DBusMessage *reply;
+
+  if (dbus_message_get_no_reply(msg))
+  {
+    dbus_message_unref(msg);
+    return;
+  }
+
+  if (success)
+    reply = dbus_message_new_method_return(msg);
+  else
+    reply = dbus_message_new_error(msg, POLICY_ALSA_ERROR_FAILED,
+                                   "Some of the actions failed");
+
+  if (!reply || !dbus_connection_send(priv.conn, reply, NULL))
+    log_error("Can't send method reply: out of memory");
+
+  if (reply)
+    dbus_message_unref(reply);
+
+  dbus_message_unref(msg);
+}
+
+/**
+ * Queue acknowledgement callback: send status of audio_actions signal
+ * @param data     transaction id
+ * @param success  whether the actions were applied
+ */
+static void
+status_cb(void *data, int success)
+{
+  signal_status(GPOINTER_TO_UINT(data), success);
+}
+
 /**
  * Respond to audio_actions signal
  *
@@ -719,6 +1602,8 @@ signal_status(uint32_t txid, uint32_t status)
   char         path[256];
   int          ret;
 
+  trace(status, txid, status);
+
   if (txid == 0)
   {
     /* When transaction ID is 0, the policy manager does not expect
@@ -7,10 +7,11 @@
 struct action_data {
   enum rule_type rule_type;
   union {
-    char *route_dev;
+    /* route device or entry of a user defined section */
+    const char *route_dev;
     struct {
-      char *variable;
-      char *value;
+      const char *variable;
+      const char *value;
     };
   };
 };
@@ -18,9 +19,11 @@ struct action_data {
 /** Audio actions handler */
 typedef int (*action_handler) (struct action_data *data);
 
+/** Called when all actions of a policy decision have been handled */
+typedef int (*decision_handler) (void);
+
 int  dbusif_init   (struct options *options);
 int  dbusif_create (void);
-void dbusif_set_cb (action_handler cb);
 
 
 #endif  /* DBUSIF_H */
@@ -0,0 +1,1078 @@
+/**
+ * @file gdbusif.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement D-Bus interface functions, GDBus backend.
+ * Same interface as dbusif.c, selected with --with-gdbus at build time.
+ * The audio_actions payload is type checked once as a whole and then
+ * read as GVariant without copying the strings; action and argument
+ * names are matched by quarks, which are resolved at init.
+ *
+ * @{ */
+
+#include <gio/gio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "action.h"
+#include "context.h"
+#include "control.h"
+#include "options.h"
+#include "logging.h"
+#include "queue.h"
+#include "record.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
+
+#include "dbusif.h"
+
+#define ADMIN_DBUS_MANAGER          "org.freedesktop.DBus"
+#define ADMIN_DBUS_PATH             "/org/freedesktop/DBus"
+#define ADMIN_DBUS_INTERFACE        "org.freedesktop.DBus"
+
+#define ADMIN_NAME_OWNER_CHANGED    "NameOwnerChanged"
+
+#define POLICY_DBUS_INTERFACE       "com.nokia.policy"
+#define POLICY_DBUS_MYPATH          "/com/nokia/policy/enforce/alsa"
+#define POLICY_DBUS_MYNAME          "com.nokia.policy.alsa"
+#define POLICY_DBUS_PDPATH          "/com/nokia/policy"
+#define POLICY_DBUS_PDNAME          "org.freedesktop.ohm"
+
+#define POLICY_ALSA_INTERFACE       "com.nokia.policy.alsa"
+#define POLICY_ALSA_ERROR_FAILED    "com.nokia.policy.alsa.Error.Failed"
+
+#define POLICY_DECISION             "decision"
+#define POLICY_ACTIONS              "audio_actions"
+#define POLICY_STATUS               "status"
+
+/* Signature of audio_actions signal */
+#define POLICY_ACTIONS_TYPE         "(ua{saa(sv)})"
+
+
+/* Action descriptor */
+struct actdsc {
+  const char *name;
+  /* kind passed to action_build() */
+  const char *kind;
+  /* names of the two arguments of the action */
+  const char *args[2];
+  GQuark      quark;
+  GQuark      arg_quarks[2];
+};
+
+/* Property descriptor */
+struct propdsc {
+  const char *name;
+  GVariant *(*value)(void);
+};
+
+static const char introspection_xml[] =
+  "<node>"
+  "  <interface name='" POLICY_ALSA_INTERFACE "'>"
+  "    <method name='SetRoute'>"
+  "      <arg name='type' type='s' direction='in'/>"
+  "      <arg name='device' type='s' direction='in'/>"
+  "    </method>"
+  "    <method name='SetContext'>"
+  "      <arg name='variable' type='s' direction='in'/>"
+  "      <arg name='value' type='s' direction='in'/>"
+  "    </method>"
+  "    <method name='ApplyBatch'>"
+  "      <arg name='actions' type='a(sss)' direction='in'/>"
+  "    </method>"
+  "    <method name='GetState'>"
+  "      <arg name='routes' type='a{ss}' direction='out'/>"
+  "      <arg name='context' type='a{ss}' direction='out'/>"
+  "    </method>"
+  "    <method name='GetStats'>"
+  "      <arg name='stats' type='a(stttttt)' direction='out'/>"
+  "    </method>"
+  "    <method name='GetRuleStats'>"
+  "      <arg name='rules' type='a(usssuuuut)' direction='out'/>"
+  "    </method>"
+  "    <property name='Routes' type='a{ss}' access='read'/>"
+  "    <property name='Context' type='a{ss}' access='read'/>"
+  "    <property name='Outband' type='a(uu)' access='read'/>"
+  "    <property name='Controls' type='a(ssuxxb)' access='read'/>"
+  "    <property name='Stats' type='a(stttttt)' access='read'/>"
+  "    <property name='RuleStats' type='a(usssuuuut)' access='read'/>"
+  "    <annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal'"
+  "                value='false'/>"
+  "  </interface>"
+  "</node>";
+
+static struct actdsc actions[] = {
+  { "com.nokia.policy.audio_route", "route"  , { "type"    , "device" } },
+  { "com.nokia.policy.context"    , "context", { "variable", "value"  } },
+  { "com.nokia.policy.section"    , "section", { "section" , "entry"  } },
+  { NULL                          , NULL     , { NULL      , NULL     } }
+};
+
+
+/** D-Bus interface data */
+static struct {
+  /** D-Bus connection */
+  GDBusConnection *conn;
+  /* Signal interface */
+  char *ifname;
+  /* My object path */
+  char *mypath;
+  /* Policy daemon's signal path */
+  char *pdpath;
+  /* Policy daemon's D-Bus name */
+  char *pdname;
+  /* Signal subscriptions and registrations */
+  guint admin_sub;
+  guint action_sub;
+  guint object_id;
+  guint owner_id;
+  /** Whether or not registered to policy daemon */
+  int   regist;
+  /** Log D-Bus message related information */
+  int   log;
+  /** Connect to the session bus */
+  int   session;
+} priv;
+
+
+static int register_to_pdp(int name_owner_changed);
+static void registration_cb(GObject *, GAsyncResult *, gpointer);
+static void admin_signal_cb(GDBusConnection *, const gchar *, const gchar *,
+                            const gchar *, const gchar *, GVariant *,
+                            gpointer);
+static void action_signal_cb(GDBusConnection *, const gchar *, const gchar *,
+                             const gchar *, const gchar *, GVariant *,
+                             gpointer);
+static void handle_action_message(GVariant *params);
+static int action_parser(struct actdsc *act, GVariant *args);
+static void method_call_cb(GDBusConnection *, const gchar *, const gchar *,
+                           const gchar *, const gchar *, GVariant *,
+                           GDBusMethodInvocation *, gpointer);
+static int apply_batch_method(GVariant *params, GDBusMethodInvocation *,
+                              gint64);
+static GVariant *get_state_method(void);
+static GVariant *get_stats_method(void);
+static GVariant *get_rule_stats_method(void);
+static GVariant *get_property_cb(GDBusConnection *, const gchar *,
+                                 const gchar *, const gchar *, const gchar *,
+                                 GError **, gpointer);
+static GVariant *routes_value(void);
+static GVariant *context_value(void);
+static GVariant *outband_value(void);
+static GVariant *controls_value(void);
+static GVariant *stats_value(void);
+static GVariant *rule_stats_value(void);
+static void control_append_cb(struct card_def *, struct elem_def *, void *);
+
+/* Read-only properties of com.nokia.policy.alsa interface */
+static const struct propdsc properties[] = {
+  { "Routes"   , routes_value     },
+  { "Context"  , context_value    },
+  { "Outband"  , outband_value    },
+  { "Controls" , controls_value   },
+  { "Stats"    , stats_value      },
+  { "RuleStats", rule_stats_value },
+  { NULL       , NULL             }
+};
+static void state_append_cb(const char *, const char *, void *);
+static void stats_append_cb(const char *, const struct stats_summary *,
+                            void *);
+static void rule_stats_append_cb(struct rule_def *, void *);
+static void method_queue(GDBusMethodInvocation *, struct action_data *, int,
+                         gint64);
+static void method_reply_cb(void *data, int success);
+static void name_lost_cb(GDBusConnection *, const gchar *, gpointer);
+static void status_cb(void *data, int success);
+static int signal_status(uint32_t txid, uint32_t status);
+void dbusif_free();
+
+
+/**
+ * Initialize D-Bus interface options
+ * @param options  options parsed from command line
+ * @return  -1 if error, 0 if success
+ */
+int
+dbusif_init(struct options *options)
+{
+  struct dbusif_options *opts;
+  struct actdsc *act;
+  char *ifname;
+  char *mypath;
+  char *pdpath;
+  char *pdname;
+
+  opts = &options->dbusif;
+
+  ifname = opts->ifname ? opts->ifname : POLICY_DBUS_INTERFACE;
+  mypath = opts->mypath ? opts->mypath : POLICY_DBUS_MYPATH;
+  pdpath = opts->pdpath ? opts->pdpath : POLICY_DBUS_PDPATH;
+  pdname = opts->pdname ? opts->pdname : POLICY_DBUS_PDNAME;
+
+  if (!(priv.ifname = strdup(ifname)) ||
+      !(priv.mypath = strdup(mypath)) ||
+      !(priv.pdpath = strdup(pdpath)) ||
+      !(priv.pdname = strdup(pdname)))
+  {
+    return -1;
+  }
+
+  /* Names are matched by quarks while parsing */
+  for (act = actions;  act->name != NULL;  act++)
+  {
+    act->quark = g_quark_from_static_string(act->name);
+    act->arg_quarks[0] = g_quark_from_static_string(act->args[0]);
+    act->arg_quarks[1] = g_quark_from_static_string(act->args[1]);
+  }
+
+  if (record_open(opts->record) < 0)
+    return -1;
+
+  priv.log = opts->log;
+  priv.session = opts->session;
+
+  return 0;
+}
+
+/**
+ * Subscribe NameOwnerChanged and audio_actions/decision signals, serve
+ * the method interface. Register to Policy Decision Point over D-Bus.
+ *
+ * @return  0 if success, -1 if error
+ */
+int dbusif_create()
+{
+  static const GDBusInterfaceVTable vtable = {
+    .method_call  = method_call_cb,
+    .get_property = get_property_cb
+  };
+
+  GDBusNodeInfo *node;
+  GError *error = NULL;
+  char path[256];
+
+  priv.conn = g_bus_get_sync(priv.session ? G_BUS_TYPE_SESSION
+                                           : G_BUS_TYPE_SYSTEM,
+                             NULL, &error);
+
+  if (!priv.conn)
+  {
+    log_error("Can't get D-Bus connection: %s", error->message);
+    goto fail;
+  }
+
+  priv.admin_sub = g_dbus_connection_signal_subscribe(priv.conn,
+                                    ADMIN_DBUS_MANAGER, ADMIN_DBUS_INTERFACE,
+                                    ADMIN_NAME_OWNER_CHANGED, ADMIN_DBUS_PATH,
+                                    priv.pdname, G_DBUS_SIGNAL_FLAGS_NONE,
+                                    admin_signal_cb, NULL, NULL);
+
+  snprintf(path, sizeof(path), "%s/%s", priv.pdpath, POLICY_DECISION);
+
+  priv.action_sub = g_dbus_connection_signal_subscribe(priv.conn,
+                                    NULL, priv.ifname, POLICY_ACTIONS, path,
+                                    NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                    action_signal_cb, NULL, NULL);
+
+  if (!(node = g_dbus_node_info_new_for_xml(introspection_xml, &error)))
+  {
+    log_error("Can't parse D-Bus introspection data: %s", error->message);
+    goto fail;
+  }
+
+  priv.object_id = g_dbus_connection_register_object(priv.conn, priv.mypath,
+                                                     node->interfaces[0],
+                                                     &vtable, NULL, NULL,
+                                                     &error);
+  g_dbus_node_info_unref(node);
+
+  if (!priv.object_id)
+  {
+    log_error("Can't register D-Bus object path '%s': %s",
+              priv.mypath, error->message);
+    goto fail;
+  }
+
+  /* Without the well-known name the methods are still available
+   * through the unique name of the connection */
+  priv.owner_id = g_bus_own_name_on_connection(priv.conn, POLICY_DBUS_MYNAME,
+                                               G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
+                                               NULL, name_lost_cb, NULL, NULL);
+
+  register_to_pdp(FALSE);
+
+  return 0;
+
+fail:
+    dbusif_free();
+    g_clear_error(&error);
+    errno = EIO;  /* I/O error */
+
+    return -1;
+}
+
+/**
+ * Free D-Bus interface allocated memory
+ */
+void dbusif_free()
+{
+  if (priv.conn)
+  {
+    if (priv.owner_id)
+      g_bus_unown_name(priv.owner_id);
+    if (priv.object_id)
+      g_dbus_connection_unregister_object(priv.conn, priv.object_id);
+    if (priv.action_sub)
+      g_dbus_connection_signal_unsubscribe(priv.conn, priv.action_sub);
+    if (priv.admin_sub)
+      g_dbus_connection_signal_unsubscribe(priv.conn, priv.admin_sub);
+    g_object_unref(priv.conn);
+  }
+  free(priv.ifname);
+  free(priv.mypath);
+  free(priv.pdpath);
+  free(priv.pdname);
+  memset(&priv, 0, sizeof(priv));
+}
+
+/**
+ * Register to policy decision point
+ * @param name_owner_changed  TRUE if registering after the policy
+ *                            daemon appeared on the bus
+ * @return  always zero, the result is reported by the callback
+ */
+static int
+register_to_pdp(int name_owner_changed)
+{
+  static const char *signals[] = { POLICY_ACTIONS, NULL };
+
+  if (priv.log)
+  {
+    log_info("registering to policy daemon: name='%s' path='%s' if='%s'",
+              priv.pdname, priv.pdpath, priv.ifname);
+  }
+
+  g_dbus_connection_call(priv.conn, priv.pdname, priv.pdpath, priv.ifname,
+                         "register",
+                         g_variant_new("(s^as)", "alsaped", signals),
+                         NULL, G_DBUS_CALL_FLAGS_NONE, 1000, NULL,
+                         registration_cb, GINT_TO_POINTER(name_owner_changed));
+
+  return 0;
+}
+
+/**
+ * D-Bus interface registration callback
+ */
+static void
+registration_cb(GObject *source, GAsyncResult *res, gpointer data)
+{
+  int name_owner_changed = GPOINTER_TO_INT(data);
+  GError *error = NULL;
+  GVariant *reply;
+
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+
+  if (!reply)
+  {
+    if (name_owner_changed)
+      log_error("registration to policy daemon failed: %s", error->message);
+
+    g_error_free(error);
+    return;
+  }
+
+  log_notice("registration to policy daemon succeeded");
+  priv.regist = 1;
+
+  g_variant_unref(reply);
+}
+
+/**
+ * Handle NameOwnerChanged D-Bus signal
+ */
+static void
+admin_signal_cb(GDBusConnection *conn, const gchar *sender,
+                const gchar *path, const gchar *ifname, const gchar *signal,
+                GVariant *params, gpointer data)
+{
+  const char *name;
+  const char *before;
+  const char *after;
+
+  if (!g_variant_is_of_type(params, G_VARIANT_TYPE("(sss)")))
+  {
+    log_error("Received malformed '%s' message", ADMIN_NAME_OWNER_CHANGED);
+    return;
+  }
+
+  g_variant_get(params, "(&s&s&s)", &name, &before, &after);
+
+  if (strcmp(name, priv.pdname))
+    return;
+
+  if (*after)
+  {
+    log_info("policy decision point is up");
+
+    if (!priv.regist)
+      register_to_pdp(TRUE);
+
+    return;
+  }
+
+  log_info("policy decision point is gone");
+  priv.regist = 0;
+}
+
+/**
+ * Handle D-Bus audio_actions signal
+ */
+static void
+action_signal_cb(GDBusConnection *conn, const gchar *sender,
+                 const gchar *path, const gchar *ifname, const gchar *signal,
+                 GVariant *params, gpointer data)
+{
+  handle_action_message(params);
+}
+
+/**
+ * Parse audio_actions signal payload and queue the actions
+ * @param params  signal parameters
+ */
+static void
+handle_action_message(GVariant *params)
+{
+  struct actdsc *act;
+  GVariantIter   arrit;
+  GVariantIter   actit;
+  GVariant      *arr;
+  GVariant      *ent;
+  GVariant      *key;
+  GVariant      *acts;
+  GVariant      *args;
+  guint32        txid;
+  GQuark         quark;
+  int            success = TRUE;
+  /* the latency of the decision is measured from here */
+  gint64         start = g_get_monotonic_time();
+
+  if (!g_variant_is_of_type(params, G_VARIANT_TYPE(POLICY_ACTIONS_TYPE)))
+  {
+    /* Status of a malformed message is sent if it has transaction id */
+    if (!g_variant_n_children(params))
+      return;
+
+    arr = g_variant_get_child_value(params, 0);
+    txid = g_variant_is_of_type(arr, G_VARIANT_TYPE_UINT32) ?
+           g_variant_get_uint32(arr) : 0;
+    g_variant_unref(arr);
+
+    if (!txid)
+      return;
+
+    record_begin();
+    success = FALSE;
+    goto send_signal;
+  }
+
+  /* The type is checked, so the children are read without format
+   * strings. The strings point to the message data. GDBus converts the
+   * message to GVariant tree, so reading a child only takes a reference
+   * and doesn't allocate memory, see tests/alloc-count.c. */
+  arr = g_variant_get_child_value(params, 0);
+  txid = g_variant_get_uint32(arr);
+  g_variant_unref(arr);
+
+  if (priv.log)
+    log_info("got actions (txid:%d)", txid);
+
+  trace(actions, txid);
+  log_set_txid(txid);
+  timeline_instant("audio_actions", NULL);
+  record_begin();
+
+  arr = g_variant_get_child_value(params, 1);
+  g_variant_iter_init(&arrit, arr);
+
+  while ((ent = g_variant_iter_next_value(&arrit)))
+  {
+    key = g_variant_get_child_value(ent, 0);
+
+    /* Names never interned can't match any of the actions */
+    quark = g_quark_try_string(g_variant_get_string(key, NULL));
+    g_variant_unref(key);
+
+    for (act = actions;  quark && act->name != NULL;  act++)
+    {
+      if (act->quark == quark)
+        break;
+    }
+
+    if (quark && act->name)
+    {
+      acts = g_variant_get_child_value(ent, 1);
+      g_variant_iter_init(&actit, acts);
+
+      while ((args = g_variant_iter_next_value(&actit)))
+      {
+        if (!action_parser(act, args))
+          success = FALSE;
+
+        g_variant_unref(args);
+      }
+
+      g_variant_unref(acts);
+    }
+
+    g_variant_unref(ent);
+  }
+
+  g_variant_unref(arr);
+
+send_signal:
+  /* Rejected and malformed decisions are recorded with their status */
+  record_end(txid, success);
+
+  if (priv.log)
+  {
+    if (success)
+      log_info("actions %s", "queued");
+    else
+      log_info("actions %s", "failed");
+  }
+
+  /* Status is sent when the queued actions are applied */
+  queue_ack(status_cb, GUINT_TO_POINTER(txid), success, start);
+  log_set_txid(0);
+}
+
+/**
+ * Parse arguments of an action and queue it
+ *
+ * @param act   action descriptor
+ * @param args  the arguments, a(sv)
+ *
+ * @return  TRUE if success, FALSE otherwise
+ */
+static int
+action_parser(struct actdsc *act, GVariant *args)
+{
+  struct action_data data;
+  const char *vals[2] = { NULL, NULL };
+  GVariantIter argit;
+  GVariant *arg;
+  GVariant *name;
+  GVariant *box;
+  GVariant *val;
+  GQuark quark;
+  int success = TRUE;
+  int i;
+
+  g_variant_iter_init(&argit, args);
+
+  while ((arg = g_variant_iter_next_value(&argit)))
+  {
+    name = g_variant_get_child_value(arg, 0);
+    quark = g_quark_try_string(g_variant_get_string(name, NULL));
+    g_variant_unref(name);
+
+    for (i = 0;  quark && i < 2;  i++)
+    {
+      if (quark != act->arg_quarks[i])
+        continue;
+
+      box = g_variant_get_child_value(arg, 1);
+      val = g_variant_get_variant(box);
+
+      if (g_variant_is_of_type(val, G_VARIANT_TYPE_STRING))
+        vals[i] = g_variant_get_string(val, NULL);
+      else
+        success = FALSE;
+
+      g_variant_unref(val);
+      g_variant_unref(box);
+    }
+
+    g_variant_unref(arg);
+  }
+
+  if (!success)
+  {
+    log_error("Action parsing failed");
+    return FALSE;
+  }
+
+  if (!vals[0] || !vals[1])
+  {
+    log_error("Some of the required action arguments are missing");
+    return FALSE;
+  }
+
+  if (priv.log)
+    log_info("Got %s request: '%s' -> '%s'", act->kind, vals[0], vals[1]);
+
+  if (action_build(act->kind, vals[0], vals[1], &data) < 0)
+    return FALSE;
+
+  record_action(act->kind, vals[0], vals[1]);
+
+  return queue_push(&data) < 0 ? FALSE : TRUE;
+}
+
+/**
+ * Handle method calls of com.nokia.policy.alsa interface. Methods which
+ * change the state are replied when their actions are applied.
+ */
+static void
+method_call_cb(GDBusConnection *conn, const gchar *sender,
+               const gchar *path, const gchar *ifname, const gchar *method,
+               GVariant *params, GDBusMethodInvocation *invocation,
+               gpointer data)
+{
+  struct action_data action;
+  gint64 start = g_get_monotonic_time();
+  const char *name;
+  const char *value;
+  int route;
+
+  if (priv.log)
+    log_info("got method call '%s'", method);
+
+  /* The arguments are checked against introspection data by GDBus */
+  if (!strcmp(method, "GetState"))
+  {
+    g_dbus_method_invocation_return_value(invocation, get_state_method());
+    return;
+  }
+
+  if (!strcmp(method, "GetStats"))
+  {
+    g_dbus_method_invocation_return_value(invocation, get_stats_method());
+    return;
+  }
+
+  if (!strcmp(method, "GetRuleStats"))
+  {
+    g_dbus_method_invocation_return_value(invocation,
+                                          get_rule_stats_method());
+    return;
+  }
+
+  if (!strcmp(method, "ApplyBatch"))
+  {
+    apply_batch_method(params, invocation, start);
+    return;
+  }
+
+  g_variant_get(params, "(&s&s)", &name, &value);
+  route = !strcmp(method, "SetRoute");
+
+  if (action_build(route ? "route" : "context", name, value, &action) < 0)
+  {
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+                                          G_DBUS_ERROR_INVALID_ARGS,
+                                          "Invalid %s '%s'",
+                                          route ? "route type"
+                                                : "context variable",
+                                          name);
+    return;
+  }
+
+  method_queue(invocation, &action, 1, start);
+}
+
+/**
+ * Handle ApplyBatch(a(sss) actions) method call. Nothing is queued if
+ * some of the actions are invalid.
+ *
+ * @param params      method call parameters
+ * @param invocation  the method invocation
+ * @param start       when the method call was received
+ *
+ * @return  0 if the actions were queued, -1 otherwise
+ */
+static int
+apply_batch_method(GVariant *params, GDBusMethodInvocation *invocation,
+                   gint64 start)
+{
+  struct action_data *data;
+  const char *args[3];
+  GVariant *arr;
+  GVariantIter arrit;
+  int len;
+  int i;
+
+  arr = g_variant_get_child_value(params, 0);
+  len = g_variant_n_children(arr);
+  data = g_new(struct action_data, len);
+
+  g_variant_iter_init(&arrit, arr);
+
+  for (i = 0;  g_variant_iter_next(&arrit, "(&s&s&s)",
+                                   &args[0], &args[1], &args[2]);  i++)
+  {
+    if (action_build(args[0], args[1], args[2], &data[i]) < 0)
+    {
+      g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR,
+                                            G_DBUS_ERROR_INVALID_ARGS,
+                                            "Invalid action %d ('%s' '%s')",
+                                            i, args[0], args[1]);
+      g_free(data);
+      g_variant_unref(arr);
+      return -1;
+    }
+  }
+
+  method_queue(invocation, data, len, start);
+
+  g_free(data);
+  g_variant_unref(arr);
+
+  return 0;
+}
+
+/**
+ * Build reply of GetState() method call: the current entries of route
+ * like sections and the values of context variables.
+ *
+ * @return  floating (a{ss}a{ss}) value
+ */
+static GVariant *
+get_state_method()
+{
+  return g_variant_new("(@a{ss}@a{ss})", routes_value(), context_value());
+}
+
+/**
+ * Build reply of GetStats() method call: the summaries of the statistics
+ * histograms, name, count, min, p50, p90, p99 and max.
+ *
+ * @return  floating (a(stttttt)) value
+ */
+static GVariant *
+get_stats_method()
+{
+  return g_variant_new("(@a(stttttt))", stats_value());
+}
+
+/**
+ * Add histogram summary to a(stttttt) array
+ *
+ * @param name     name of the histogram
+ * @param summary  the summary
+ * @param data     GVariantBuilder of the array
+ */
+static void
+stats_append_cb(const char *name, const struct stats_summary *summary,
+                void *data)
+{
+  g_variant_builder_add(data, "(stttttt)", name, summary->count,
+                        summary->min, summary->p50, summary->p90,
+                        summary->p99, summary->max);
+}
+
+/**
+ * Build reply of GetRuleStats() method call: the counters of the alsa
+ * setting rules,
+ * line, card, control, entry (empty for defaults), executions, writes,
+ * skipped writes, failures and write time in microseconds.
+ *
+ * @return  floating (a(usssuuuut)) value
+ */
+static GVariant *
+get_rule_stats_method()
+{
+  return g_variant_new("(@a(usssuuuut))", rule_stats_value());
+}
+
+/**
+ * Add rule counters to a(usssuuuut) array
+ *
+ * @param rule  alsa setting rule
+ * @param data  GVariantBuilder of the array
+ */
+static void
+rule_stats_append_cb(struct rule_def *rule, void *data)
+{
+  g_variant_builder_add(data, "(usssuuuut)", rule->lineno,
+                        rule->card_def->name, rule->elem_def->name,
+                        rule->entry_def ? rule->entry_def->name : "",
+                        rule->stats.executions, rule->stats.writes,
+                        rule->stats.skipped, rule->stats.failures,
+                        (guint64)atomic_load_explicit(&rule->stats.write_usec,
+                                                      memory_order_relaxed));
+}
+
+/**
+ * Get property of com.nokia.policy.alsa interface. GDBus serves the
+ * properties interface and checks the names against introspection data.
+ *
+ * @return  floating value of the property, NULL if not found
+ */
+static GVariant *
+get_property_cb(GDBusConnection *conn, const gchar *sender,
+                const gchar *path, const gchar *ifname, const gchar *name,
+                GError **error, gpointer data)
+{
+  const struct propdsc *prop;
+
+  for (prop = properties;  prop->name != NULL;  prop++)
+  {
+    if (!strcmp(name, prop->name))
+      return prop->value();
+  }
+
+  g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+              "Unknown property '%s'", name);
+
+  return NULL;
+}
+
+/**
+ * Get the current entries of route like sections
+ * @return  floating a{ss} value
+ */
+static GVariant *
+routes_value()
+{
+  GVariantBuilder routes;
+
+  g_variant_builder_init(&routes, G_VARIANT_TYPE("a{ss}"));
+  control_foreach_route(state_append_cb, &routes);
+
+  return g_variant_builder_end(&routes);
+}
+
+/**
+ * Get the values of context variables
+ * @return  floating a{ss} value
+ */
+static GVariant *
+context_value()
+{
+  GVariantBuilder context;
+
+  g_variant_builder_init(&context, G_VARIANT_TYPE("a{ss}"));
+  context_foreach(state_append_cb, &context);
+
+  return g_variant_builder_end(&context);
+}
+
+/**
+ * Get the pending outband execution: line of the rules and milliseconds
+ * left. The array is empty if none is pending.
+ *
+ * @return  floating a(uu) value
+ */
+static GVariant *
+outband_value()
+{
+  GVariantBuilder outband;
+  int lineno;
+  int msec;
+
+  g_variant_builder_init(&outband, G_VARIANT_TYPE("a(uu)"));
+
+  if (control_get_outband(&lineno, &msec))
+    g_variant_builder_add(&outband, "(uu)", lineno, msec);
+
+  return g_variant_builder_end(&outband);
+}
+
+/**
+ * Get the control elements present: card, control, line of the rule
+ * which set the desired value (0 if none), desired value, last known
+ * value and whether it's known to be set
+ *
+ * @return  floating a(ssuxxb) value
+ */
+static GVariant *
+controls_value()
+{
+  GVariantBuilder controls;
+
+  g_variant_builder_init(&controls, G_VARIANT_TYPE("a(ssuxxb)"));
+  control_foreach_elem(control_append_cb, &controls);
+
+  return g_variant_builder_end(&controls);
+}
+
+/**
+ * Add control element to a(ssuxxb) array, from the values kept by
+ * alsaped, without reading the element
+ *
+ * @param card  card definition
+ * @param elem  element definition
+ * @param data  GVariantBuilder of the array
+ */
+static void
+control_append_cb(struct card_def *card, struct elem_def *elem, void *data)
+{
+  if (card->num < 0 || elem->numid < 0)
+    return;
+
+  g_variant_builder_add(data, "(ssuxxb)", card->name, elem->name,
+                        elem->target ? elem->target->lineno : 0,
+                        (gint64)(elem->target ? elem->target->value
+                                              : elem->value),
+                        (gint64)elem->value, elem->value_valid ? TRUE : FALSE);
+}
+
+/**
+ * Get the summaries of the statistics histograms
+ * @return  floating a(stttttt) value
+ */
+static GVariant *
+stats_value()
+{
+  GVariantBuilder stats;
+
+  g_variant_builder_init(&stats, G_VARIANT_TYPE("a(stttttt)"));
+  stats_foreach(stats_append_cb, &stats);
+
+  return g_variant_builder_end(&stats);
+}
+
+/**
+ * Get the counters of the alsa setting rules
+ * @return  floating a(usssuuuut) value
+ */
+static GVariant *
+rule_stats_value()
+{
+  GVariantBuilder rules;
+
+  g_variant_builder_init(&rules, G_VARIANT_TYPE("a(usssuuuut)"));
+  control_foreach_rule(rule_stats_append_cb, &rules);
+
+  return g_variant_builder_end(&rules);
+}
+
+/**
+ * Add name/value pair to a{ss} dictionary
+ *
+ * @param name   the key
+ * @param value  the value
+ * @param data   GVariantBuilder of the dictionary
+ */
+static void
+state_append_cb(const char *name, const char *value, void *data)
+{
+  g_variant_builder_add(data, "{ss}", name, value);
+}
+
+/**
+ * Queue actions of method call. The method is replied when the actions
+ * are applied.
+ *
+ * @param invocation  the method invocation
+ * @param data        the actions
+ * @param len         number of actions
+ * @param start       when the method call was received
+ */
+static void
+method_queue(GDBusMethodInvocation *invocation,
+             struct action_data *data, int len, gint64 start)
+{
+  int success = TRUE;
+  int i;
+
+  for (i = 0;  i < len;  i++)
+  {
+    if (queue_push(&data[i]) < 0)
+      success = FALSE;
+  }
+
+  queue_ack(method_reply_cb, invocation, success, start);
+}
+
+/**
+ * Queue acknowledgement callback: reply to method call
+ * @param data     GDBusMethodInvocation
+ * @param success  whether the actions were applied
+ */
+static void
+method_reply_cb(void *data, int success)
+{
+  GDBusMethodInvocation *invocation = data;
+
+  if (success)
+    g_dbus_method_invocation_return_value(invocation, NULL);
+  else
+    g_dbus_method_invocation_return_dbus_error(invocation,
+                                               POLICY_ALSA_ERROR_FAILED,
+                                               "Some of the actions failed");
+}
+
+/**
+ * Well-known name is not owned
+ */
+static void
+name_lost_cb(GDBusConnection *conn, const gchar *name, gpointer data)
+{
+  log_warning("Can't own D-Bus name '%s'", name);
+}
+
+/**
+ * Queue acknowledgement callback: send status of audio_actions signal
+ * @param data     transaction id
+ * @param success  whether the actions were applied
+ */
+static void
+status_cb(void *data, int success)
+{
+  signal_status(GPOINTER_TO_UINT(data), success);
+}
+
+/**
+ * Respond to audio_actions signal
+ *
+ * @param txid    transaction id
+ * @param status  handling status
+ *
+ * @return  0 if success, -1 if error
+ */
+static int
+signal_status(uint32_t txid, uint32_t status)
+{
+  GError *error = NULL;
+  char    path[256];
+
+  trace(status, txid, status);
+
+  if (txid == 0)
+  {
+    /* When transaction ID is 0, the policy manager does not expect
+     * a response. */
+    log_info("Not sending status message since transaction ID is 0");
+    return 0;
+  }
+
+  snprintf(path, sizeof(path), "%s/%s", priv.pdpath, POLICY_DECISION);
+
+  if (priv.log)
+  {
+    log_info(
+      "sending D-Bus signal to: path='%s', if='%s' member='%s' content: txid=%d status=%d",
+      path, priv.ifname, POLICY_STATUS, txid, status);
+  }
+
+  if (!g_dbus_connection_emit_signal(priv.conn, NULL, path, priv.ifname,
+                                     POLICY_STATUS,
+                                     g_variant_new("(uu)", txid, status),
+                                     &error))
+  {
+    log_error("Can't send status message: %s", error->message);
+    g_error_free(error);
+    return -1;
+  }
+
+  return 0;
+}
+
+/** @} */
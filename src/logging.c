@@ -1,45 +1,708 @@
 /**
- * @file alsaif.c Logging functions
+ * @file logging.c Logging functions
  * @copyright GNU GPLv2 or later
  *
+ * Once the logger thread is running, the arguments of a message are
+ * packed into a ring shared by all the threads and stamped with the
+ * monotonic time. The thread formats the message, adds the prefix and
+ * writes it to stderr or syslog, so logging doesn't hold up route
+ * switches. The ring is lock-free, if it's full the message is dropped
+ * and counted, and the count is logged once the thread catches up.
+ *
  * @{ */
 
+#include <errno.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <syslog.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#ifdef HAVE_JOURNAL
+#include <sys/uio.h>
+#include <systemd/sd-journal.h>
+#endif
 
 #include "logging.h"
 
-#define MSG_SIZE 1024
+/* Size of a formatted message, and of the packed arguments of one */
+#define MSG_SIZE  1024
+#define ARGS_SIZE 1024
+
+/* Messages queued for the logger thread, a power of two */
+#define RING_SIZE 256
+#define RING_MASK (RING_SIZE - 1)
+
+/* Journal socket, journald is used if it's there */
+#define JOURNAL_SOCKET "/run/systemd/journal/socket"
+
+/* Type of printf argument */
+enum log_arg {
+  LOG_ARG_NONE,
+  LOG_ARG_INT,
+  LOG_ARG_LONG,
+  LOG_ARG_LLONG,
+  LOG_ARG_SIZE,
+  LOG_ARG_INTMAX,
+  LOG_ARG_PTRDIFF,
+  LOG_ARG_DOUBLE,
+  LOG_ARG_LDOUBLE,
+  LOG_ARG_POINTER,
+  /* copied strings, %m is strerror() of the errno of the caller */
+  LOG_ARG_STRING,
+  LOG_ARG_ERRNO
+};
+
+/* Conversion specification of printf format */
+struct log_spec {
+  const char *start;
+  const char *end;
+  /* width and precision are given as int arguments */
+  int width_arg;
+  int prec_arg;
+  enum log_arg type;
+};
+
+/* Value of printf argument */
+union log_value {
+  int i;
+  long l;
+  long long ll;
+  size_t z;
+  intmax_t j;
+  ptrdiff_t t;
+  double d;
+  long double ld;
+  void *p;
+};
+
+/* Message with its fields. The arguments are packed when the message is
+ * logged and formatted when it's written. */
+struct log_entry {
+  /* position + 1 when filled, position + RING_SIZE when free again */
+  atomic_uint seq;
+  log_level_t level;
+  uint64_t usec;
+  uint32_t txid;
+  int line;
+  int card;
+  int numid;
+  char entry[64];
+  /* printf format, a string literal, and its packed arguments */
+  const char *format;
+  size_t args_len;
+  char args[ARGS_SIZE];
+};
+
+int alsaped_log_mask;
+
+/* Decision being handled by the thread, 0 if none */
+static __thread uint32_t log_txid;
 
 static struct {
   int syslog;
-  int mask;
+  int journal;
+  /* logger thread */
+  int running;
+  pthread_t thread;
+  int kick_fd;
+  atomic_int sleeping;
+  atomic_int stop;
+  /* messages dropped as the ring was full */
+  atomic_uint dropped;
+  /* next position to fill and to write */
+  atomic_uint tail;
+  unsigned int head;
+  struct log_entry ring[RING_SIZE];
 } priv;
 
+
+static uint64_t log_usec   (void);
+static void     log_fill   (struct log_entry *, log_level_t,
+                            const struct log_fields *, int, const char *,
+                            va_list);
+static void     log_message (struct log_entry *, log_level_t,
+                             const char *, ...);
+static const char *log_spec_parse (const char *, struct log_spec *);
+static size_t   log_pack   (char *, size_t, int, const char *, va_list);
+static void     log_format (struct log_entry *, char *, size_t);
+static void     log_write  (struct log_entry *);
+static void     log_push   (log_level_t, const struct log_fields *, int,
+                            const char *, va_list);
+static int      log_drain  (void);
+static void    *log_main   (void *);
+static void     log_exit   (void);
+
+
+/**
+ * Initialize logging. Messages are written synchronously until the logger
+ * thread is started by log_create().
+ *
+ * @param options  options parsed from command line
+ * @return         always zero
+ */
 int
 log_init(struct options *options)
 {
   priv.syslog = options->daemon && !options->list_and_exit;
-  priv.mask   = options->log_mask | LOG_FLAG_NOTICE;
+  alsaped_log_mask = options->log_mask | LOG_FLAG_NOTICE;
+  priv.kick_fd = -1;
 
-  if (priv.syslog)
+#ifdef HAVE_JOURNAL
+  priv.journal = priv.syslog && access(JOURNAL_SOCKET, W_OK) == 0;
+#endif
+
+  if (priv.syslog && !priv.journal)
     openlog("alsaped", LOG_NOWAIT, LOG_DAEMON);
 
   return 0;
 }
 
+/**
+ * Start the logger thread. From now on a message is copied to a ring and
+ * written later by the thread, so the caller doesn't wait for localtime(),
+ * stderr or syslog. The queued messages are written at exit.
+ *
+ * @return  0 on success, -1 on error
+ */
+int
+log_create()
+{
+  unsigned int i;
+  int ret;
+
+  if (priv.running)
+    return 0;
+
+  for (i = 0;  i < RING_SIZE;  i++)
+    atomic_init(&priv.ring[i].seq, i);
+
+  priv.kick_fd = eventfd(0, EFD_CLOEXEC);
+
+  if (priv.kick_fd < 0)
+    return -1;
+
+  ret = pthread_create(&priv.thread, NULL, log_main, NULL);
+
+  if (ret)
+  {
+    close(priv.kick_fd);
+    priv.kick_fd = -1;
+    errno = ret;
+    return -1;
+  }
+
+  priv.running = 1;
+  atexit(log_exit);
+
+  return 0;
+}
+
+/**
+ * Set the decision the messages of the calling thread are about
+ * @param txid  transaction ID of the decision, 0 if none
+ */
+void
+log_set_txid(uint32_t txid)
+{
+  log_txid = txid;
+}
+
+/**
+ * Get the decision the messages of the calling thread are about
+ * @return  transaction ID of the decision, 0 if none
+ */
+uint32_t
+log_get_txid()
+{
+  return log_txid;
+}
+
 void
 alsaped_log(log_level_t level, const char *format, ...)
 {
+  struct log_entry entry;
+  va_list args;
+  int errnum = errno;
+
+  if (!level || level >= LOG_LEVEL_MAX || !log_enabled(level))
+    return;
+
+  va_start(args, format);
+
+  if (priv.running)
+    log_push(level, NULL, errnum, format, args);
+  else
+  {
+    log_fill(&entry, level, NULL, errnum, format, args);
+    log_write(&entry);
+  }
+
+  va_end(args);
+}
+
+/**
+ * Log message about rule
+ *
+ * @param level   log level of the message
+ * @param fields  the rule, NULL if none
+ * @param format  printf format of the message
+ */
+void
+alsaped_log_fields(log_level_t level, const struct log_fields *fields,
+                   const char *format, ...)
+{
+  struct log_entry entry;
   va_list args;
+  int errnum = errno;
 
-  if (!level || level >= LOG_LEVEL_MAX || !(priv.mask >> level & 1))
+  if (!level || level >= LOG_LEVEL_MAX || !log_enabled(level))
     return;
 
   va_start(args, format);
 
+  if (priv.running)
+    log_push(level, fields, errnum, format, args);
+  else
+  {
+    log_fill(&entry, level, fields, errnum, format, args);
+    log_write(&entry);
+  }
+
+  va_end(args);
+}
+
+/**
+ * Get monotonic time
+ * @return  the time in microseconds
+ */
+static uint64_t
+log_usec()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Fill log entry, except for its sequence number
+ *
+ * @param entry   the entry
+ * @param level   log level of the message
+ * @param fields  rule the message is about, NULL if none
+ * @param errnum  errno of the caller, for %m
+ * @param format  printf format of the message
+ * @param args    arguments of the format
+ */
+static void
+log_fill(struct log_entry *entry, log_level_t level,
+         const struct log_fields *fields, int errnum, const char *format,
+         va_list args)
+{
+  entry->level = level;
+  entry->usec  = log_usec();
+  entry->txid  = log_txid;
+
+  if (fields)
+  {
+    entry->line  = fields->line;
+    entry->card  = fields->card;
+    entry->numid = fields->numid;
+    snprintf(entry->entry, sizeof(entry->entry), "%s",
+             fields->entry ? fields->entry : "");
+  }
+  else
+  {
+    entry->line  = 0;
+    entry->card  = -1;
+    entry->numid = -1;
+    entry->entry[0] = 0;
+  }
+
+  entry->format = format;
+  entry->args_len = log_pack(entry->args, sizeof(entry->args), errnum,
+                             format, args);
+}
+
+/**
+ * Fill log entry of a message without fields
+ *
+ * @param entry   the entry
+ * @param level   log level of the message
+ * @param format  printf format of the message
+ */
+static void
+log_message(struct log_entry *entry, log_level_t level,
+            const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  log_fill(entry, level, NULL, 0, format, args);
+  va_end(args);
+}
+
+/**
+ * Parse conversion specification of printf format
+ *
+ * @param p     the '%' starting the specification
+ * @param spec  pointer to return the specification
+ *
+ * @return  the format after the specification
+ */
+static const char *
+log_spec_parse(const char *p, struct log_spec *spec)
+{
+  char length = 0;
+
+  memset(spec, 0, sizeof(*spec));
+  spec->start = p++;
+
+  p += strspn(p, "-+ #0'");
+
+  if (*p == '*')
+  {
+    spec->width_arg = 1;
+    p++;
+  }
+  else
+    p += strspn(p, "0123456789");
+
+  if (*p == '.')
+  {
+    if (*++p == '*')
+    {
+      spec->prec_arg = 1;
+      p++;
+    }
+    else
+      p += strspn(p, "0123456789");
+  }
+
+  /* hh and ll are told apart by case */
+  if ((p[0] == 'h' || p[0] == 'l') && p[1] == p[0])
+  {
+    length = p[0] == 'h' ? 'H' : 'L';
+    p += 2;
+  }
+  else if (*p && strchr("hlzjtL", *p))
+    length = *p++ == 'L' ? 'D' : p[-1];
+
+  switch (*p)
+  {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+      switch (length)
+      {
+        case 'l': spec->type = LOG_ARG_LONG;    break;
+        case 'L': spec->type = LOG_ARG_LLONG;   break;
+        case 'z': spec->type = LOG_ARG_SIZE;    break;
+        case 'j': spec->type = LOG_ARG_INTMAX;  break;
+        case 't': spec->type = LOG_ARG_PTRDIFF; break;
+        default:  spec->type = LOG_ARG_INT;     break;
+      }
+      break;
+
+    case 'e': case 'f': case 'g': case 'a':
+    case 'E': case 'F': case 'G': case 'A':
+      spec->type = length == 'D' ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+      break;
+
+    case 's':
+      spec->type = LOG_ARG_STRING;
+      break;
+
+    case 'p':
+      spec->type = LOG_ARG_POINTER;
+      break;
+
+    case 'm':
+      spec->type = LOG_ARG_ERRNO;
+      break;
+  }
+
+  if (*p)
+    p++;
+
+  spec->end = p;
+
+  return p;
+}
+
+/**
+ * Pack the arguments of printf format, the strings are copied. The
+ * arguments which don't fit are left out, the strings are truncated.
+ *
+ * @param buf     the buffer
+ * @param size    buffer size
+ * @param errnum  errno of the caller, for %m
+ * @param format  the format
+ * @param args    the arguments
+ *
+ * @return  size of the packed arguments
+ */
+static size_t
+log_pack(char *buf, size_t size, int errnum, const char *format,
+         va_list args)
+{
+  struct log_spec spec;
+  union log_value value;
+  const char *p = format;
+  const char *str;
+  size_t len = 0;
+  size_t n;
+  int star;
+
+#define LOG_PACK(field, arg)                               \
+  do {                                                    \
+    value.field = (arg);                                  \
+    if (len + sizeof(value.field) > size)                 \
+      return len;                                         \
+    memcpy(buf + len, &value.field, sizeof(value.field)); \
+    len += sizeof(value.field);                           \
+  } while (0)
+
+  while ((p = strchr(p, '%')) != NULL)
+  {
+    p = log_spec_parse(p, &spec);
+
+    for (star = spec.width_arg + spec.prec_arg;  star > 0;  star--)
+      LOG_PACK(i, va_arg(args, int));
+
+    switch (spec.type)
+    {
+      case LOG_ARG_NONE:                                              break;
+      case LOG_ARG_INT:     LOG_PACK(i,  va_arg(args, int));          break;
+      case LOG_ARG_LONG:    LOG_PACK(l,  va_arg(args, long));         break;
+      case LOG_ARG_LLONG:   LOG_PACK(ll, va_arg(args, long long));    break;
+      case LOG_ARG_SIZE:    LOG_PACK(z,  va_arg(args, size_t));       break;
+      case LOG_ARG_INTMAX:  LOG_PACK(j,  va_arg(args, intmax_t));     break;
+      case LOG_ARG_PTRDIFF: LOG_PACK(t,  va_arg(args, ptrdiff_t));    break;
+      case LOG_ARG_DOUBLE:  LOG_PACK(d,  va_arg(args, double));       break;
+      case LOG_ARG_LDOUBLE: LOG_PACK(ld, va_arg(args, long double));  break;
+      case LOG_ARG_POINTER: LOG_PACK(p,  va_arg(args, void *));       break;
+
+      case LOG_ARG_STRING:
+      case LOG_ARG_ERRNO:
+        if (spec.type == LOG_ARG_STRING)
+          str = va_arg(args, const char *);
+        else
+          str = strerror(errnum);
+
+        if (!str)
+          str = "(null)";
+
+        if (len >= size)
+          return len;
+
+        n = strnlen(str, size - len - 1);
+        memcpy(buf + len, str, n);
+        buf[len + n] = 0;
+        len += n + 1;
+        break;
+    }
+  }
+
+#undef LOG_PACK
+
+  return len;
+}
+
+/**
+ * Format message of log entry. The arguments left out when packing end
+ * the message.
+ *
+ * @param entry  the entry
+ * @param msg    buffer for the message
+ * @param size   buffer size
+ */
+static void
+log_format(struct log_entry *entry, char *msg, size_t size)
+{
+  struct log_spec spec;
+  union log_value value;
+  const char *p = entry->format;
+  const char *next;
+  const char *q;
+  char conv[64];
+  int stars[2];
+  size_t pos = 0;
+  size_t len = 0;
+  size_t n;
+  int star, ret = 0;
+
+#define LOG_UNPACK(field)                                           \
+  (pos + sizeof(value.field) <= entry->args_len ?                   \
+   (memcpy(&value.field, entry->args + pos, sizeof(value.field)),   \
+    pos += sizeof(value.field), 1) : 0)
+
+  msg[0] = 0;
+
+  for (;;)
+  {
+    next = strchr(p, '%');
+    n = next ? (size_t)(next - p) : strlen(p);
+
+    if (n > size - len - 1)
+      n = size - len - 1;
+
+    memcpy(msg + len, p, n);
+    len += n;
+    msg[len] = 0;
+
+    if (!next || len == size - 1)
+      break;
+
+    p = log_spec_parse(next, &spec);
+
+    for (star = 0;  star < spec.width_arg + spec.prec_arg;  star++)
+    {
+      if (!LOG_UNPACK(i))
+        return;
+
+      stars[star] = value.i;
+    }
+
+    /* The conversion with the '*' replaced by the values, and %m by %s.
+     * A negative precision is taken as if omitted. */
+    for (q = spec.start, n = 0;  q < spec.end;  q++)
+    {
+      if (n > sizeof(conv) - 16)
+        return;
+
+      if (*q == '.' && q[1] == '*' && stars[spec.width_arg] < 0)
+        q++;
+      else if (*q == '*')
+        n += sprintf(conv + n, "%d", stars[q[-1] == '.' ? spec.width_arg : 0]);
+      else if (*q == 'm' && spec.type == LOG_ARG_ERRNO)
+        conv[n++] = 's';
+      else
+        conv[n++] = *q;
+    }
+
+    conv[n] = 0;
+
+    switch (spec.type)
+    {
+      case LOG_ARG_NONE:
+        if (spec.end[-1] == '%' && spec.end - spec.start > 1)
+          ret = snprintf(msg + len, size - len, "%%");
+        else
+          ret = 0;
+        break;
+
+#define LOG_CONV(field)                                        \
+      if (!LOG_UNPACK(field))                                  \
+        return;                                                \
+      ret = snprintf(msg + len, size - len, conv, value.field); \
+      break
+
+      case LOG_ARG_INT:     LOG_CONV(i);
+      case LOG_ARG_LONG:    LOG_CONV(l);
+      case LOG_ARG_LLONG:   LOG_CONV(ll);
+      case LOG_ARG_SIZE:    LOG_CONV(z);
+      case LOG_ARG_INTMAX:  LOG_CONV(j);
+      case LOG_ARG_PTRDIFF: LOG_CONV(t);
+      case LOG_ARG_DOUBLE:  LOG_CONV(d);
+      case LOG_ARG_LDOUBLE: LOG_CONV(ld);
+      case LOG_ARG_POINTER: LOG_CONV(p);
+
+#undef LOG_CONV
+
+      case LOG_ARG_STRING:
+      case LOG_ARG_ERRNO:
+        if (pos >= entry->args_len)
+          return;
+
+        ret = snprintf(msg + len, size - len, conv, entry->args + pos);
+        pos += strlen(entry->args + pos) + 1;
+        break;
+    }
+
+    if (ret > 0)
+      len += (size_t)ret < size - len ? (size_t)ret : size - len - 1;
+  }
+
+#undef LOG_UNPACK
+}
+
+#ifdef HAVE_JOURNAL
+/**
+ * Send message to journald, with the fields set as fields of their own.
+ * The record is sent with one call.
+ *
+ * @param entry  the message
+ * @param msg    the message formatted
+ * @param prio   syslog priority of the message
+ */
+static void
+log_journal(struct log_entry *entry, const char *msg, int prio)
+{
+  char message[MSG_SIZE + 8];
+  char name[sizeof(entry->entry) + 14];
+  char buf[5][32];
+  struct iovec iov[8];
+  int n = 0;
+
+#define JOURNAL_FIELD(str)                              \
+  (iov[n].iov_base = (void *)(str),                     \
+   iov[n].iov_len  = strlen(iov[n].iov_base), n++)
+
+#define JOURNAL_INT(i, name, value)                     \
+  (snprintf(buf[i], sizeof(buf[i]), name "=%lld",       \
+            (long long)(value)), JOURNAL_FIELD(buf[i]))
+
+  snprintf(message, sizeof(message), "MESSAGE=%s", msg);
+  JOURNAL_FIELD(message);
+  JOURNAL_INT(0, "PRIORITY", prio);
+  JOURNAL_FIELD("SYSLOG_IDENTIFIER=alsaped");
+
+  if (entry->txid)
+    JOURNAL_INT(1, "ALSAPED_TXID", entry->txid);
+
+  if (entry->line)
+    JOURNAL_INT(2, "ALSAPED_LINE", entry->line);
+
+  if (entry->card >= 0)
+    JOURNAL_INT(3, "ALSAPED_CARD", entry->card);
+
+  if (entry->numid >= 0)
+    JOURNAL_INT(4, "ALSAPED_NUMID", entry->numid);
+
+  if (entry->entry[0])
+  {
+    snprintf(name, sizeof(name), "ALSAPED_ENTRY=%s", entry->entry);
+    JOURNAL_FIELD(name);
+  }
+
+#undef JOURNAL_INT
+#undef JOURNAL_FIELD
+
+  sd_journal_sendv(iov, n);
+}
+#endif
+
+/**
+ * Write message to journald, syslog or stderr
+ * @param entry  the message
+ */
+static void
+log_write(struct log_entry *entry)
+{
+  log_level_t level = entry->level;
+  uint64_t usec = entry->usec;
+  char msg[MSG_SIZE];
+
+  log_format(entry, msg, sizeof(msg));
+
   if (priv.syslog)
   {
     int prio;
@@ -51,32 +714,182 @@ alsaped_log(log_level_t level, const char *format, ...)
     else
       prio = LOG_ERR;
 
-    vsyslog(prio, format, args);
+#ifdef HAVE_JOURNAL
+    if (priv.journal)
+    {
+      log_journal(entry, msg, prio);
+      return;
+    }
+#endif
+
+    syslog(prio, "%s", msg);
   }
   else
   {
-    char msg[MSG_SIZE];
-    time_t timer;
-    struct tm *timeinfo;
     char *prefix = "";
 
-    time(&timer);
-    timeinfo = localtime(&timer);
-
     if (level == LOG_LEVEL_ERROR)
       prefix = " [ERROR]";
     else if (level == LOG_LEVEL_WARNING)
       prefix = " [WARNING]";
 
-    snprintf(msg, MSG_SIZE,
-             "%02d:%02d:%02d alsaped%s: %s\n",
-             timeinfo->tm_hour, timeinfo->tm_min,
-             timeinfo->tm_sec, prefix, format);
+    fprintf(stderr, "%5llu.%06llu alsaped%s: %s\n",
+            (unsigned long long)(usec / 1000000),
+            (unsigned long long)(usec % 1000000), prefix, msg);
+  }
+}
+
+/**
+ * Queue message for the logger thread. Any thread may log, so a position
+ * is claimed first and the entry is marked filled when the message is in.
+ * If the ring is full, the message is dropped.
+ */
+static void
+log_push(log_level_t level, const struct log_fields *fields, int errnum,
+         const char *format, va_list args)
+{
+  struct log_entry *entry;
+  unsigned int pos, seq;
+
+  pos = atomic_load_explicit(&priv.tail, memory_order_relaxed);
+
+  for (;;)
+  {
+    entry = &priv.ring[pos & RING_MASK];
+    seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
 
-    vfprintf(stderr, msg, args);
+    if (seq == pos)
+    {
+      if (atomic_compare_exchange_weak_explicit(&priv.tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if ((int)(seq - pos) < 0)
+    {
+      /* The caller isn't held up, the thread logs the count */
+      atomic_fetch_add_explicit(&priv.dropped, 1, memory_order_relaxed);
+      return;
+    }
+    else
+    {
+      pos = atomic_load_explicit(&priv.tail, memory_order_relaxed);
+    }
   }
 
-  va_end(args);
+  log_fill(entry, level, fields, errnum, format, args);
+  atomic_store_explicit(&entry->seq, pos + 1, memory_order_release);
+
+  /* Wake the logger thread only if it's waiting. Pairs with the fence
+   * of log_main(): either the thread sees the entry, or this sees it
+   * waiting. */
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (atomic_load_explicit(&priv.sleeping, memory_order_relaxed) &&
+      atomic_exchange(&priv.sleeping, 0))
+  {
+    uint64_t one = 1;
+
+    while (write(priv.kick_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+      ;
+  }
+}
+
+/**
+ * Write the queued messages and the count of the dropped ones, called by
+ * the logger thread only
+ *
+ * @return  number of messages written
+ */
+static int
+log_drain()
+{
+  static struct log_entry notice;
+  struct log_entry *entry;
+  unsigned int dropped;
+  int count = 0;
+
+  for (;;)
+  {
+    entry = &priv.ring[priv.head & RING_MASK];
+
+    if (atomic_load_explicit(&entry->seq, memory_order_acquire) !=
+        priv.head + 1)
+    {
+      break;
+    }
+
+    log_write(entry);
+    atomic_store_explicit(&entry->seq, priv.head + RING_SIZE,
+                          memory_order_release);
+    priv.head++;
+    count++;
+  }
+
+  if ((dropped = atomic_exchange_explicit(&priv.dropped, 0,
+                                          memory_order_relaxed)))
+  {
+    log_message(&notice, LOG_LEVEL_NOTICE,
+                "%u messages dropped, the log was full", dropped);
+    log_write(&notice);
+    count++;
+  }
+
+  return count;
+}
+
+/**
+ * Logger thread: write the queued messages, then wait for more
+ */
+static void *
+log_main(void *arg)
+{
+  uint64_t count;
+
+  for (;;)
+  {
+    if (log_drain())
+      continue;
+
+    if (atomic_load(&priv.stop))
+      break;
+
+    /* Check once more after announcing the wait, a message queued
+     * meanwhile may not have kicked. Pairs with the fence of
+     * log_push(). */
+    atomic_store_explicit(&priv.sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (log_drain())
+      continue;
+
+    if (atomic_load(&priv.stop))
+      break;
+
+    while (read(priv.kick_fd, &count, sizeof(count)) < 0 && errno == EINTR)
+      ;
+  }
+
+  return NULL;
+}
+
+/**
+ * Let the logger thread write the queued messages and stop it
+ */
+static void
+log_exit()
+{
+  uint64_t one = 1;
+
+  atomic_store(&priv.stop, 1);
+
+  while (write(priv.kick_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+
+  pthread_join(priv.thread, NULL);
+  priv.running = 0;
 }
 
 /** @} */
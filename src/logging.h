@@ -2,6 +2,7 @@
 #define LOGGING_H
 
 #include <stdarg.h>
+#include <stdint.h>
 #include "options.h"
 
 typedef enum log_level {
@@ -25,15 +26,66 @@ enum log_flag {
 #define LOG_MASK_ALL (LOG_FLAG_NULL | LOG_FLAG_ERROR | LOG_FLAG_INFO | \
                       LOG_FLAG_WARNING | LOG_FLAG_NOTICE)
 
+/* Rule a message is about, logged as journal fields */
+struct log_fields {
+  /* config file line, 0 if none */
+  int line;
+  /* sound card number and control element numid, -1 if none */
+  int card;
+  int numid;
+  /* entry of the rule, NULL if none */
+  const char *entry;
+};
+
+
+/* Levels compiled in. LOG_COMPILED_LEVELS is the LOG_FLAG_* of the
+ * levels given to --with-log-levels of configure, notices are always
+ * compiled in. */
+#ifdef LOG_COMPILED_LEVELS
+#define LOG_COMPILED_MASK (LOG_FLAG_NOTICE | (LOG_COMPILED_LEVELS))
+#else
+#define LOG_COMPILED_MASK LOG_MASK_ALL
+#endif
+
+/* Levels enabled at run time, set by log_init() */
+extern int alsaped_log_mask;
+
+/* True if messages of level are logged. Levels not compiled in are
+ * constant false, so the code logging them is dropped by the compiler. */
+#define log_enabled(level) \
+  ((LOG_COMPILED_MASK >> (level) & 1) && (alsaped_log_mask >> (level) & 1))
+
 
 int log_init(struct options *options);
+int log_create(void);
+
+void log_set_txid (uint32_t txid);
+uint32_t log_get_txid (void);
 
+/* The format is read when the logger thread writes the message, so it
+ * must be a string literal. The arguments are copied. */
 void alsaped_log(log_level_t level, const char *format, ...);
+void alsaped_log_fields(log_level_t level, const struct log_fields *fields,
+                        const char *format, ...);
+
+/* The arguments are evaluated only if the level is enabled */
+#define log_level(level, ...)                   \
+  do {                                          \
+    if (log_enabled(level))                     \
+      alsaped_log((level), __VA_ARGS__);        \
+  } while (0)
+
+#define log_error(...)   log_level(LOG_LEVEL_ERROR,   __VA_ARGS__)
+#define log_info(...)    log_level(LOG_LEVEL_INFO,    __VA_ARGS__)
+#define log_warning(...) log_level(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define log_notice(...)  log_level(LOG_LEVEL_NOTICE,  __VA_ARGS__)
 
-#define log_error(...)   alsaped_log(LOG_LEVEL_ERROR,   __VA_ARGS__)
-#define log_info(...)    alsaped_log(LOG_LEVEL_INFO,    __VA_ARGS__)
-#define log_warning(...) alsaped_log(LOG_LEVEL_WARNING, __VA_ARGS__)
-#define log_notice(...)  alsaped_log(LOG_LEVEL_NOTICE,  __VA_ARGS__)
+/* Info about rule execution, fields points to struct log_fields */
+#define log_rule(fields, ...)                                     \
+  do {                                                            \
+    if (log_enabled(LOG_LEVEL_INFO))                              \
+      alsaped_log_fields(LOG_LEVEL_INFO, (fields), __VA_ARGS__);  \
+  } while (0)
 
 
 #endif  /* LOGGING_H */
@@ -9,6 +9,15 @@ struct dbusif_options {
   char *pdpath;
   char *pdname;
   int   log;
+  int   window;
+  /* file to record the received decisions to */
+  char *record;
+  /* use the session bus instead of the system bus */
+  int   session;
+};
+
+struct sockif_options {
+  char *path;
 };
 
 struct alsaif_options {
@@ -27,9 +36,14 @@ struct options {
   int   log_parsed_rules;
   int   log_rule_execution;
   int   list_and_exit;
+  int   check_and_exit;
+  int   worker;
   int   log_mask;
+  /* file to write the timeline of the decisions to */
+  char *timeline;
   struct dbusif_options dbusif;
   struct alsaif_options alsaif;
+  struct sockif_options sockif;
 };
 
 
@@ -0,0 +1,600 @@
+/**
+ * @file queue.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement decision queue.
+ * Actions parsed from D-Bus messages are queued here and applied later
+ * from the main loop, so rule execution (and its suspends) doesn't happen
+ * inside D-Bus message dispatch. The actions of a message are a decision,
+ * acknowledged with its own result when they are applied. A queued action
+ * supersedes the earlier one of the same route, section or context
+ * variable of the decision, or of any decision within the coalescing
+ * window (-w), which applies the decisions of the window at once. The
+ * actions are applied in priority order: source routes first (e.g. mute
+ * the source), then sink routes, context and user defined sections.
+ * Acknowledgements wait for the worker thread, if it's running, to apply
+ * the settings.
+ * The queues and the executor source are reused, so queueing and applying
+ * actions doesn't allocate memory once the queues have grown. The latency
+ * of every acknowledged decision is recorded in the statistics, and in
+ * the timeline if it's written.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "control.h"
+#include "logging.h"
+#include "stats.h"
+#include "timeline.h"
+#include "worker.h"
+
+#include "queue.h"
+
+/* Length of names stored in queued actions, with terminator. Longer
+ * names are allocated. */
+#define QUEUE_NAME_MAX 128
+
+/* Queued action. The names are stored in the entry, action data is
+ * pointed to them when the action is applied, as the entries move. */
+struct queue_entry {
+  struct action_data data;
+  int   priority;
+  guint seq;
+  /* acknowledgement of the action, and its txid for logging */
+  guint decision;
+  uint32_t txid;
+  char  names[2][QUEUE_NAME_MAX];
+  /* allocated names, if too long for the entry */
+  char *long_names[2];
+};
+
+/* Acknowledgement waiting for the queued actions */
+struct queue_ack {
+  queue_ack_cb cb;
+  void *data;
+  int   success;
+  /* decision acknowledged and its span in the timeline */
+  uint32_t txid;
+  guint id;
+  /* when the decision was queued, microseconds */
+  gint64 start;
+  /* next one on the free list, while the settings are written */
+  struct queue_ack *next;
+};
+
+/* Private structure */
+static struct {
+  action_handler cb;
+  decision_handler done;
+  /* queued actions, struct queue_entry */
+  GArray *entries;
+  /* acknowledgements, struct queue_ack */
+  GArray *acks;
+  /* actions and acknowledgements being applied */
+  GArray *run_entries;
+  GArray *run_acks;
+  /* insertion order of entries */
+  guint seq;
+  /* acknowledgements queued so far */
+  guint ack_seq;
+  /* acknowledgement of the actions being applied, 0 if none */
+  guint current;
+  /* delay of the executor in milliseconds, 0 to run on idle */
+  int   delay;
+  GSource *executor;
+  int   scheduled;
+  int   log;
+  /* acknowledgements waiting for the worker threads, and reused ones */
+  GPtrArray *waiting;
+  struct queue_ack *free_acks;
+} priv;
+
+
+static int      entry_priority    (enum rule_type);
+static gint     entry_compare     (gconstpointer, gconstpointer);
+static gint     decision_compare  (gconstpointer, gconstpointer);
+static void     entry_set_name    (struct queue_entry *, int, const char *);
+static const char *entry_name     (struct queue_entry *, int);
+static void     entries_clear     (GArray *);
+static void     executor_start    (void);
+static gboolean executor_dispatch (GSource *, GSourceFunc, gpointer);
+static void     executor_cb       (void);
+static void     executor_apply    (GArray *, guint, guint, guint);
+static void     ack_finish        (struct queue_ack *);
+static void     ack_done_cb       (void *, int);
+
+static GSourceFuncs executor_funcs = {
+  .dispatch = executor_dispatch
+};
+
+
+/**
+ * Initialize decision queue
+ * @param options  options parsed from command line
+ * @return         always zero
+ */
+int
+queue_init(struct options *options)
+{
+  priv.entries     = g_array_new(FALSE, FALSE, sizeof(struct queue_entry));
+  priv.acks        = g_array_new(FALSE, FALSE, sizeof(struct queue_ack));
+  priv.run_entries = g_array_new(FALSE, FALSE, sizeof(struct queue_entry));
+  priv.run_acks    = g_array_new(FALSE, FALSE, sizeof(struct queue_ack));
+  priv.waiting     = g_ptr_array_new();
+  priv.delay       = options->dbusif.window;
+  priv.log         = options->dbusif.log;
+
+  /* The executor is woken up by setting its ready time */
+  priv.executor = g_source_new(&executor_funcs, sizeof(GSource));
+  g_source_set_priority(priv.executor, priv.delay ? G_PRIORITY_DEFAULT
+                                                  : G_PRIORITY_DEFAULT_IDLE);
+  g_source_attach(priv.executor, NULL);
+
+  return 0;
+}
+
+/**
+ * Set the functions applying queued actions
+ * @param cb    callback function for every action
+ * @param done  callback function for the end of actions
+ */
+void
+queue_set_cb(action_handler cb, decision_handler done)
+{
+  priv.cb   = cb;
+  priv.done = done;
+}
+
+/**
+ * Queue action. An already queued action of the same route type, section
+ * or context variable is replaced, if it's of the same decision or the
+ * decisions are coalesced.
+ *
+ * @param data  action data, the strings are copied
+ * @return      0 on success, -1 on error
+ */
+int
+queue_push(struct action_data *data)
+{
+  struct queue_entry *entry = NULL;
+  const char *names[2];
+  /* the actions are acknowledged by the next acknowledgement */
+  guint decision = priv.ack_seq + 1;
+  guint i;
+
+  if (!data || data->rule_type == rule_unknown)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (data->rule_type == rule_context)
+  {
+    names[0] = data->variable;
+    names[1] = data->value;
+  }
+  else
+  {
+    names[0] = data->route_dev;
+    names[1] = "";
+  }
+
+  for (i = 0;  i < priv.entries->len;  i++)
+  {
+    entry = &g_array_index(priv.entries, struct queue_entry, i);
+
+    if ((priv.delay || entry->decision == decision) &&
+        entry->data.rule_type == data->rule_type &&
+        (data->rule_type != rule_context ||
+         !strcmp(entry_name(entry, 0), names[0])))
+    {
+      if (priv.log)
+        log_info("Queued action superseded");
+
+      break;
+    }
+  }
+
+  if (i == priv.entries->len)
+  {
+    g_array_set_size(priv.entries, i + 1);
+    entry = &g_array_index(priv.entries, struct queue_entry, i);
+    entry->long_names[0] = entry->long_names[1] = NULL;
+  }
+
+  entry->data.rule_type = data->rule_type;
+  entry->priority = entry_priority(data->rule_type);
+  entry->seq = priv.seq++;
+  entry->decision = decision;
+  entry->txid = log_get_txid();
+  entry_set_name(entry, 0, names[0]);
+  entry_set_name(entry, 1, names[1]);
+
+  executor_start();
+
+  return 0;
+}
+
+/**
+ * Queue acknowledgement. The callback is called after the actions
+ * queued so far are applied.
+ *
+ * @param cb       callback function
+ * @param data     data passed to the callback
+ * @param success  FALSE if the acknowledged request was already failed
+ * @param start    when the request was received, g_get_monotonic_time()
+ *
+ * @return  0 on success, -1 on error
+ */
+int
+queue_ack(queue_ack_cb cb, void *data, int success, int64_t start)
+{
+  struct queue_ack ack;
+
+  if (!cb)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ack.cb = cb;
+  ack.data = data;
+  ack.success = success;
+  ack.txid = log_get_txid();
+  ack.id = ++priv.ack_seq;
+  ack.start = start;
+
+  g_array_append_val(priv.acks, ack);
+  executor_start();
+
+  return 0;
+}
+
+/**
+ * Get the decision whose actions are being applied
+ * @return  acknowledgement id of the decision, 0 if none is applied
+ */
+unsigned int
+queue_decision()
+{
+  return priv.current;
+}
+
+/**
+ * Fail decision, e.g. when a control element write of it failed. The
+ * acknowledgement of the decision reports the failure.
+ *
+ * @param decision  acknowledgement id of the decision, 0 is ignored
+ */
+void
+queue_fail(unsigned int decision)
+{
+  struct queue_ack *ack;
+  guint i;
+
+  if (!decision)
+    return;
+
+  for (i = 0;  i < priv.run_acks->len;  i++)
+  {
+    ack = &g_array_index(priv.run_acks, struct queue_ack, i);
+
+    if (ack->id == decision)
+    {
+      ack->success = FALSE;
+      return;
+    }
+  }
+
+  for (i = 0;  i < priv.waiting->len;  i++)
+  {
+    ack = g_ptr_array_index(priv.waiting, i);
+
+    if (ack->id == decision)
+    {
+      ack->success = FALSE;
+      return;
+    }
+  }
+}
+
+/**
+ * Get execution priority of an action, lower is executed first
+ * @param rule_type  rule type of the action
+ * @return           the priority
+ */
+static int
+entry_priority(enum rule_type rule_type)
+{
+  switch (rule_type)
+  {
+    case rule_source:
+      return 0;
+    case rule_sink:
+      return 1;
+    case rule_context:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+/**
+ * Compare queued actions by priority and insertion order
+ */
+static gint
+entry_compare(gconstpointer a, gconstpointer b)
+{
+  const struct queue_entry *ea = a;
+  const struct queue_entry *eb = b;
+
+  if (ea->priority != eb->priority)
+    return ea->priority - eb->priority;
+
+  return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+/**
+ * Compare queued actions by decision, priority and insertion order
+ */
+static gint
+decision_compare(gconstpointer a, gconstpointer b)
+{
+  const struct queue_entry *ea = a;
+  const struct queue_entry *eb = b;
+
+  if (ea->decision != eb->decision)
+    return ea->decision < eb->decision ? -1 : 1;
+
+  return entry_compare(a, b);
+}
+
+/**
+ * Store a name in queued action
+ * @param entry  the action
+ * @param i      index of the name
+ * @param name   the name, copied
+ */
+static void
+entry_set_name(struct queue_entry *entry, int i, const char *name)
+{
+  g_free(entry->long_names[i]);
+  entry->long_names[i] = NULL;
+
+  if (strlen(name) < QUEUE_NAME_MAX)
+    strcpy(entry->names[i], name);
+  else
+    entry->long_names[i] = g_strdup(name);
+}
+
+/**
+ * Get a name of queued action
+ * @param entry  the action
+ * @param i      index of the name
+ * @return       the name
+ */
+static const char *
+entry_name(struct queue_entry *entry, int i)
+{
+  return entry->long_names[i] ? entry->long_names[i] : entry->names[i];
+}
+
+/**
+ * Remove all queued actions of an array
+ * @param entries  the actions
+ */
+static void
+entries_clear(GArray *entries)
+{
+  struct queue_entry *entry;
+  guint i;
+
+  for (i = 0;  i < entries->len;  i++)
+  {
+    entry = &g_array_index(entries, struct queue_entry, i);
+    g_free(entry->long_names[0]);
+    g_free(entry->long_names[1]);
+  }
+
+  g_array_set_size(entries, 0);
+}
+
+/**
+ * Schedule the executor if not scheduled yet
+ */
+static void
+executor_start()
+{
+  if (priv.scheduled)
+    return;
+
+  priv.scheduled = TRUE;
+
+  if (priv.delay)
+    g_source_set_ready_time(priv.executor,
+                            g_get_monotonic_time() + priv.delay * 1000);
+  else
+    g_source_set_ready_time(priv.executor, 0);
+}
+
+/**
+ * Executor source dispatch function
+ * @return  always TRUE / G_SOURCE_CONTINUE, the source is reused
+ */
+static gboolean
+executor_dispatch(GSource *source, GSourceFunc cb, gpointer data)
+{
+  g_source_set_ready_time(source, -1);
+  priv.scheduled = FALSE;
+
+  executor_cb();
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Apply the queued decisions one by one, or the decisions of the
+ * coalescing window at once, and call the acknowledgements
+ */
+static void
+executor_cb()
+{
+  struct queue_entry *entry;
+  struct queue_ack *ack;
+  GArray *entries;
+  GArray *acks;
+  gint64 start = timeline_start();
+  guint i, first, last;
+
+  /* Actions queued by the callbacks go to the next round */
+  entries = priv.entries;
+  acks = priv.acks;
+  priv.entries = priv.run_entries;
+  priv.acks = priv.run_acks;
+  priv.run_entries = entries;
+  priv.run_acks = acks;
+
+  g_array_sort(entries, priv.delay ? entry_compare : decision_compare);
+
+  if (priv.log)
+    log_info("applying %u queued actions", entries->len);
+
+  if (priv.delay)
+  {
+    /* The settings are written once, as of the last decision */
+    executor_apply(entries, 0, entries->len,
+                   acks->len ? g_array_index(acks, struct queue_ack,
+                                             acks->len - 1).id : 0);
+
+    for (i = 0;  i < acks->len;  i++)
+      ack_finish(&g_array_index(acks, struct queue_ack, i));
+  }
+  else
+  {
+    for (i = first = 0;  i < acks->len;  i++)
+    {
+      ack = &g_array_index(acks, struct queue_ack, i);
+
+      for (last = first;  last < entries->len;  last++)
+      {
+        entry = &g_array_index(entries, struct queue_entry, last);
+
+        if (entry->decision != ack->id)
+          break;
+      }
+
+      executor_apply(entries, first, last, ack->id);
+      ack_finish(ack);
+      first = last;
+    }
+
+    /* Actions without acknowledgement */
+    if (first < entries->len)
+      executor_apply(entries, first, entries->len, 0);
+  }
+
+  timeline_span("apply", start, NULL);
+
+  entries_clear(entries);
+  g_array_set_size(acks, 0);
+}
+
+/**
+ * Apply queued actions and write the settings. A failed action fails its
+ * decision, and the writes fail the decisions which staged them.
+ *
+ * @param entries   the actions
+ * @param first     index of the first action to apply
+ * @param last      index after the last action to apply
+ * @param decision  decision of the actions, 0 if not acknowledged
+ */
+static void
+executor_apply(GArray *entries, guint first, guint last, guint decision)
+{
+  struct queue_entry *entry;
+  guint i;
+
+  for (i = first;  i < last;  i++)
+  {
+    entry = &g_array_index(entries, struct queue_entry, i);
+
+    if (entry->data.rule_type == rule_context)
+    {
+      entry->data.variable = entry_name(entry, 0);
+      entry->data.value    = entry_name(entry, 1);
+    }
+    else
+    {
+      entry->data.route_dev = entry_name(entry, 0);
+    }
+
+    log_set_txid(entry->txid);
+    priv.current = entry->decision;
+
+    if (priv.cb && priv.cb(&entry->data) < 0)
+      queue_fail(entry->decision);
+  }
+
+  /* The settings are written now, with the txids which staged them */
+  priv.current = decision;
+
+  if (priv.done)
+    priv.done();
+
+  priv.current = 0;
+  log_set_txid(0);
+}
+
+/**
+ * Wait for the worker threads to write the settings of decision
+ * @param ack  acknowledgement of the decision
+ */
+static void
+ack_finish(struct queue_ack *ack)
+{
+  struct queue_ack *done;
+
+  /* The array is reused, so the acknowledgement is copied */
+  if ((done = priv.free_acks) != NULL)
+    priv.free_acks = done->next;
+  else
+    done = g_new(struct queue_ack, 1);
+
+  *done = *ack;
+  g_ptr_array_add(priv.waiting, done);
+  worker_barrier(ack_done_cb, done, TRUE);
+}
+
+/**
+ * Worker barrier callback: the settings of the decision are written
+ *
+ * @param data     the acknowledgement
+ * @param success  whether the actions were applied
+ */
+static void
+ack_done_cb(void *data, int success)
+{
+  struct queue_ack *ack = data;
+
+  g_ptr_array_remove_fast(priv.waiting, ack);
+
+  stats_decision(g_get_monotonic_time() - ack->start);
+
+  /* The acknowledgement, e.g. the status signal, is of the decision */
+  log_set_txid(ack->txid);
+
+  if (timeline_start())
+    timeline_async("decision", ack->id, ack->start, NULL);
+
+  ack->cb(ack->data, ack->success && success);
+  log_set_txid(0);
+
+  ack->next = priv.free_acks;
+  priv.free_acks = ack;
+}
+
+/** @} */
@@ -0,0 +1,21 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+
+#include "options.h"
+#include "dbusif.h"
+
+/** Called when the actions queued before the acknowledgement are applied */
+typedef void (*queue_ack_cb) (void *data, int success);
+
+int  queue_init   (struct options *options);
+void queue_set_cb (action_handler cb, decision_handler done);
+int  queue_push   (struct action_data *data);
+int  queue_ack    (queue_ack_cb cb, void *data, int success,
+                   int64_t start);
+unsigned int queue_decision (void);
+void queue_fail   (unsigned int decision);
+
+
+#endif  /* QUEUE_H */
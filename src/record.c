@@ -0,0 +1,241 @@
+/**
+ * @file record.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement decision recording.
+ * The actions of every policy decision received over D-Bus are appended
+ * to a file with the time they were received, so the exact traffic can
+ * be replayed later. See record.h for the format. The records are
+ * buffered and written once a second, so the decisions don't wait for
+ * the file.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "action.h"
+#include "logging.h"
+
+#include "record.h"
+
+/* Size of the record buffer, holds at least one record */
+#define RECORD_BUF_SIZE (64 * 1024)
+
+/* Interval of writing the buffered records, seconds */
+#define RECORD_FLUSH_SEC 1
+
+/* Private structure */
+static struct {
+  int fd;
+  /* decision being recorded */
+  struct record_header header;
+  char actions[RECORD_ACTIONS_MAX];
+  /* some action didn't fit or couldn't be packed */
+  int overflow;
+  /* records not written yet */
+  char buf[RECORD_BUF_SIZE];
+  size_t len;
+  /* writes the buffer, woken up by setting its ready time */
+  GSource *flush;
+  int scheduled;
+} priv = {
+  .fd = -1
+};
+
+
+static void     record_flush   (void);
+static gboolean flush_dispatch (GSource *, GSourceFunc, gpointer);
+
+static GSourceFuncs flush_funcs = {
+  .dispatch = flush_dispatch
+};
+
+
+/**
+ * Open the recording file. New records are appended to the file.
+ *
+ * @param path  the file, NULL to not record
+ * @return      0 if success, -1 if error
+ */
+int
+record_open(const char *path)
+{
+  if (!path)
+    return 0;
+
+  priv.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+  if (priv.fd < 0)
+  {
+    log_error("Can't open recording '%s': %s", path, strerror(errno));
+    return -1;
+  }
+
+  priv.flush = g_source_new(&flush_funcs, sizeof(GSource));
+  g_source_attach(priv.flush, NULL);
+  atexit(record_flush);
+
+  log_info("Recording policy decisions to '%s'", path);
+
+  return 0;
+}
+
+/**
+ * Start recording decision, just received
+ */
+void
+record_begin()
+{
+  if (priv.fd < 0)
+    return;
+
+  memset(&priv.header, 0, sizeof(priv.header));
+  priv.header.usec = g_get_monotonic_time();
+  priv.overflow = FALSE;
+}
+
+/**
+ * Add action to the decision being recorded
+ *
+ * @param kind   "route", "context" or "section"
+ * @param name   route type, context variable or section name
+ * @param value  route device, variable value or section entry
+ */
+void
+record_action(const char *kind, const char *name, const char *value)
+{
+  int size;
+
+  if (priv.fd < 0 || priv.overflow)
+    return;
+
+  size = action_pack(priv.actions + priv.header.len,
+                     sizeof(priv.actions) - priv.header.len,
+                     kind, name, value);
+
+  if (size < 0 || priv.header.count == UINT8_MAX)
+  {
+    priv.overflow = TRUE;
+    return;
+  }
+
+  priv.header.len += size;
+  priv.header.count++;
+}
+
+/**
+ * Finish the decision being recorded, it's written within
+ * RECORD_FLUSH_SEC seconds
+ *
+ * @param txid     transaction ID of the decision
+ * @param success  FALSE if the decision was rejected or malformed
+ */
+void
+record_end(uint32_t txid, int success)
+{
+  size_t len;
+
+  if (priv.fd < 0)
+    return;
+
+  if (priv.overflow)
+  {
+    log_error("Decision %u is too big to be recorded", txid);
+    return;
+  }
+
+  priv.header.txid = txid;
+  priv.header.status = success ? RECORD_QUEUED : RECORD_FAILED;
+
+  len = sizeof(priv.header) + priv.header.len;
+
+  if (priv.len + len > sizeof(priv.buf))
+    record_flush();
+
+  if (priv.fd < 0)
+    return;
+
+  memcpy(priv.buf + priv.len, &priv.header, sizeof(priv.header));
+  memcpy(priv.buf + priv.len + sizeof(priv.header), priv.actions,
+         priv.header.len);
+  priv.len += len;
+
+  if (!priv.scheduled)
+  {
+    priv.scheduled = TRUE;
+    g_source_set_ready_time(priv.flush, g_get_monotonic_time() +
+                                        RECORD_FLUSH_SEC * G_USEC_PER_SEC);
+  }
+}
+
+/**
+ * Write the buffered records, also at exit. One write, so a record is
+ * never split by a crash, the last second of records is lost at most.
+ */
+static void
+record_flush()
+{
+  if (priv.fd < 0 || !priv.len)
+    return;
+
+  if (write(priv.fd, priv.buf, priv.len) != priv.len)
+  {
+    log_error("Can't write recording, stopped: %s", strerror(errno));
+    close(priv.fd);
+    priv.fd = -1;
+  }
+
+  priv.len = 0;
+}
+
+/**
+ * Flush source dispatch function
+ * @return  always TRUE / G_SOURCE_CONTINUE, the source is reused
+ */
+static gboolean
+flush_dispatch(GSource *source, GSourceFunc cb, gpointer data)
+{
+  g_source_set_ready_time(source, -1);
+  priv.scheduled = FALSE;
+
+  record_flush();
+
+  return G_SOURCE_CONTINUE;
+}
+
+/**
+ * Read record of recording file
+ *
+ * @param file     the recording
+ * @param header   pointer to return the record header
+ * @param actions  buffer of RECORD_ACTIONS_MAX bytes to return the
+ *                 packed actions
+ *
+ * @return  1 if read, 0 at the end of file, -1 if error
+ */
+int
+record_read(FILE *file, struct record_header *header, char *actions)
+{
+  size_t len;
+
+  len = fread(header, 1, sizeof(*header), file);
+
+  if (len == 0 && feof(file))
+    return 0;
+
+  if (len != sizeof(*header) || header->len > RECORD_ACTIONS_MAX ||
+      fread(actions, 1, header->len, file) != header->len)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 1;
+}
+
+/** @} */
@@ -0,0 +1,42 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Recording of the policy decisions received over D-Bus. The file is a
+ * sequence of records in host byte order, every record is struct
+ * record_header followed by 'len' bytes of actions packed the same way
+ * as the actions of control socket requests, see sockif.h.
+ */
+
+/** Record header */
+struct record_header {
+  /* CLOCK_MONOTONIC time when the decision was received, microseconds */
+  uint64_t usec;
+  /* transaction ID of the decision */
+  uint32_t txid;
+  /* size of the packed actions */
+  uint16_t len;
+  /* number of actions */
+  uint8_t  count;
+  /* RECORD_QUEUED, or RECORD_FAILED if the decision was rejected or
+   * malformed, the actions parsed before the error are recorded */
+  uint8_t  status;
+};
+
+#define RECORD_QUEUED 0
+#define RECORD_FAILED 1
+
+#define RECORD_ACTIONS_MAX 4096
+
+int  record_open   (const char *path);
+void record_begin  (void);
+void record_action (const char *kind, const char *name, const char *value);
+void record_end    (uint32_t txid, int success);
+int  record_read   (FILE *file, struct record_header *header,
+                    char *actions);
+
+
+#endif  /* RECORD_H */
@@ -0,0 +1,432 @@
+/**
+ * @file sockif.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement control socket.
+ * Local clients can send policy actions over a SOCK_SEQPACKET unix socket
+ * instead of D-Bus, so the decisions don't pass through the bus daemon.
+ * The actions are queued like the ones received over D-Bus and every
+ * request is replied when its actions are applied. See sockif.h for the
+ * protocol.
+ *
+ * @{ */
+
+#define _GNU_SOURCE  /* accept4() */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "action.h"
+#include "control.h"
+#include "logging.h"
+#include "queue.h"
+
+#include "sockif.h"
+
+/* Access of the socket, for the users and groups of the policy clients */
+#define SOCKIF_MODE 0660
+
+/* Connected client */
+struct sockif_client {
+  int   fd;
+  guint src_id;
+  /* the connection and the requests waiting for reply */
+  int   refcount;
+};
+
+/* Request waiting for reply */
+struct sockif_pending {
+  struct sockif_client *client;
+  uint32_t id;
+};
+
+/* Private structure */
+static struct {
+  char *path;
+  int   fd;
+  int   log;
+} priv;
+
+
+static int      socket_remove  (struct sockaddr_un *);
+static gboolean listen_io_cb   (GIOChannel *, GIOCondition, gpointer);
+static gboolean client_io_cb   (GIOChannel *, GIOCondition, gpointer);
+static void     client_close   (struct sockif_client *);
+static void     client_unref   (struct sockif_client *);
+static int      request_handle (struct sockif_client *, char *, int);
+static void     reply_cb       (void *, int);
+static void     reply_send     (struct sockif_client *, uint32_t, int32_t);
+
+
+/**
+ * Initialize control socket options
+ * @param options  options parsed from command line
+ * @return         -1 if error, 0 if success
+ */
+int
+sockif_init(struct options *options)
+{
+  priv.fd  = -1;
+  priv.log = options->dbusif.log;
+
+  if (options->sockif.path && !(priv.path = strdup(options->sockif.path)))
+    return -1;
+
+  return 0;
+}
+
+/**
+ * Create the control socket, if enabled
+ * @return  0 if success, -1 if error
+ */
+int
+sockif_create()
+{
+  struct sockaddr_un addr;
+  GIOChannel *chan;
+
+  if (!priv.path)
+    return 0;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+
+  if (strlen(priv.path) >= sizeof(addr.sun_path))
+  {
+    log_error("Control socket path '%s' is too long", priv.path);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  strcpy(addr.sun_path, priv.path);
+
+  priv.fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (priv.fd < 0)
+  {
+    log_error("Can't create control socket: %s", strerror(errno));
+    return -1;
+  }
+
+  if (socket_remove(&addr) < 0)
+    goto fail;
+
+  /* The mode isn't left to the umask of the daemon */
+  if (bind(priv.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      chmod(priv.path, SOCKIF_MODE) < 0 ||
+      listen(priv.fd, 8) < 0)
+  {
+    log_error("Can't listen on '%s': %s", priv.path, strerror(errno));
+    goto fail;
+  }
+
+  chan = g_io_channel_unix_new(priv.fd);
+
+  if (!g_io_add_watch(chan, G_IO_IN, listen_io_cb, NULL))
+  {
+    log_error("Can't watch control socket");
+    g_io_channel_unref(chan);
+    goto fail;
+  }
+
+  g_io_channel_unref(chan);
+
+  log_info("Listening on '%s'", priv.path);
+
+  return 0;
+
+fail:
+  close(priv.fd);
+  priv.fd = -1;
+  errno = EIO;
+
+  return -1;
+}
+
+/**
+ * Remove the socket left by previous instance. Only a socket nobody
+ * listens on is removed, other files are left alone.
+ *
+ * @param addr  address of the socket
+ * @return      0 if the path is free, -1 if not
+ */
+static int
+socket_remove(struct sockaddr_un *addr)
+{
+  struct stat st;
+  int fd, ret;
+
+  if (lstat(addr->sun_path, &st) < 0)
+  {
+    if (errno == ENOENT)
+      return 0;
+
+    log_error("Can't access '%s': %s", addr->sun_path, strerror(errno));
+    return -1;
+  }
+
+  if (!S_ISSOCK(st.st_mode))
+  {
+    log_error("Can't listen on '%s': not a socket", addr->sun_path);
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+  {
+    log_error("Can't create control socket: %s", strerror(errno));
+    return -1;
+  }
+
+  ret = connect(fd, (struct sockaddr *)addr, sizeof(*addr));
+  close(fd);
+
+  if (ret == 0)
+  {
+    log_error("Can't listen on '%s': already in use", addr->sun_path);
+    return -1;
+  }
+
+  if (errno != ECONNREFUSED || unlink(addr->sun_path) < 0)
+  {
+    log_error("Can't remove '%s': %s", addr->sun_path, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Accept connection on the control socket
+ */
+static gboolean
+listen_io_cb(GIOChannel *chan, GIOCondition cond, gpointer data)
+{
+  struct sockif_client *client;
+  GIOChannel *client_chan;
+  int fd;
+
+  fd = accept4(priv.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (fd < 0)
+  {
+    if (errno != EAGAIN && errno != EINTR)
+      log_error("Can't accept control connection: %s", strerror(errno));
+
+    return TRUE;
+  }
+
+  client = g_new0(struct sockif_client, 1);
+  client->fd = fd;
+  client->refcount = 1;
+
+  client_chan = g_io_channel_unix_new(fd);
+  client->src_id = g_io_add_watch(client_chan, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                  client_io_cb, client);
+  g_io_channel_unref(client_chan);
+
+  if (!client->src_id)
+  {
+    log_error("Can't watch control connection");
+    client_close(client);
+    return TRUE;
+  }
+
+  if (priv.log)
+    log_info("control connection %d accepted", fd);
+
+  return TRUE;
+}
+
+/**
+ * Receive requests of client
+ */
+static gboolean
+client_io_cb(GIOChannel *chan, GIOCondition cond, gpointer data)
+{
+  struct sockif_client *client = data;
+  char packet[SOCKIF_PACKET_MAX];
+  ssize_t len;
+
+  while ((len = recv(client->fd, packet, sizeof(packet), MSG_TRUNC)) > 0)
+  {
+    if (len > sizeof(packet))
+    {
+      log_error("Control request of %zd bytes is too long", len);
+      reply_send(client, 0, -EINVAL);
+      continue;
+    }
+
+    request_handle(client, packet, len);
+  }
+
+  if (len < 0 && (errno == EAGAIN || errno == EINTR))
+    return TRUE;
+
+  /* End of file or error */
+  if (priv.log)
+    log_info("control connection %d closed", client->fd);
+
+  client->src_id = 0;
+  client_close(client);
+
+  return FALSE;
+}
+
+/**
+ * Close client connection. The client is freed when the pending
+ * requests are done.
+ *
+ * @param client  the client
+ */
+static void
+client_close(struct sockif_client *client)
+{
+  if (client->src_id)
+    g_source_remove(client->src_id);
+
+  close(client->fd);
+
+  client->src_id = 0;
+  client->fd = -1;
+
+  client_unref(client);
+}
+
+/**
+ * Release reference to client
+ * @param client  the client
+ */
+static void
+client_unref(struct sockif_client *client)
+{
+  if (--client->refcount == 0)
+    g_free(client);
+}
+
+/**
+ * Parse request packet and queue its actions. Nothing is queued if some
+ * of the actions are malformed.
+ *
+ * @param client  the client which sent the request
+ * @param packet  the request
+ * @param len     length of the request
+ *
+ * @return  0 if success, -1 if error
+ */
+static int
+request_handle(struct sockif_client *client, char *packet, int len)
+{
+  struct sockif_request req;
+  struct sockif_pending *pending;
+  struct action_data data[UINT8_MAX];
+  gint64 start = g_get_monotonic_time();
+  int offs, size, kind, i;
+  int success = TRUE;
+
+  if (len < sizeof(req))
+  {
+    reply_send(client, 0, -EINVAL);
+    return -1;
+  }
+
+  memcpy(&req, packet, sizeof(req));
+  offs = sizeof(req);
+
+  if (req.cmd <= sockif_unknown || req.cmd > sockif_batch ||
+      (req.cmd != sockif_batch && req.count != 1))
+  {
+    goto invalid;
+  }
+
+  for (i = 0;  i < req.count;  i++)
+  {
+    size = action_unpack(packet + offs, len - offs, &kind, &data[i]);
+
+    /* Actions of a single action request have the kind of the request */
+    if (size < 0 || (req.cmd != sockif_batch && kind != req.cmd))
+      goto invalid;
+
+    offs += size;
+  }
+
+  if (offs != len)
+    goto invalid;
+
+  if (priv.log)
+    log_info("control request %u: %u actions", req.id, req.count);
+
+  for (i = 0;  i < req.count;  i++)
+  {
+    if (queue_push(&data[i]) < 0)
+      success = FALSE;
+  }
+
+  pending = g_new(struct sockif_pending, 1);
+  pending->client = client;
+  pending->id = req.id;
+  client->refcount++;
+
+  queue_ack(reply_cb, pending, success, start);
+
+  return 0;
+
+invalid:
+  log_error("Malformed control request %u", req.id);
+  reply_send(client, req.id, -EINVAL);
+
+  return -1;
+}
+
+/**
+ * Queue acknowledgement callback: reply to request
+ * @param data     struct sockif_pending
+ * @param success  whether the actions were applied
+ */
+static void
+reply_cb(void *data, int success)
+{
+  struct sockif_pending *pending = data;
+
+  if (pending->client->fd >= 0)
+    reply_send(pending->client, pending->id, success ? 0 : -EIO);
+
+  client_unref(pending->client);
+  g_free(pending);
+}
+
+/**
+ * Send reply to client. A reply which can't be sent, as the client
+ * doesn't read them, isn't dropped silently: the connection is shut
+ * down, so the client gets end of file instead of waiting for it. The
+ * connection is closed by client_io_cb() then.
+ *
+ * @param client  the client
+ * @param id      request id
+ * @param status  0 or negative error code
+ */
+static void
+reply_send(struct sockif_client *client, uint32_t id, int32_t status)
+{
+  struct sockif_reply reply;
+
+  reply.id = id;
+  reply.status = status;
+
+  if (send(client->fd, &reply, sizeof(reply), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+  {
+    log_error("Can't reply to control request %u: %s, closing connection %d",
+              id, strerror(errno), client->fd);
+    shutdown(client->fd, SHUT_RDWR);
+  }
+}
+
+/** @} */
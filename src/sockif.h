@@ -0,0 +1,65 @@
+#ifndef SOCKIF_H
+#define SOCKIF_H
+
+#include <stdint.h>
+#include "options.h"
+
+/*
+ * Control socket protocol. Every request and reply is one packet of a
+ * SOCK_SEQPACKET connection, integers are in host byte order.
+ *
+ * Request:  struct sockif_request followed by 'count' actions, every
+ *           action is struct sockif_action followed by 'name_len' bytes
+ *           of name and 'value_len' bytes of value, not null terminated.
+ * Reply:    struct sockif_reply, sent when the actions are applied.
+ *           A client not reading its replies is disconnected when a
+ *           reply doesn't fit the socket buffer, so a request is always
+ *           replied or the connection ends.
+ */
+
+/** Request commands and action kinds */
+enum sockif_cmd {
+  sockif_unknown = 0,
+  /* route: "sink" or "source" and device */
+  sockif_route,
+  /* context: variable and value */
+  sockif_context,
+  /* user defined section: section name and entry */
+  sockif_section,
+  /* several actions of any kind applied as one decision */
+  sockif_batch
+};
+
+/** Request header */
+struct sockif_request {
+  /* echoed in the reply */
+  uint32_t id;
+  /* enum sockif_cmd */
+  uint8_t  cmd;
+  /* number of actions, 1 unless cmd is sockif_batch */
+  uint8_t  count;
+  uint16_t reserved;
+};
+
+/** Action header */
+struct sockif_action {
+  /* enum sockif_cmd, same as cmd of the request unless it's a batch */
+  uint8_t  kind;
+  uint8_t  name_len;
+  uint8_t  value_len;
+};
+
+/** Reply */
+struct sockif_reply {
+  uint32_t id;
+  /* 0 if applied, -EINVAL for malformed request, -EIO if failed */
+  int32_t  status;
+};
+
+#define SOCKIF_PACKET_MAX 4096
+
+int  sockif_init   (struct options *options);
+int  sockif_create (void);
+
+
+#endif  /* SOCKIF_H */
@@ -0,0 +1,257 @@
+/**
+ * @file stats.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement statistics.
+ * Decision latency, control element write latency of every sound card and
+ * rules executed and writes skipped per decision are kept in histograms,
+ * always. A histogram has 16 buckets for every power of two, like HDR
+ * histograms, so a sample is recorded with a few instructions and no
+ * memory allocation, and the percentiles are within 1/16 of the value.
+ * Every histogram is recorded by one thread, the writes of a card by its
+ * worker, so the counters are only atomic for the readers.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "logging.h"
+
+#include "stats.h"
+
+/* Sub-buckets for every power of two */
+#define SUB_BITS    4
+#define SUB_COUNT   (1 << SUB_BITS)
+
+/* Values up to 2^32 - 1, larger ones are counted as that */
+#define VALUE_MAX   UINT32_MAX
+#define BUCKETS     ((32 - SUB_BITS + 1) * SUB_COUNT)
+
+struct stats_hist {
+  char name[32];
+  atomic_ullong count;
+  atomic_ullong min;
+  atomic_ullong max;
+  atomic_uint buckets[BUCKETS];
+};
+
+enum stats_hist_id {
+  HIST_DECISION,
+  HIST_RULES,
+  HIST_SKIPPED,
+  HIST_WRITE,
+  HIST_MAX = HIST_WRITE + STATS_CARDS
+};
+
+/* Private structure */
+static struct {
+  struct stats_hist hists[HIST_MAX];
+} priv = {
+  .hists = {
+    [HIST_DECISION] = { .name = "decision_usec" },
+    [HIST_RULES]    = { .name = "rules_per_decision" },
+    [HIST_SKIPPED]  = { .name = "skipped_per_decision" }
+  }
+};
+
+
+static void     hist_record     (struct stats_hist *, uint64_t);
+static void     hist_summary    (struct stats_hist *, struct stats_summary *);
+static int      bucket_index    (uint64_t);
+static uint64_t bucket_highest  (int);
+static void     dump_cb         (const char *, const struct stats_summary *,
+                                 void *);
+
+
+/**
+ * Record latency of policy decision
+ * @param usec  time from receiving the decision to acknowledging it
+ */
+void
+stats_decision(uint64_t usec)
+{
+  hist_record(&priv.hists[HIST_DECISION], usec);
+}
+
+/**
+ * Record rules of policy decision
+ *
+ * @param rules    rules executed
+ * @param skipped  control element writes skipped, as the element had
+ *                 the value or was kept by a section of higher priority
+ */
+void
+stats_rules(int rules, int skipped)
+{
+  hist_record(&priv.hists[HIST_RULES], rules);
+  hist_record(&priv.hists[HIST_SKIPPED], skipped);
+}
+
+/**
+ * Record latency of control element write
+ *
+ * @param card_num  sound card number
+ * @param usec      time the write took
+ */
+void
+stats_write(int card_num, uint64_t usec)
+{
+  if (card_num >= 0 && card_num < STATS_CARDS)
+    hist_record(&priv.hists[HIST_WRITE + card_num], usec);
+}
+
+/**
+ * Call function for every histogram with samples
+ *
+ * @param cb    callback function
+ * @param data  data passed to the callback
+ */
+void
+stats_foreach(stats_cb cb, void *data)
+{
+  struct stats_summary summary;
+  struct stats_hist *hist;
+  int i;
+
+  for (i = 0;  i < HIST_MAX;  i++)
+  {
+    hist = &priv.hists[i];
+
+    if (!atomic_load_explicit(&hist->count, memory_order_relaxed))
+      continue;
+
+    if (!hist->name[0])
+    {
+      snprintf(hist->name, sizeof(hist->name), "card%d_write_usec",
+               i - HIST_WRITE);
+    }
+
+    hist_summary(hist, &summary);
+    cb(hist->name, &summary, data);
+  }
+}
+
+/**
+ * Log the histograms, e.g. on SIGUSR1
+ */
+void
+stats_dump()
+{
+  log_notice("statistics:   count      min      p50      p90      p99      max");
+  stats_foreach(dump_cb, NULL);
+}
+
+static void
+dump_cb(const char *name, const struct stats_summary *summary, void *data)
+{
+  log_notice("%-20s %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+             " %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT
+             " %8" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT,
+             name, summary->count, summary->min, summary->p50,
+             summary->p90, summary->p99, summary->max);
+}
+
+/**
+ * Add sample to histogram, called by the thread recording it only
+ *
+ * @param hist   the histogram
+ * @param value  the sample
+ */
+static void
+hist_record(struct stats_hist *hist, uint64_t value)
+{
+  uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+
+  if (value > VALUE_MAX)
+    value = VALUE_MAX;
+
+  if (!count ||
+      value < atomic_load_explicit(&hist->min, memory_order_relaxed))
+  {
+    atomic_store_explicit(&hist->min, value, memory_order_relaxed);
+  }
+
+  if (value > atomic_load_explicit(&hist->max, memory_order_relaxed))
+    atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+
+  atomic_fetch_add_explicit(&hist->buckets[bucket_index(value)], 1,
+                            memory_order_relaxed);
+  atomic_store_explicit(&hist->count, count + 1, memory_order_release);
+}
+
+/**
+ * Summarize histogram. The samples recorded meanwhile may be left out.
+ *
+ * @param hist     the histogram
+ * @param summary  pointer to return the summary
+ */
+static void
+hist_summary(struct stats_hist *hist, struct stats_summary *summary)
+{
+  static const int percentiles[] = { 50, 90, 99 };
+  uint64_t *values[] = { &summary->p50, &summary->p90, &summary->p99 };
+  uint64_t rank, count, seen = 0;
+  int i = 0, p;
+
+  summary->count = atomic_load_explicit(&hist->count, memory_order_acquire);
+  summary->min   = atomic_load_explicit(&hist->min, memory_order_relaxed);
+  summary->max   = atomic_load_explicit(&hist->max, memory_order_relaxed);
+
+  for (p = 0;  p < G_N_ELEMENTS(percentiles);  p++)
+  {
+    /* Rank of the sample at the percentile, the first one is 1 */
+    rank = (summary->count * percentiles[p] + 99) / 100;
+
+    /* seen is the samples in the buckets before bucket i */
+    for ( ;  i < BUCKETS;  i++)
+    {
+      count = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+
+      if (seen + count >= rank)
+        break;
+
+      seen += count;
+    }
+
+    *values[p] = i < BUCKETS ? MIN(bucket_highest(i), summary->max) :
+                               summary->max;
+  }
+}
+
+/**
+ * Get bucket of value. Values below SUB_COUNT have buckets of their own,
+ * the range of every larger power of two is split to SUB_COUNT buckets.
+ */
+static int
+bucket_index(uint64_t value)
+{
+  int bit;
+
+  if (value < SUB_COUNT)
+    return value;
+
+  bit = 63 - __builtin_clzll(value);
+
+  return (bit - SUB_BITS + 1) * SUB_COUNT +
+         (int)((value >> (bit - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/**
+ * Get the highest value of bucket
+ */
+static uint64_t
+bucket_highest(int index)
+{
+  int shift;
+
+  if (index < SUB_COUNT)
+    return index;
+
+  shift = index / SUB_COUNT - 1;
+
+  return (((uint64_t)(SUB_COUNT + index % SUB_COUNT) + 1) << shift) - 1;
+}
+
+/** @} */
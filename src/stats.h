@@ -0,0 +1,31 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* ALSA allows 32 sound cards */
+#define STATS_CARDS 32
+
+/** Summary of a histogram, the percentiles are within 1/16 */
+struct stats_summary {
+  uint64_t count;
+  uint64_t min;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t max;
+};
+
+/** Called for every histogram with samples */
+typedef void (*stats_cb) (const char *name,
+                          const struct stats_summary *summary,
+                          void *data);
+
+void stats_decision (uint64_t usec);
+void stats_rules    (int rules, int skipped);
+void stats_write    (int card_num, uint64_t usec);
+void stats_foreach  (stats_cb cb, void *data);
+void stats_dump     (void);
+
+
+#endif  /* STATS_H */
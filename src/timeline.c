@@ -0,0 +1,327 @@
+/**
+ * @file timeline.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement decision timeline.
+ * Every decision is written as an async span from queueing to
+ * acknowledgement. Its entries, the writes of the settings, suspends and
+ * outband executions are written as spans of the thread doing them, the
+ * main thread or the worker of a card, and the audio_actions signals as
+ * instant events. The file is a JSON array of trace events, one per line.
+ * It's closed at exit, but it can be loaded without the closing bracket.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "logging.h"
+
+#include "timeline.h"
+
+#define EVENT_SIZE 512
+
+/* Thread id and name, the name is written with the first event */
+static __thread pid_t timeline_tid;
+static __thread char timeline_name[32];
+
+/* Private structure */
+static struct {
+  int enabled;
+  FILE *file;
+  pthread_mutex_t lock;
+  unsigned int events;
+} priv = {
+  .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+
+static void   timeline_event  (const char *, char, const char *,
+                               int64_t, int64_t, unsigned int,
+                               const struct log_fields *);
+static void   timeline_write  (const char *);
+static void   timeline_flush  (void);
+static size_t json_escape     (char *, size_t, const char *);
+static void   timeline_close  (void);
+
+
+/**
+ * Open the timeline file, an existing file is truncated
+ *
+ * @param path  the file, NULL to not write a timeline
+ * @return      0 if success, -1 if error
+ */
+int
+timeline_open(const char *path)
+{
+  if (!path)
+    return 0;
+
+  if (!(priv.file = fopen(path, "we")))
+  {
+    log_error("Can't open timeline '%s': %s", path, strerror(errno));
+    return -1;
+  }
+
+  /* Loadable from the start, even if no decision is made */
+  fputs("[", priv.file);
+  fflush(priv.file);
+
+  priv.enabled = TRUE;
+  atexit(timeline_close);
+
+  log_info("Writing timeline to '%s'", path);
+
+  return 0;
+}
+
+/**
+ * Get start time of a span
+ * @return  monotonic time in microseconds, 0 if no timeline is written
+ */
+int64_t
+timeline_start()
+{
+  return priv.enabled ? g_get_monotonic_time() : 0;
+}
+
+/**
+ * Name the calling thread in the timeline
+ * @param name  the name
+ */
+void
+timeline_thread(const char *name)
+{
+  g_strlcpy(timeline_name, name, sizeof(timeline_name));
+}
+
+/**
+ * Write span of the calling thread, ending now. The spans of a thread
+ * are nested, so they are shown as a call stack.
+ *
+ * @param name    name of the span
+ * @param start   time from timeline_start()
+ * @param fields  rule the span is about, may be NULL
+ */
+void
+timeline_span(const char *name, int64_t start,
+              const struct log_fields *fields)
+{
+  if (start)
+    timeline_event(name, 'X', "alsaped", start,
+                   g_get_monotonic_time() - start, 0, fields);
+}
+
+/**
+ * Write async span, ending now. It's shown on a track of its own, so it
+ * may overlap the spans of the threads. The span ends a decision or an
+ * outband execution, so the file is flushed to have it complete on disk.
+ *
+ * @param name    name of the span, also the track
+ * @param id      span id, unique among the spans of the name
+ * @param start   time from timeline_start()
+ * @param fields  rule the span is about, may be NULL
+ */
+void
+timeline_async(const char *name, unsigned int id, int64_t start,
+               const struct log_fields *fields)
+{
+  if (!start)
+    return;
+
+  timeline_event(name, 'b', name, start, 0, id, fields);
+  timeline_event(name, 'e', name, g_get_monotonic_time(), 0, id, NULL);
+  timeline_flush();
+}
+
+/**
+ * Write instant event of the process
+ *
+ * @param name    name of the event
+ * @param fields  rule the event is about, may be NULL
+ */
+void
+timeline_instant(const char *name, const struct log_fields *fields)
+{
+  if (priv.enabled)
+    timeline_event(name, 'i', "alsaped", g_get_monotonic_time(), 0, 0,
+                   fields);
+}
+
+/**
+ * Format trace event with the txid of the calling thread and write it
+ *
+ * @param name    event name
+ * @param phase   event type, 'X', 'b', 'e' or 'i'
+ * @param cat     category, async spans are matched by it and the id
+ * @param ts      time in microseconds
+ * @param dur     duration of 'X' spans
+ * @param id      id of async spans
+ * @param fields  rule the event is about, may be NULL
+ */
+static void
+timeline_event(const char *name, char phase, const char *cat, int64_t ts,
+               int64_t dur, unsigned int id, const struct log_fields *fields)
+{
+  char event[EVENT_SIZE];
+  char escaped[64];
+  size_t len;
+
+  if (!timeline_tid)
+  {
+    timeline_tid = syscall(SYS_gettid);
+
+    if (!timeline_name[0])
+      g_strlcpy(timeline_name, "main", sizeof(timeline_name));
+
+    json_escape(escaped, sizeof(escaped), timeline_name);
+    snprintf(event, sizeof(event),
+             "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+             "\"args\":{\"name\":\"%s\"}}", getpid(), timeline_tid, escaped);
+    timeline_write(event);
+  }
+
+  json_escape(escaped, sizeof(escaped), name);
+  len = snprintf(event, sizeof(event),
+                 "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+                 "\"ts\":%lld,\"pid\":%d,\"tid\":%d",
+                 escaped, cat, phase, (long long)ts, getpid(), timeline_tid);
+
+  if (phase == 'X')
+    len += snprintf(event + len, sizeof(event) - len, ",\"dur\":%lld",
+                    (long long)dur);
+  else if (phase == 'i')
+    len += snprintf(event + len, sizeof(event) - len, ",\"s\":\"p\"");
+  else
+    len += snprintf(event + len, sizeof(event) - len, ",\"id\":%u", id);
+
+  len += snprintf(event + len, sizeof(event) - len, ",\"args\":{\"txid\":%u",
+                  log_get_txid());
+
+  if (fields && fields->line > 0)
+    len += snprintf(event + len, sizeof(event) - len, ",\"line\":%d",
+                    fields->line);
+
+  if (fields && fields->card >= 0)
+    len += snprintf(event + len, sizeof(event) - len, ",\"card\":%d",
+                    fields->card);
+
+  if (fields && fields->numid >= 0)
+    len += snprintf(event + len, sizeof(event) - len, ",\"numid\":%d",
+                    fields->numid);
+
+  if (fields && fields->entry)
+  {
+    json_escape(escaped, sizeof(escaped), fields->entry);
+    len += snprintf(event + len, sizeof(event) - len, ",\"entry\":\"%s\"",
+                    escaped);
+  }
+
+  snprintf(event + len, sizeof(event) - len, "}}");
+  timeline_write(event);
+}
+
+/**
+ * Append event to the file, events of the threads are serialized
+ * @param event  the event
+ */
+static void
+timeline_write(const char *event)
+{
+  pthread_mutex_lock(&priv.lock);
+
+  if (priv.file)
+  {
+    fputs(priv.events++ ? ",\n" : "\n", priv.file);
+    fputs(event, priv.file);
+  }
+
+  pthread_mutex_unlock(&priv.lock);
+}
+
+/**
+ * Write the buffered events to the file
+ */
+static void
+timeline_flush()
+{
+  pthread_mutex_lock(&priv.lock);
+
+  if (priv.file)
+    fflush(priv.file);
+
+  pthread_mutex_unlock(&priv.lock);
+}
+
+/**
+ * Copy string as the contents of a JSON string, truncated to fit
+ *
+ * @param buf   the buffer
+ * @param size  buffer size
+ * @param str   the string
+ *
+ * @return  length of the copy
+ */
+static size_t
+json_escape(char *buf, size_t size, const char *str)
+{
+  size_t len = 0;
+  unsigned char c;
+
+  for ( ;  (c = *str);  str++)
+  {
+    if (c == '"' || c == '\\')
+    {
+      if (len + 2 >= size)
+        break;
+
+      buf[len++] = '\\';
+      buf[len++] = c;
+    }
+    else if (c < 0x20)
+    {
+      if (len + 6 >= size)
+        break;
+
+      len += snprintf(buf + len, size - len, "\\u%04x", c);
+    }
+    else
+    {
+      if (len + 1 >= size)
+        break;
+
+      buf[len++] = c;
+    }
+  }
+
+  buf[len] = '\0';
+
+  return len;
+}
+
+/**
+ * Close the timeline at exit. The events of the threads still running
+ * are left out.
+ */
+static void
+timeline_close()
+{
+  pthread_mutex_lock(&priv.lock);
+
+  if (priv.file)
+  {
+    fputs("\n]\n", priv.file);
+    fclose(priv.file);
+    priv.file = NULL;
+  }
+
+  pthread_mutex_unlock(&priv.lock);
+}
+
+/** @} */
@@ -0,0 +1,26 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+
+#include "logging.h"
+
+/*
+ * Timeline of the policy decisions in the trace event format of Chrome,
+ * for chrome://tracing and Perfetto. Spans are written with the txid of
+ * the calling thread and the rule of the fields, if any. The start time
+ * of a span is taken with timeline_start(), which returns 0 if the
+ * timeline isn't written, and a span with start time 0 is left out.
+ */
+
+int     timeline_open    (const char *path);
+int64_t timeline_start   (void);
+void    timeline_thread  (const char *name);
+void    timeline_span    (const char *name, int64_t start,
+                          const struct log_fields *fields);
+void    timeline_async   (const char *name, unsigned int id, int64_t start,
+                          const struct log_fields *fields);
+void    timeline_instant (const char *name, const struct log_fields *fields);
+
+
+#endif  /* TIMELINE_H */
@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Static tracepoints of provider 'alsaped', see --with-sdt of configure.
+ * They are USDT probes, for perf, bpftrace, SystemTap and the userspace
+ * probes of LTTng. A probe is a nop instruction until a tracer attaches
+ * to it, and the arguments are plain integers, so they are not guarded.
+ * Without --with-sdt the probes and their arguments are compiled out.
+ *
+ * actions        (txid)
+ * status         (txid, status)
+ * rule           (txid, lineno, card, numid, value)
+ * ctl_read       (txid, card, numid)
+ * ctl_read_done  (txid, card, numid, value, ret)
+ * ctl_write      (txid, card, numid, value)
+ * ctl_write_done (txid, card, numid, ret)
+ * ctl_event      (txid, card, numid, mask)
+ *
+ * txid is the transaction id of the decision being applied, 0 if none.
+ */
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define trace(name, ...) STAP_PROBEV(alsaped, name, __VA_ARGS__)
+#else
+#define trace(name, ...) do { } while (0)
+#endif
+
+
+#endif  /* TRACE_H */
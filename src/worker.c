@@ -0,0 +1,817 @@
+/**
+ * @file worker.c
+ * @copyright GNU GPLv2 or later
+ *
+ * ALSA Policy Enforcement worker threads.
+ * Optionally the control element writes and suspends are applied by
+ * threads of their own, one for each sound card, so a slow codec doesn't
+ * hold up the main loop, D-Bus handling or the writes to other cards. The
+ * main loop is the only producer of the command ring of a worker and the
+ * worker is the only consumer, so the rings are lock-free. Workers post
+ * completions back through rings of their own and wake the main loop with
+ * an eventfd. When a ring is full, its producer sleeps until the consumer
+ * takes an entry.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "logging.h"
+#include "alsaif.h"
+#include "stats.h"
+#include "timeline.h"
+
+#include "worker.h"
+
+#define RING_SIZE 256
+#define RING_MASK (RING_SIZE - 1)
+
+/* ALSA allows 32 sound cards */
+#define WORKER_CARDS 32
+
+enum worker_cmd_type {
+  WORKER_WRITE,
+  WORKER_SUSPEND,
+  WORKER_BARRIER
+};
+
+/* Barrier shared by all the workers, owned by the main loop */
+struct worker_barrier {
+  worker_done_cb cb;
+  void *data;
+  int   success;
+  /* workers which haven't reached the barrier yet */
+  int   pending;
+  /* next one on the free list */
+  struct worker_barrier *next;
+};
+
+/* Suspend shared by all the workers */
+struct worker_sync {
+  pthread_barrier_t barrier;
+  atomic_int refs;
+  /* next one on the free list */
+  struct worker_sync *next;
+};
+
+/* Command for worker, completion for main loop */
+struct worker_cmd {
+  enum worker_cmd_type type;
+  /* decision the command belongs to, for logging and tracing */
+  uint32_t txid;
+  /* decision of the queue whose write it is, failed if the write fails */
+  unsigned int decision;
+  /* config file line of the rule */
+  int lineno;
+  /* the time of a write is added to it, if set */
+  atomic_ullong *usec;
+  union {
+    struct alsaif_write write;
+    struct {
+      useconds_t usec;
+      struct worker_sync *sync;
+    } suspend;
+    struct {
+      struct worker_barrier *barrier;
+    } barrier;
+  };
+};
+
+/* Single producer, single consumer ring */
+struct worker_ring {
+  atomic_uint head;
+  atomic_uint tail;
+  struct worker_cmd cmds[RING_SIZE];
+};
+
+/* Worker thread of a sound card */
+struct worker {
+  int card_num;
+  /* main loop -> worker */
+  struct worker_ring cmds;
+  /* worker -> main loop */
+  struct worker_ring done;
+  int kick_fd;
+  /* set by the main loop waiting for room in the command ring, which the
+   * worker then signals with space_fd */
+  atomic_int cmds_full;
+  int space_fd;
+  /* set by the worker waiting for room in the completion ring, which the
+   * main loop then signals with kick_fd */
+  atomic_int done_full;
+  pthread_t thread;
+  snd_ctl_t *ctl;
+};
+
+/* Private structure */
+static struct {
+  int enabled;
+  int log_rule_execution;
+  worker_fail_cb fail_cb;
+  /* workers indexed by card number */
+  struct worker *workers[WORKER_CARDS];
+  int workers_len;
+  int done_fd;
+  GIOChannel *done_chan;
+  /* barriers reached by all the workers, called from the main loop */
+  struct worker_barrier *ready;
+  struct worker_barrier **ready_tail;
+  /* barriers and suspends are reused, so a decision doesn't allocate
+   * memory */
+  struct worker_barrier *free_barriers;
+  struct worker_sync *free_syncs;
+} priv;
+
+
+static struct worker *worker_new   (int);
+static int      ring_push    (struct worker_ring *, struct worker_cmd *);
+static int      ring_pop     (struct worker_ring *, struct worker_cmd *);
+static void     worker_push  (struct worker *, struct worker_cmd *);
+static void     worker_wait  (struct worker *);
+static void     worker_post  (struct worker *, struct worker_cmd *);
+static void     worker_exec  (struct worker *, struct worker_cmd *);
+static void    *worker_main  (void *);
+static void     done_take    (void);
+static void     done_drain   (void);
+static gboolean done_io_cb   (GIOChannel *, GIOCondition, gpointer);
+
+
+/**
+ * Initialize worker options
+ * @param options  options parsed from command line
+ * @return         always zero
+ */
+int
+worker_init(struct options *options)
+{
+  priv.enabled = options->worker;
+  priv.log_rule_execution = options->log_rule_execution;
+  priv.done_fd = -1;
+  priv.ready_tail = &priv.ready;
+
+  return 0;
+}
+
+/**
+ * Start a worker thread for every sound card found by alsaif, if enabled.
+ * The cards added later get theirs from worker_add_card().
+ *
+ * @return  0 on success, -1 on error
+ */
+int
+worker_create()
+{
+  int nums[WORKER_CARDS];
+  GSource *source;
+  int count, i;
+
+  if (!priv.enabled || priv.done_fd >= 0)
+    return 0;
+
+  priv.done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (priv.done_fd < 0)
+  {
+    log_error("Can't create eventfd: %s", strerror(errno));
+    return -1;
+  }
+
+  priv.done_chan = g_io_channel_unix_new(priv.done_fd);
+  source = g_io_create_watch(priv.done_chan, G_IO_IN);
+
+  /* A source is blocked while dispatched, and unblocking it allocates
+   * memory for its fd, so the completions don't block it */
+  g_source_set_can_recurse(source, TRUE);
+  g_source_set_callback(source, (GSourceFunc)done_io_cb, NULL, NULL);
+
+  if (!g_source_attach(source, NULL))
+  {
+    log_error("Can't watch worker completions");
+    g_source_unref(source);
+    return -1;
+  }
+
+  g_source_unref(source);
+
+  count = alsaif_card_nums(nums, WORKER_CARDS);
+
+  for (i = 0;  i < count;  i++)
+  {
+    if (worker_add_card(nums[i]) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Start worker thread for sound card, if the workers are running and the
+ * card doesn't have one yet. The work queued before isn't waited for by
+ * the worker of the card.
+ *
+ * @param card_num  sound card number
+ * @return          0 on success, -1 on error
+ */
+int
+worker_add_card(int card_num)
+{
+  struct worker *worker;
+
+  if (priv.done_fd < 0 || card_num < 0 || card_num >= WORKER_CARDS ||
+      priv.workers[card_num])
+  {
+    return 0;
+  }
+
+  if (!(worker = worker_new(card_num)))
+    return -1;
+
+  priv.workers[card_num] = worker;
+  priv.workers_len++;
+
+  return 0;
+}
+
+/**
+ * Set callback for failed control element writes
+ * @param cb  callback function
+ */
+void
+worker_set_cb(worker_fail_cb cb)
+{
+  priv.fail_cb = cb;
+}
+
+/**
+ * Check if worker threads apply ALSA settings
+ * @return  TRUE or FALSE
+ */
+int
+worker_running()
+{
+  return priv.workers_len > 0;
+}
+
+/**
+ * Set ALSA control element value, on the worker thread of the card if it
+ * has one
+ *
+ * @param card_num  Sound card number
+ * @param numid     Control element numid
+ * @param value     Pointer to the value
+ * @param lineno    config file line of the rule
+ * @param usec      the time the write takes is added to it, may be NULL
+ * @param decision  passed to the fail callback if a queued write fails
+ *
+ * @return  -1 if error, 0 if success or queued
+ */
+int
+worker_set_value(int card_num, int numid, long *value, int lineno,
+                 atomic_ullong *usec, unsigned int decision)
+{
+  struct log_fields fields = { lineno, card_num, numid, NULL };
+  struct worker_cmd cmd;
+  gint64 start, span, time;
+  int ret;
+
+  if (card_num < 0 || card_num >= WORKER_CARDS || !priv.workers[card_num])
+  {
+    span = timeline_start();
+    start = g_get_monotonic_time();
+    ret = alsaif_set_value(card_num, numid, value);
+    time = g_get_monotonic_time() - start;
+
+    if (numid != -1)
+    {
+      stats_write(card_num, time);
+      timeline_span("write", span, &fields);
+    }
+
+    if (usec)
+      atomic_fetch_add_explicit(usec, time, memory_order_relaxed);
+
+    return ret;
+  }
+
+  ret = alsaif_write_prepare(card_num, numid, value, &cmd.write);
+
+  if (ret != 0)
+    return ret < 0 ? -1 : 0;
+
+  cmd.type = WORKER_WRITE;
+  cmd.txid = log_get_txid();
+  cmd.lineno = lineno;
+  cmd.usec = usec;
+  cmd.decision = decision;
+  worker_push(priv.workers[card_num], &cmd);
+
+  return 0;
+}
+
+/**
+ * Queue suspend of the worker threads. All the workers first wait for
+ * each other, so the writes queued before the suspend are applied on all
+ * the cards before the suspend starts.
+ *
+ * @param usec    delay time in microseconds
+ * @param lineno  config file line number of the rule
+ *
+ * @return  0 on success, -1 if the workers are not running
+ */
+int
+worker_suspend(useconds_t usec, int lineno)
+{
+  struct worker_cmd cmd;
+  struct worker_sync *sync;
+  int i;
+
+  if (!priv.workers_len)
+  {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  if ((sync = priv.free_syncs) != NULL)
+    priv.free_syncs = sync->next;
+  else
+    sync = g_new0(struct worker_sync, 1);
+
+  pthread_barrier_init(&sync->barrier, NULL, priv.workers_len);
+  atomic_init(&sync->refs, priv.workers_len);
+
+  cmd.type = WORKER_SUSPEND;
+  cmd.txid = log_get_txid();
+  cmd.suspend.usec = usec;
+  cmd.lineno = lineno;
+  cmd.suspend.sync = sync;
+
+  for (i = 0;  i < WORKER_CARDS;  i++)
+  {
+    if (priv.workers[i])
+      worker_push(priv.workers[i], &cmd);
+  }
+
+  return 0;
+}
+
+/**
+ * Call function from the main loop when the work queued so far is applied
+ * on all the cards. The function is called right away if the workers are
+ * not running.
+ *
+ * @param cb       callback function
+ * @param data     data passed to the callback
+ * @param success  passed to the callback
+ *
+ * @return  0 on success, -1 on error
+ */
+int
+worker_barrier(worker_done_cb cb, void *data, int success)
+{
+  struct worker_cmd cmd;
+  struct worker_barrier *barrier;
+  int i;
+
+  if (!cb)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!priv.workers_len)
+  {
+    cb(data, success);
+    return 0;
+  }
+
+  if ((barrier = priv.free_barriers) != NULL)
+    priv.free_barriers = barrier->next;
+  else
+    barrier = g_new0(struct worker_barrier, 1);
+
+  barrier->cb = cb;
+  barrier->data = data;
+  barrier->success = success;
+  barrier->pending = priv.workers_len;
+
+  cmd.type = WORKER_BARRIER;
+  cmd.txid = log_get_txid();
+  cmd.lineno = 0;
+  cmd.barrier.barrier = barrier;
+
+  for (i = 0;  i < WORKER_CARDS;  i++)
+  {
+    if (priv.workers[i])
+      worker_push(priv.workers[i], &cmd);
+  }
+
+  return 0;
+}
+
+/**
+ * Create worker thread of a sound card
+ * @param card_num  sound card number
+ * @return          worker instance or NULL on error
+ */
+static struct worker *
+worker_new(int card_num)
+{
+  struct worker *worker;
+  int ret;
+
+  worker = g_new0(struct worker, 1);
+  worker->card_num = card_num;
+  worker->kick_fd = eventfd(0, EFD_CLOEXEC);
+
+  worker->space_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (worker->kick_fd < 0 || worker->space_fd < 0)
+  {
+    log_error("Can't create eventfd: %s", strerror(errno));
+
+    if (worker->kick_fd >= 0)
+      close(worker->kick_fd);
+
+    g_free(worker);
+    return NULL;
+  }
+
+  ret = pthread_create(&worker->thread, NULL, worker_main, worker);
+
+  if (ret)
+  {
+    log_error("Can't create worker thread for card %d: %s",
+              card_num, strerror(ret));
+    close(worker->kick_fd);
+    close(worker->space_fd);
+    g_free(worker);
+    errno = ret;
+    return NULL;
+  }
+
+  pthread_detach(worker->thread);
+
+  return worker;
+}
+
+/**
+ * Add command to ring, called by the producer only
+ * @return  0 on success, -1 if the ring is full
+ */
+static int
+ring_push(struct worker_ring *ring, struct worker_cmd *cmd)
+{
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (head - tail == RING_SIZE)
+    return -1;
+
+  ring->cmds[head & RING_MASK] = *cmd;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+  return 0;
+}
+
+/**
+ * Take command from ring, called by the consumer only
+ * @return  0 on success, -1 if the ring is empty
+ */
+static int
+ring_pop(struct worker_ring *ring, struct worker_cmd *cmd)
+{
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  if (head == tail)
+    return -1;
+
+  *cmd = ring->cmds[tail & RING_MASK];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+  return 0;
+}
+
+/**
+ * Pass command to worker thread. If the ring is full, wait for the
+ * worker to take a command.
+ */
+static void
+worker_push(struct worker *worker, struct worker_cmd *cmd)
+{
+  uint64_t one = 1;
+  int waited = FALSE;
+
+  while (ring_push(&worker->cmds, cmd) < 0)
+  {
+    worker_wait(worker);
+    waited = TRUE;
+  }
+
+  while (write(worker->kick_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+
+  /* The barriers reached meanwhile are left to the main loop */
+  if (waited && priv.ready)
+  {
+    while (write(priv.done_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+      ;
+  }
+}
+
+/**
+ * Sleep until the worker takes a command from its full ring. The
+ * completions are taken meanwhile, so the worker doesn't wait for the
+ * main loop, but the barrier callbacks aren't called from here.
+ *
+ * @param worker  the worker
+ */
+static void
+worker_wait(struct worker *worker)
+{
+  struct pollfd fds[2] = {
+    { worker->space_fd, POLLIN, 0 },
+    { priv.done_fd, POLLIN, 0 }
+  };
+  struct worker_ring *ring = &worker->cmds;
+  uint64_t count;
+
+  atomic_store_explicit(&worker->cmds_full, TRUE, memory_order_relaxed);
+
+  /* Pairs with the fence of the worker, one of us sees the other */
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (atomic_load_explicit(&ring->head, memory_order_relaxed) -
+      atomic_load_explicit(&ring->tail, memory_order_acquire) == RING_SIZE)
+  {
+    while (poll(fds, 2, -1) < 0 && errno == EINTR)
+      ;
+
+    if (fds[0].revents & POLLIN)
+      while (read(worker->space_fd, &count, sizeof(count)) < 0 &&
+             errno == EINTR)
+        ;
+
+    if (fds[1].revents & POLLIN)
+    {
+      while (read(priv.done_fd, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+
+      done_take();
+    }
+  }
+
+  atomic_store_explicit(&worker->cmds_full, FALSE, memory_order_relaxed);
+}
+
+/**
+ * Pass completion of worker to the main loop. If the ring is full, wait
+ * for the main loop to take a completion.
+ */
+static void
+worker_post(struct worker *worker, struct worker_cmd *cmd)
+{
+  uint64_t one = 1;
+  uint64_t count;
+
+  while (ring_push(&worker->done, cmd) < 0)
+  {
+    atomic_store_explicit(&worker->done_full, TRUE, memory_order_relaxed);
+
+    /* Pairs with the fence of done_take(), one of us sees the other */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (ring_push(&worker->done, cmd) == 0)
+    {
+      atomic_store_explicit(&worker->done_full, FALSE, memory_order_relaxed);
+      break;
+    }
+
+    /* Commands queued meanwhile are taken after the completion */
+    while (read(worker->kick_fd, &count, sizeof(count)) < 0 &&
+           errno == EINTR)
+      ;
+
+    atomic_store_explicit(&worker->done_full, FALSE, memory_order_relaxed);
+  }
+
+  while (write(priv.done_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+}
+
+/**
+ * Execute command on worker thread
+ */
+static void
+worker_exec(struct worker *worker, struct worker_cmd *cmd)
+{
+  struct log_fields fields = { cmd->lineno, worker->card_num, -1, NULL };
+  struct worker_sync *sync;
+  gint64 start, span, time;
+  int result;
+
+  log_set_txid(cmd->txid);
+
+  switch (cmd->type)
+  {
+    case WORKER_WRITE:
+      span = timeline_start();
+      start = g_get_monotonic_time();
+      result = alsaif_write_apply(&worker->ctl, &cmd->write);
+      time = g_get_monotonic_time() - start;
+      stats_write(worker->card_num, time);
+
+      fields.numid = cmd->write.numid;
+      timeline_span("write", span, &fields);
+
+      if (cmd->usec)
+        atomic_fetch_add_explicit(cmd->usec, time, memory_order_relaxed);
+
+      if (result < 0)
+        worker_post(worker, cmd);
+      break;
+
+    case WORKER_SUSPEND:
+      span = timeline_start();
+      sync = cmd->suspend.sync;
+
+      if (pthread_barrier_wait(&sync->barrier) ==
+          PTHREAD_BARRIER_SERIAL_THREAD && priv.log_rule_execution)
+      {
+        log_info("suspend execution for %u msec (line %d)",
+                 cmd->suspend.usec / 1000, cmd->lineno);
+      }
+
+      /* The last one out gives it back to the main loop for reuse */
+      if (atomic_fetch_sub(&sync->refs, 1) == 1)
+      {
+        pthread_barrier_destroy(&sync->barrier);
+        worker_post(worker, cmd);
+      }
+
+      do
+        result = usleep(cmd->suspend.usec);
+      while (result < 0 && errno == EINTR);
+
+      /* Waiting for the other workers is a part of the suspend */
+      timeline_span("suspend", span, &fields);
+      break;
+
+    case WORKER_BARRIER:
+      worker_post(worker, cmd);
+      break;
+  }
+}
+
+/**
+ * Worker thread: apply commands until the ring is empty, then wait
+ */
+static void *
+worker_main(void *arg)
+{
+  struct worker *worker = arg;
+  struct worker_cmd cmd;
+  char name[16];
+  uint64_t one = 1;
+  uint64_t count;
+
+  snprintf(name, sizeof(name), "card %d", worker->card_num);
+  timeline_thread(name);
+
+  for (;;)
+  {
+    while (ring_pop(&worker->cmds, &cmd) == 0)
+    {
+      /* Pairs with the fence of worker_wait() */
+      atomic_thread_fence(memory_order_seq_cst);
+
+      if (atomic_load_explicit(&worker->cmds_full, memory_order_relaxed))
+      {
+        while (write(worker->space_fd, &one, sizeof(one)) < 0 &&
+               errno == EINTR)
+          ;
+      }
+
+      worker_exec(worker, &cmd);
+    }
+
+    while (read(worker->kick_fd, &count, sizeof(count)) < 0 &&
+           errno == EINTR)
+      ;
+  }
+
+  return NULL;
+}
+
+/**
+ * Take the completions posted by the workers. The barriers reached by
+ * all the workers are put on the ready list, and the suspends they are
+ * all done with on the free list.
+ */
+static void
+done_take()
+{
+  struct worker_barrier *barrier;
+  struct worker_sync *sync;
+  struct worker *worker;
+  struct worker_cmd cmd;
+  uint64_t one = 1;
+  int i;
+
+  for (i = 0;  i < WORKER_CARDS;  i++)
+  {
+    if (!(worker = priv.workers[i]))
+      continue;
+
+    while (ring_pop(&worker->done, &cmd) == 0)
+    {
+      switch (cmd.type)
+      {
+        case WORKER_WRITE:
+          if (priv.fail_cb)
+            priv.fail_cb(cmd.write.card_num, cmd.write.numid, cmd.lineno,
+                         cmd.decision);
+          break;
+
+        case WORKER_BARRIER:
+          barrier = cmd.barrier.barrier;
+
+          if (--barrier->pending == 0)
+          {
+            barrier->next = NULL;
+            *priv.ready_tail = barrier;
+            priv.ready_tail = &barrier->next;
+          }
+          break;
+
+        case WORKER_SUSPEND:
+          sync = cmd.suspend.sync;
+          sync->next = priv.free_syncs;
+          priv.free_syncs = sync;
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    /* Pairs with the fence of worker_post() */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&worker->done_full, memory_order_relaxed))
+    {
+      while (write(worker->kick_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+    }
+  }
+}
+
+/**
+ * Handle the completions posted by the workers. The callback of a barrier
+ * is called when all the workers have reached it.
+ */
+static void
+done_drain()
+{
+  struct worker_barrier *barrier;
+
+  done_take();
+
+  /* The callbacks may queue more work, and barriers */
+  while ((barrier = priv.ready) != NULL)
+  {
+    if (!(priv.ready = barrier->next))
+      priv.ready_tail = &priv.ready;
+
+    barrier->cb(barrier->data, barrier->success);
+    barrier->next = priv.free_barriers;
+    priv.free_barriers = barrier;
+  }
+}
+
+/**
+ * Worker completion eventfd handler
+ */
+static gboolean
+done_io_cb(GIOChannel *chan, GIOCondition cond, gpointer data)
+{
+  uint64_t count;
+
+  while (read(priv.done_fd, &count, sizeof(count)) < 0 && errno == EINTR)
+    ;
+
+  done_drain();
+
+  return TRUE;
+}
+
+/** @} */
@@ -0,0 +1,26 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <unistd.h>
+#include <stdatomic.h>
+#include "options.h"
+
+/** Called from the main loop when the work queued before is applied */
+typedef void (*worker_done_cb) (void *data, int success);
+
+/** Called from the main loop when a control element write failed */
+typedef void (*worker_fail_cb) (int card_num, int numid, int lineno,
+                                unsigned int decision);
+
+int  worker_init      (struct options *options);
+int  worker_create    (void);
+int  worker_add_card  (int card_num);
+void worker_set_cb    (worker_fail_cb cb);
+int  worker_running   (void);
+int  worker_set_value (int card_num, int numid, long *value, int lineno,
+                       atomic_ullong *usec, unsigned int decision);
+int  worker_suspend   (useconds_t usec, int lineno);
+int  worker_barrier   (worker_done_cb cb, void *data, int success);
+
+
+#endif  /* WORKER_H */
@@ -0,0 +1,277 @@
+/**
+ * @file action-parse.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Unit tests of the audio_actions signal parser of dbusif.c: the
+ * arguments of an action, and the actions of a signal. dbusif.c is
+ * compiled in to reach its static functions; the parsed actions are
+ * recorded instead of queued, by tests/stubs.c.
+ *
+ * @{ */
+
+#include "../src/dbusif.c"
+
+#include "bench.h"
+#include "test.h"
+
+
+static DBusMessage *args_msg_new       (const char *, int, const void *,
+                                        const char *, int, const void *);
+static int          parse_args         (DBusMessage *, struct argdsc *,
+                                        void *, int);
+static void         handle             (DBusMessage *);
+static void         test_action_parser (void);
+static void         test_action_types  (void);
+static void         test_handle_action (void);
+
+
+int
+main(int argc, char **argv)
+{
+  struct options options;
+
+  /* Errors of the invalid signals are expected, they are not logged */
+  memset(&options, 0, sizeof(options));
+
+  if (log_init(&options) < 0 || dbusif_init(&options) < 0)
+  {
+    fputs("Initialization failed\n", stderr);
+    return 1;
+  }
+
+  test_action_parser();
+  test_action_types();
+  test_handle_action();
+
+  return test_report();
+}
+
+/**
+ * Build message of a(sv) action arguments, of up to two arguments
+ *
+ * @param name1   name of the first argument, NULL for none
+ * @param type1   D-Bus type of its value, string or uint32
+ * @param value1  pointer to the value
+ * @param name2   second argument, like the first one
+ *
+ * @return  the message
+ */
+static DBusMessage *
+args_msg_new(const char *name1, int type1, const void *value1,
+             const char *name2, int type2, const void *value2)
+{
+  DBusMessage *msg;
+  DBusMessageIter msgit, cmdit;
+
+  msg = dbus_message_new_signal(POLICY_DBUS_PDPATH, POLICY_DBUS_INTERFACE,
+                                POLICY_ACTIONS);
+
+  dbus_message_iter_init_append(msg, &msgit);
+  dbus_message_iter_open_container(&msgit, DBUS_TYPE_ARRAY, "(sv)", &cmdit);
+
+  if (name1)
+    bench_append_arg(&cmdit, name1, type1, value1);
+
+  if (name2)
+    bench_append_arg(&cmdit, name2, type2, value2);
+
+  dbus_message_iter_close_container(&msgit, &cmdit);
+
+  return msg;
+}
+
+/**
+ * Parse arguments of args_msg_new() message
+ * @return  return value of action_parser()
+ */
+static int
+parse_args(DBusMessage *msg, struct argdsc *descs, void *args, int len)
+{
+  DBusMessageIter msgit;
+
+  dbus_message_iter_init(msg, &msgit);
+
+  return action_parser(&msgit, descs, args, len);
+}
+
+/**
+ * Handle signal, forgetting the actions of the previous one
+ * @param msg  the signal, it's unreferenced
+ */
+static void
+handle(DBusMessage *msg)
+{
+  test_queue_reset();
+
+  handle_action_message(msg);
+  dbus_message_unref(msg);
+}
+
+static void
+test_action_parser()
+{
+  static const char *sink = "sink";
+  static const char *ihf = "ihf";
+  static const char *headset = "headset";
+  static const dbus_uint32_t one = 1;
+  struct argrt args;
+  DBusMessage *msg;
+
+  msg = args_msg_new("type", DBUS_TYPE_STRING, &sink,
+                     "device", DBUS_TYPE_STRING, &ihf);
+  check(parse_args(msg, route_args, &args, sizeof(args)));
+  check_str(args.type, "sink");
+  check_str(args.device, "ihf");
+
+  /* Offset of device is out of a buffer of one pointer */
+  check(!parse_args(msg, route_args, &args, sizeof(args.type)));
+  dbus_message_unref(msg);
+
+  /* Arguments may be in any order */
+  msg = args_msg_new("device", DBUS_TYPE_STRING, &ihf,
+                     "type", DBUS_TYPE_STRING, &sink);
+  check(parse_args(msg, route_args, &args, sizeof(args)));
+  check_str(args.type, "sink");
+  check_str(args.device, "ihf");
+  dbus_message_unref(msg);
+
+  /* Later value of an argument replaces the earlier one */
+  msg = args_msg_new("device", DBUS_TYPE_STRING, &ihf,
+                     "device", DBUS_TYPE_STRING, &headset);
+  check(parse_args(msg, route_args, &args, sizeof(args)));
+  check(args.type == NULL);
+  check_str(args.device, "headset");
+  dbus_message_unref(msg);
+
+  /* Unknown arguments are ignored, whatever their type */
+  msg = args_msg_new("volume", DBUS_TYPE_UINT32, &one,
+                     "type", DBUS_TYPE_STRING, &sink);
+  check(parse_args(msg, route_args, &args, sizeof(args)));
+  check_str(args.type, "sink");
+  check(args.device == NULL);
+  dbus_message_unref(msg);
+
+  /* Values of known arguments have to be strings */
+  msg = args_msg_new("type", DBUS_TYPE_STRING, &sink,
+                     "device", DBUS_TYPE_UINT32, &one);
+  check(!parse_args(msg, route_args, &args, sizeof(args)));
+  dbus_message_unref(msg);
+
+  /* Actions have arguments */
+  msg = args_msg_new(NULL, 0, NULL, NULL, 0, NULL);
+  check(!parse_args(msg, route_args, &args, sizeof(args)));
+  dbus_message_unref(msg);
+}
+
+static void
+test_action_types()
+{
+  static const char *call = "call";
+  static const char *active = "active";
+  static const char *mode = "mode";
+  static const char *loud = "loud";
+  struct argctx ctx;
+  struct argsec sec;
+  struct argrt rt;
+  DBusMessage *msg;
+
+  msg = args_msg_new("variable", DBUS_TYPE_STRING, &call,
+                     "value", DBUS_TYPE_STRING, &active);
+  check(parse_args(msg, context_args, &ctx, sizeof(ctx)));
+  check_str(ctx.variable, "call");
+  check_str(ctx.value, "active");
+
+  /* Arguments of other actions are not known */
+  check(parse_args(msg, route_args, &rt, sizeof(rt)));
+  check(rt.type == NULL && rt.device == NULL);
+  dbus_message_unref(msg);
+
+  msg = args_msg_new("section", DBUS_TYPE_STRING, &mode,
+                     "entry", DBUS_TYPE_STRING, &loud);
+  check(parse_args(msg, section_args, &sec, sizeof(sec)));
+  check_str(sec.section, "mode");
+  check_str(sec.entry, "loud");
+  dbus_message_unref(msg);
+}
+
+static void
+test_handle_action()
+{
+  static const struct bench_action call[] = {
+    { "com.nokia.policy.audio_route",
+      { "type", "sink", "device", "ihf" } },
+    { "com.nokia.policy.context",
+      { "variable", "call", "value", "active" } },
+    { "com.nokia.policy.section",
+      { "section", "mode", "entry", "loud" } },
+  };
+  static const struct bench_action unknown[] = {
+    { "com.nokia.policy.volume_limit",
+      { "group", "player", "limit", "50" } },
+    { "com.nokia.policy.audio_route",
+      { "type", "source", "device", "microphone" } },
+  };
+  static const struct bench_action missing[] = {
+    { "com.nokia.policy.audio_route",
+      { "type", "sink" } },
+  };
+  static const struct bench_action invalid[] = {
+    { "com.nokia.policy.audio_route",
+      { "type", "speaker", "device", "ihf" } },
+  };
+  static const struct bench_action no_section[] = {
+    { "com.nokia.policy.section",
+      { "section", "none", "entry", "loud" } },
+  };
+  static const dbus_uint32_t txid = 7;
+  DBusMessage *msg;
+
+  /* Actions of every type are queued and the decision acknowledged */
+  handle(bench_actions_new(42, call, G_N_ELEMENTS(call)));
+  check(test_queue.pushed_len == 3);
+  check(test_queue.pushed[0].rule_type == rule_sink);
+  check(test_queue.pushed[1].rule_type == rule_context);
+  check(test_queue.pushed[2].rule_type == rule_max);
+  check(test_queue.acks == 1 && test_queue.ack_success == TRUE);
+  check(test_queue.ack_txid == 42);
+
+  /* Actions of other enforcement points are ignored */
+  handle(bench_actions_new(1, unknown, G_N_ELEMENTS(unknown)));
+  check(test_queue.pushed_len == 1);
+  check(test_queue.pushed[0].rule_type == rule_source);
+  check(test_queue.acks == 1 && test_queue.ack_success == TRUE);
+
+  /* Decisions with invalid actions fail */
+  handle(bench_actions_new(1, missing, G_N_ELEMENTS(missing)));
+  check(test_queue.pushed_len == 0);
+  check(test_queue.acks == 1 && test_queue.ack_success == FALSE);
+
+  handle(bench_actions_new(1, invalid, G_N_ELEMENTS(invalid)));
+  check(test_queue.pushed_len == 0);
+  check(test_queue.acks == 1 && test_queue.ack_success == FALSE);
+
+  handle(bench_actions_new(1, no_section, G_N_ELEMENTS(no_section)));
+  check(test_queue.pushed_len == 0);
+  check(test_queue.acks == 1 && test_queue.ack_success == FALSE);
+
+  /* Decision without actions fails, but it's acknowledged */
+  handle(bench_actions_new(3, NULL, 0));
+  check(test_queue.acks == 1 && test_queue.ack_success == FALSE);
+  check(test_queue.ack_txid == 3);
+
+  msg = dbus_message_new_signal(POLICY_DBUS_PDPATH "/" POLICY_DECISION,
+                                POLICY_DBUS_INTERFACE, POLICY_ACTIONS);
+  dbus_message_append_args(msg, DBUS_TYPE_UINT32, &txid, DBUS_TYPE_INVALID);
+  handle(msg);
+  check(test_queue.acks == 1 && test_queue.ack_success == FALSE);
+  check(test_queue.ack_txid == 7);
+
+  /* Signal without transaction id is not acknowledged */
+  msg = dbus_message_new_signal(POLICY_DBUS_PDPATH "/" POLICY_DECISION,
+                                POLICY_DBUS_INTERFACE, POLICY_ACTIONS);
+  handle(msg);
+  check(test_queue.pushed_len == 0);
+  check(test_queue.acks == 0);
+}
+
+/** @} */
@@ -0,0 +1,339 @@
+/**
+ * @file alloc-count.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Check that handling an audio_actions signal doesn't allocate memory
+ * once the daemon is warmed up. Every signal is a new message, built as
+ * it would be received from the bus. It's parsed by dbusif.c, or by
+ * gdbusif.c with ALLOC_GDBUS, the actions are queued and executed against
+ * the configuration in alloc-count.conf, and the writes go to a fake
+ * sound card through its worker thread. The heap allocations are counted
+ * by wrapping malloc() and friends.
+ *
+ * @{ */
+
+/* The acknowledgements are counted, so the test waits for them */
+#define queue_ack test_queue_ack
+
+#ifdef ALLOC_GDBUS
+#include "../src/gdbusif.c"
+#else
+#include "../src/dbusif.c"
+#endif
+
+#undef queue_ack
+
+/* queue.h was included with the name replaced */
+int queue_ack(queue_ack_cb cb, void *data, int success, int64_t start);
+
+#include <dbus/dbus.h>
+
+#include "alsaif.h"
+#include "config.h"
+#include "queue.h"
+#include "worker.h"
+
+#include "bench.h"
+
+#define TEST_ITERATIONS 1000
+#define TEST_WARMUP     10
+
+/* Implemented by glibc, used by the wrappers below */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/* Actions of the two messages, the test switches between them */
+static const struct bench_action test_actions[2][3] = {
+  {
+    { "com.nokia.policy.audio_route",
+      { "type", "sink", "device", "ihf" } },
+    { "com.nokia.policy.context",
+      { "variable", "call", "value", "active" } },
+    { "com.nokia.policy.section",
+      { "section", "mode", "entry", "loud" } },
+  },
+  {
+    { "com.nokia.policy.audio_route",
+      { "type", "sink", "device", "headset" } },
+    { "com.nokia.policy.context",
+      { "variable", "call", "value", "inactive" } },
+    { "com.nokia.policy.section",
+      { "section", "mode", "entry", "quiet" } },
+  },
+};
+
+#define TEST_ACTIONS (sizeof(test_actions[0]) / sizeof(test_actions[0][0]))
+
+/* Control elements of the fake sound card, numid is index + 1 */
+static const char *test_elems[] = { "Volume", "Headset Volume", "Switch" };
+
+#define TEST_ELEMS (sizeof(test_elems) / sizeof(test_elems[0]))
+
+#ifdef ALLOC_GDBUS
+typedef GDBusMessage test_msg;
+#else
+typedef DBusMessage test_msg;
+#endif
+
+static struct {
+  alsaif_event_cb event_cb;
+  value_descriptor descriptor;
+  long values[TEST_ELEMS + 1];
+  int writes;
+  /* acknowledgements not called yet */
+  int pending;
+  int counting;
+  int allocs;
+} test;
+
+
+void *
+malloc(size_t size)
+{
+  if (test.counting)
+    test.allocs++;
+
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+  if (test.counting)
+    test.allocs++;
+
+  return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  if (test.counting)
+    test.allocs++;
+
+  return __libc_realloc(ptr, size);
+}
+
+/* Fake sound card */
+
+void
+alsaif_set_cb(alsaif_event_cb cb)
+{
+  test.event_cb = cb;
+}
+
+int
+alsaif_card_nums(int *nums, int len)
+{
+  nums[0] = 0;
+  return 1;
+}
+
+snd_ctl_elem_type_t
+alsaif_get_value_descriptor(int cardnum, int numid,
+                            value_descriptor **descriptor)
+{
+  /* The values of the config are in 0 - 100 */
+  test.descriptor.int_t.max = 100;
+  test.descriptor.int_t.step = 1;
+  *descriptor = &test.descriptor;
+  return SND_CTL_ELEM_TYPE_INTEGER;
+}
+
+int
+alsaif_get_value(int cardnum, int numid, long *value)
+{
+  *value = test.values[numid];
+  return 0;
+}
+
+int
+alsaif_set_value(int cardnum, int numid, long *value)
+{
+  test.values[numid] = *value;
+  test.writes++;
+  return 0;
+}
+
+int
+alsaif_write_prepare(int cardnum, int numid, long *value,
+                     struct alsaif_write *write)
+{
+  return alsaif_set_value(cardnum, numid, value);
+}
+
+int
+alsaif_write_apply(snd_ctl_t **ctl, struct alsaif_write *write)
+{
+  return 0;
+}
+
+/* Decision queue, the status signal isn't sent as the txid is 0 */
+
+static void
+test_ack_cb(void *data, int success)
+{
+  test.pending--;
+}
+
+int
+test_queue_ack(queue_ack_cb cb, void *data, int success, int64_t start)
+{
+  test.pending++;
+  return queue_ack(test_ack_cb, data, success, start);
+}
+
+/**
+ * Report the fake sound card and its control elements
+ */
+static void
+test_card_add()
+{
+  alsaif_event event;
+  unsigned i;
+
+  memset(&event, 0, sizeof(event));
+  event.type = EVENT_SOUNDCARD_ADDED;
+  event.card.id = "Test";
+  event.card.name = "Test Card";
+  test.event_cb(&event);
+
+  for (i = 0;  i < TEST_ELEMS;  i++)
+  {
+    memset(&event, 0, sizeof(event));
+    event.type = EVENT_CTL_ELEM_ADDED;
+    event.elem.ifname = "MIXER";
+    event.elem.name = (char *)test_elems[i];
+    event.elem.numid = i + 1;
+    test.event_cb(&event);
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.type = EVENT_CONTROLS_ADDED;
+  test.event_cb(&event);
+}
+
+/**
+ * Build audio_actions signal, as received from the bus. The transaction
+ * ID is 0, so no status signal is sent.
+ */
+static test_msg *
+test_msg_new(int n)
+{
+  DBusMessage *msg;
+
+  msg = bench_actions_new(0, test_actions[n], TEST_ACTIONS);
+
+#ifdef ALLOC_GDBUS
+  {
+    GDBusMessage *gmsg;
+    char *blob;
+    int len;
+
+    dbus_message_set_serial(msg, 1);
+    dbus_message_marshal(msg, &blob, &len);
+    gmsg = g_dbus_message_new_from_blob((guchar *)blob, len,
+                                        G_DBUS_CAPABILITY_FLAGS_NONE, NULL);
+    dbus_free(blob);
+    dbus_message_unref(msg);
+
+    return gmsg;
+  }
+#else
+  return msg;
+#endif
+}
+
+/**
+ * Handle the message and wait for the queued actions to be applied
+ */
+static void
+test_handle(test_msg *msg)
+{
+#ifdef ALLOC_GDBUS
+  handle_action_message(g_dbus_message_get_body(msg));
+#else
+  handle_action_message(msg);
+#endif
+
+  while (test.pending)
+    g_main_context_iteration(NULL, TRUE);
+
+  while (g_main_context_iteration(NULL, FALSE))
+    ;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct options options;
+  static test_msg *msg[TEST_ITERATIONS];
+  int i;
+
+  memset(&options, 0, sizeof(options));
+  options.config_path = SRCDIR "/tests/alloc-count.conf";
+  options.worker = TRUE;
+
+  if (log_init(&options) < 0     || config_init(&options) < 0 ||
+      control_init(&options) < 0 || queue_init(&options) < 0  ||
+      worker_init(&options) < 0  || dbusif_init(&options) < 0)
+  {
+    fputs("Initialization failed\n", stderr);
+    return 1;
+  }
+
+  control_set_cb();
+
+  if (config_parse() < 0 || control_compile() < 0)
+  {
+    fprintf(stderr, "Can't load %s\n", options.config_path);
+    return 1;
+  }
+
+  test_card_add();
+
+  if (worker_create() < 0)
+  {
+    fputs("Can't start the worker thread\n", stderr);
+    return 1;
+  }
+
+  /* Every message is handled once, as it would be received */
+  for (i = 0;  i < TEST_ITERATIONS;  i++)
+    msg[i] = test_msg_new(i & 1);
+
+  /* Every value is seen and every buffer is grown before counting */
+  for (i = 0;  i < TEST_WARMUP;  i++)
+    test_handle(msg[i]);
+
+  test.writes = 0;
+  test.counting = TRUE;
+
+  for (i = TEST_WARMUP;  i < TEST_ITERATIONS;  i++)
+    test_handle(msg[i]);
+
+  test.counting = FALSE;
+
+  printf("%d messages, %d writes, %d allocations\n",
+         TEST_ITERATIONS - TEST_WARMUP, test.writes, test.allocs);
+
+  for (i = 0;  i < TEST_ITERATIONS;  i++)
+  {
+#ifdef ALLOC_GDBUS
+    g_object_unref(msg[i]);
+#else
+    dbus_message_unref(msg[i]);
+#endif
+  }
+
+  if (test.writes < TEST_ITERATIONS - TEST_WARMUP)
+  {
+    fputs("The actions weren't applied\n", stderr);
+    return 1;
+  }
+
+  return test.allocs ? 1 : 0;
+}
+
+/** @} */
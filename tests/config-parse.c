@@ -0,0 +1,313 @@
+/**
+ * @file config-parse.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Unit tests of the config file parser: the line preprocessing and the
+ * parsers of [control] definitions and of the rules. config.c is
+ * compiled in to reach its static functions.
+ *
+ * @{ */
+
+#include "../src/config.c"
+
+#include "test.h"
+
+
+static void test_preprocess_buffer   (void);
+static void test_elemdef_parse       (void);
+static void test_ruldef_alsa_setting (void);
+static void test_ruldef_outband      (void);
+static void test_ruldef_suspend      (void);
+static void test_ruldef_deflt        (void);
+
+
+int
+main(int argc, char **argv)
+{
+  struct options options;
+
+  /* Errors of the invalid lines are expected, they are not logged */
+  memset(&options, 0, sizeof(options));
+  log_init(&options);
+
+  test_preprocess_buffer();
+  test_elemdef_parse();
+  test_ruldef_alsa_setting();
+  test_ruldef_outband();
+  test_ruldef_suspend();
+  test_ruldef_deflt();
+
+  return test_report();
+}
+
+/**
+ * Preprocess line
+ *
+ * @param line  the line as read from config file
+ * @param out   buffer of BUFSIZE bytes to return the result
+ *
+ * @return  return value of preprocess_buffer()
+ */
+static int
+preprocess(const char *line, char *out)
+{
+  char in[BUFSIZE];
+
+  g_strlcpy(in, line, sizeof(in));
+
+  return preprocess_buffer(1, in, out);
+}
+
+static void
+test_preprocess_buffer()
+{
+  char out[BUFSIZE];
+
+  /* Blanks and comments are removed */
+  check(preprocess("  id  =\tline-volume  # comment\n", out) == 0);
+  check_str(out, "id=line-volume");
+
+  check(preprocess("# comment only\n", out) == 0);
+  check_str(out, "");
+
+  check(preprocess("\n", out) == 0);
+  check_str(out, "");
+
+  /* The line may be the last one, without newline */
+  check(preprocess("card = RX-51", out) == 0);
+  check_str(out, "card=RX-51");
+
+  /* Quotes keep blanks and '#', and are removed */
+  check(preprocess("name = \"Line  DAC #1\" # comment\n", out) == 0);
+  check_str(out, "name=Line  DAC #1");
+
+  check(preprocess("name = Line\" \"Volume\n", out) == 0);
+  check_str(out, "name=Line Volume");
+
+  /* Unterminated quote is a warning only */
+  check(preprocess("name = \"Line Volume\n", out) == 0);
+  check_str(out, "name=Line Volume");
+
+  /* Bytes of UTF-8 are kept */
+  check(preprocess("card = \"K\xc3\xa4rtti\"\n", out) == 0);
+  check_str(out, "card=K\xc3\xa4rtti");
+
+  /* Control characters are not allowed, even quoted */
+  errno = 0;
+  check(preprocess("id = a\x01" "b\n", out) < 0);
+  check(errno == EILSEQ);
+
+  check(preprocess("name = \"a\tb\"\n", out) < 0);
+}
+
+static void
+test_elemdef_parse()
+{
+  struct elemdef *elemdef = elemdef_create();
+  char line[BUFSIZE];
+
+#define parse(str) \
+  (g_strlcpy(line, (str), sizeof(line)), elemdef_parse(1, line, elemdef))
+
+  check(parse("id=line-volume") == 0);
+  check_str(elemdef->id, "line-volume");
+
+  check(parse("card=RX-51") == 0);
+  check_str(elemdef->card, "RX-51");
+
+  check(parse("interface=MIXER") == 0);
+  check_str(elemdef->iface, "MIXER");
+
+  check(parse("name=Line DAC Playback Volume") == 0);
+  check_str(elemdef->name, "Line DAC Playback Volume");
+
+  /* Later definition of a key replaces the earlier one */
+  check(parse("id=b-line-volume") == 0);
+  check_str(elemdef->id, "b-line-volume");
+
+  /* Values may be empty */
+  check(parse("interface=") == 0);
+  check_str(elemdef->iface, "");
+
+  check(parse("index=2") == 0);
+  check(elemdef->index == 2);
+
+  check(parse("device=1") == 0);
+  check(elemdef->dev == 1);
+
+  check(parse("sub-device=3") == 0);
+  check(elemdef->subdev == 3);
+
+  check(parse("index=") < 0);
+  check(parse("index=two") < 0);
+  check(parse("device=1x") < 0);
+  check(parse("sub-device= ") < 0);
+
+  /* Keys are matched exactly */
+  check(parse("identity=x") < 0);
+  check(parse("Id=x") < 0);
+  check(parse("id") < 0);
+  check(parse("") < 0);
+  check(parse("=x") < 0);
+  check_str(elemdef->id, "b-line-volume");
+
+  check(elemdef_parse(1, line, NULL) < 0);
+
+#undef parse
+
+  elemdef_free(elemdef);
+}
+
+static void
+test_ruldef_alsa_setting()
+{
+  struct ruldef rule;
+  char line[BUFSIZE];
+
+#define parse(str)                                                    \
+  (memset(&rule, 0, sizeof(rule)),                                    \
+   g_strlcpy(line, (str), sizeof(line)),                              \
+   ruldef_parse_alsa_setting(1, line, &rule))
+
+  check(parse("ihf=line-volume:80%") == 0);
+  check(rule.action == action_alsa_setting);
+  check_str(rule.entry, "ihf");
+  check_str(rule.elemid, "line-volume");
+  check_str(rule.value, "80%");
+
+  /* Value is the rest of the line */
+  check(parse("headset=mux:a:b") == 0);
+  check_str(rule.elemid, "mux");
+  check_str(rule.value, "a:b");
+
+  check(parse("call-active+jack-headset=vol:0") == 0);
+  check_str(rule.entry, "call-active+jack-headset");
+
+  check(parse("ihf={,b-}line-volume:0") == 0);
+  check_str(rule.elemid, "{,b-}line-volume");
+
+  check(parse("ihf=vol:") == 0);
+  check_str(rule.value, "");
+
+  /* Lines of other kind are skipped */
+  check(parse("ihf=line-volume") == 1);
+  check(parse("ihf") == 1);
+  check(parse("ihf:vol=1") == 1);
+  check(parse("") == 1);
+
+  /* Invalid entries */
+  check(parse("=vol:1") < 0);
+  check(parse("1ihf=vol:1") < 0);
+  check(parse("ihf.2=vol:1") < 0);
+  check(parse("call-active+=vol:1") < 0);
+  check(parse("call-active++jack=vol:1") < 0);
+
+  check(ruldef_parse_alsa_setting(1, line, NULL) < 0);
+
+#undef parse
+}
+
+static void
+test_ruldef_outband()
+{
+  struct ruldef rule;
+  char line[BUFSIZE];
+
+#define parse(str)                                                    \
+  (memset(&rule, 0, sizeof(rule)),                                    \
+   g_strlcpy(line, (str), sizeof(line)),                              \
+   ruldef_parse_outband(1, line, &rule))
+
+  check(parse("ihf=@outband_execution@delay:100") == 0);
+  check(rule.action == action_outband_execution);
+  check_str(rule.entry, "ihf");
+  check(rule.delay == 100);
+
+  check(parse("ihf=@outband_cancellation@") == 0);
+  check(rule.action == action_outband_cancellation);
+  check_str(rule.entry, "ihf");
+
+  check(parse("ihf=@outband_execution@delay:") < 0);
+  check(parse("ihf=@outband_execution@delay:1s") < 0);
+  check(parse("1ihf=@outband_execution@delay:100") < 0);
+  check(parse("1ihf=@outband_cancellation@") < 0);
+
+  /* Only the whole keywords are outband rules */
+  check(parse("ihf=line-volume:100") == 1);
+  check(parse("ihf=:100") == 1);
+  check(parse("ihf=@outband:100") == 1);
+  check(parse("ihf=@outband_execution@delayed:100") == 1);
+  check(parse("ihf=@outband_cancellation@x") == 1);
+  check(parse("ihf=@outband_cancellation") == 1);
+  check(parse("ihf=@suspend_execution@sleep:100") == 1);
+  check(parse("ihf") == 1);
+
+  check(ruldef_parse_outband(1, line, NULL) < 0);
+
+#undef parse
+}
+
+static void
+test_ruldef_suspend()
+{
+  struct ruldef rule;
+  char line[BUFSIZE];
+
+#define parse(str)                                                    \
+  (memset(&rule, 0, sizeof(rule)),                                    \
+   g_strlcpy(line, (str), sizeof(line)),                              \
+   ruldef_parse_suspend(1, line, &rule))
+
+  check(parse("ihf=@suspend_execution@sleep:1000") == 0);
+  check(rule.action == action_suspend_execution);
+  check_str(rule.entry, "ihf");
+  check(rule.delay == 1000);
+
+  check(parse("ihf=@suspend_execution@sleep:") < 0);
+  check(parse("ihf=@suspend_execution@sleep:-") < 0);
+  check(parse("1ihf=@suspend_execution@sleep:10") < 0);
+
+  /* Only the whole keyword is a suspend rule */
+  check(parse("ihf=line-volume:100") == 1);
+  check(parse("ihf=:100") == 1);
+  check(parse("ihf=@suspend:100") == 1);
+  check(parse("ihf=@suspend_execution@sleeps:100") == 1);
+  check(parse("ihf=@suspend_execution@sleep") == 1);
+  check(parse("ihf=@outband_execution@delay:100") == 1);
+  check(parse("ihf") == 1);
+
+  check(ruldef_parse_suspend(1, line, NULL) < 0);
+
+#undef parse
+}
+
+static void
+test_ruldef_deflt()
+{
+  struct ruldef rule;
+  char line[BUFSIZE];
+
+#define parse(str)                                                    \
+  (memset(&rule, 0, sizeof(rule)),                                    \
+   g_strlcpy(line, (str), sizeof(line)),                              \
+   ruldef_parse_deflt(1, line, &rule))
+
+  check(parse("line-volume:Off") == 0);
+  check(rule.action == action_alsa_setting);
+  check_str(rule.entry, "<default>");
+  check_str(rule.elemid, "line-volume");
+  check_str(rule.value, "Off");
+
+  check(parse("*-switch:a:b") == 0);
+  check_str(rule.elemid, "*-switch");
+  check_str(rule.value, "a:b");
+
+  check(parse("line-volume") < 0);
+  check(parse("") < 0);
+
+  check(ruldef_parse_deflt(1, line, NULL) < 0);
+
+#undef parse
+}
+
+/** @} */
@@ -0,0 +1,90 @@
+/**
+ * @file fuzz-actions.c
+ * @copyright GNU GPLv2 or later
+ *
+ * libFuzzer harness of the audio_actions signal parser. The input is a
+ * serialized D-Bus message, as received from the bus. It's decoded by
+ * the D-Bus library and handled by dbusif.c, or by gdbusif.c with
+ * FUZZ_GDBUS, like an audio_actions signal. The parsed actions are
+ * checked instead of queued, by tests/stubs.c, and no status signal is
+ * sent.
+ *
+ * @{ */
+
+#ifdef FUZZ_GDBUS
+#include "../src/gdbusif.c"
+#else
+#include "../src/dbusif.c"
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "test.h"
+
+
+int
+LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+  struct options options;
+
+  /* Errors of the invalid inputs are expected, they are not logged */
+  memset(&options, 0, sizeof(options));
+
+  if (log_init(&options) < 0 || dbusif_init(&options) < 0)
+  {
+    fputs("Initialization failed\n", stderr);
+    exit(1);
+  }
+
+  return 0;
+}
+
+#ifdef FUZZ_GDBUS
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  GDBusMessage *msg;
+  GVariant *body;
+
+  test_queue_reset();
+
+  msg = g_dbus_message_new_from_blob((guchar *)data, size,
+                                     G_DBUS_CAPABILITY_FLAGS_NONE, NULL);
+
+  if (!msg)
+    return 0;
+
+  if ((body = g_dbus_message_get_body(msg)))
+    handle_action_message(body);
+
+  g_object_unref(msg);
+
+  return 0;
+}
+
+#else  /* FUZZ_GDBUS */
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  DBusMessage *msg;
+
+  test_queue_reset();
+
+  if (size > INT_MAX)
+    return 0;
+
+  if (!(msg = dbus_message_demarshal((const char *)data, size, NULL)))
+    return 0;
+
+  handle_action_message(msg);
+  dbus_message_unref(msg);
+
+  return 0;
+}
+
+#endif  /* FUZZ_GDBUS */
+
+/** @} */
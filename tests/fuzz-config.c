@@ -0,0 +1,81 @@
+/**
+ * @file fuzz-config.c
+ * @copyright GNU GPLv2 or later
+ *
+ * libFuzzer harness of the config file parser. The input is parsed as
+ * the config file and the rules are compiled, without sound cards. The
+ * definitions of an input are kept when the next one is run, as the
+ * daemon can't forget them, so a crash may depend on the inputs run
+ * before it and not reproduce with the crash input alone. It's then
+ * reproduced by running the corpus before the input in one process, as
+ * libFuzzer does, with 'tests/fuzz-config fuzz-corpus/fuzz-config
+ * crash-<sha1>'. The inputs which added no coverage are not kept in the
+ * corpus, so even this may not reproduce it.
+ *
+ * @{ */
+
+#define _GNU_SOURCE  /* memfd_create() */
+
+#include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "control.h"
+#include "logging.h"
+
+/* Private structure */
+static struct {
+  struct options options;
+  char path[32];
+  int fd;
+} priv;
+
+
+int
+LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+  /* The config is read from memory by path */
+  if ((priv.fd = memfd_create("alsaped.conf", MFD_CLOEXEC)) < 0)
+  {
+    perror("memfd_create");
+    exit(1);
+  }
+
+  snprintf(priv.path, sizeof(priv.path), "/proc/self/fd/%d", priv.fd);
+  priv.options.config_path = priv.path;
+
+  /* Errors of the invalid inputs are expected, they are not logged */
+  if (log_init(&priv.options) < 0 || config_init(&priv.options) < 0 ||
+      control_init(&priv.options) < 0)
+  {
+    fputs("Initialization failed\n", stderr);
+    exit(1);
+  }
+
+  control_set_cb();
+
+  return 0;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (ftruncate(priv.fd, 0) < 0 ||
+      pwrite(priv.fd, data, size, 0) != (ssize_t)size)
+  {
+    perror("pwrite");
+    abort();
+  }
+
+  if (config_parse() == 0)
+    control_compile();
+
+  return 0;
+}
+
+/** @} */
@@ -0,0 +1,118 @@
+/**
+ * @file fuzz-main.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Runs a libFuzzer harness on files, for builds without libFuzzer. The
+ * files and directories given are run, or the seed corpus directories
+ * of the harness, FUZZ_CORPUS, relative to SRCDIR and separated by ':'.
+ * So 'make check' checks the harnesses with their seeds, under the
+ * sanitizers if configured with --enable-sanitizers, and a crash found
+ * by 'make fuzz' can be reproduced and debugged with any compiler.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+int LLVMFuzzerInitialize   (int *argc, char ***argv);
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size);
+
+static int run_path (const char *);
+static int run_file (const char *);
+
+
+int
+main(int argc, char **argv)
+{
+  gchar **dirs;
+  gchar *path;
+  int i, runs = 0;
+
+  LLVMFuzzerInitialize(&argc, &argv);
+
+  if (argc > 1)
+  {
+    for (i = 1;  i < argc;  i++)
+      runs += run_path(argv[i]);
+  }
+  else
+  {
+    dirs = g_strsplit(FUZZ_CORPUS, ":", -1);
+
+    for (i = 0;  dirs[i];  i++)
+    {
+      path = g_build_filename(SRCDIR, dirs[i], NULL);
+      runs += run_path(path);
+      g_free(path);
+    }
+
+    g_strfreev(dirs);
+  }
+
+  printf("%d inputs\n", runs);
+
+  /* The seeds not found is an error too */
+  return runs ? 0 : 1;
+}
+
+/**
+ * Run harness on file, or on the files of directory
+ *
+ * @param path  the file or directory
+ * @return      number of files run
+ */
+static int
+run_path(const char *path)
+{
+  const gchar *name;
+  gchar *file;
+  GDir *dir;
+  int runs = 0;
+
+  if (!g_file_test(path, G_FILE_TEST_IS_DIR))
+    return run_file(path);
+
+  if (!(dir = g_dir_open(path, 0, NULL)))
+  {
+    fprintf(stderr, "Can't open '%s'\n", path);
+    return 0;
+  }
+
+  while ((name = g_dir_read_name(dir)))
+  {
+    file = g_build_filename(path, name, NULL);
+    runs += run_file(file);
+    g_free(file);
+  }
+
+  g_dir_close(dir);
+
+  return runs;
+}
+
+/**
+ * Run harness on file
+ * @param path  the file
+ * @return      1 if run, 0 if the file can't be read
+ */
+static int
+run_file(const char *path)
+{
+  gchar *data;
+  gsize size;
+
+  if (!g_file_get_contents(path, &data, &size, NULL))
+  {
+    fprintf(stderr, "Can't read '%s'\n", path);
+    return 0;
+  }
+
+  LLVMFuzzerTestOneInput((const uint8_t *)data, size);
+  g_free(data);
+
+  return 1;
+}
+
+/** @} */
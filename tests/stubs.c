@@ -0,0 +1,95 @@
+/**
+ * @file stubs.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Queue and control stubs of the tests and fuzz harnesses of the
+ * audio_actions parsers. The actions are recorded instead of queued, and
+ * their strings are read, so that the sanitizers check them. The routes,
+ * rules and context are empty, and only the "mode" section is known.
+ *
+ * @{ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "context.h"
+#include "control.h"
+#include "queue.h"
+
+#include "test.h"
+
+struct test_queue test_queue;
+
+
+/**
+ * Forget the actions and acknowledgements recorded
+ */
+void
+test_queue_reset()
+{
+  test_queue.pushed_len = 0;
+  test_queue.acks = 0;
+  test_queue.ack_success = -1;
+  test_queue.ack_txid = 0;
+}
+
+int
+queue_push(struct action_data *data)
+{
+  volatile size_t len;
+
+  if (data->rule_type == rule_context)
+    len = strlen(data->variable) + strlen(data->value);
+  else
+    len = strlen(data->route_dev);
+
+  (void)len;
+
+  if (test_queue.pushed_len < TEST_PUSHED_MAX)
+    test_queue.pushed[test_queue.pushed_len++] = *data;
+
+  return 0;
+}
+
+int
+queue_ack(queue_ack_cb cb, void *data, int success, int64_t start)
+{
+  test_queue.acks++;
+  test_queue.ack_success = success;
+  test_queue.ack_txid = GPOINTER_TO_UINT(data);
+  return 0;
+}
+
+enum rule_type
+control_find_section(const char *name)
+{
+  return strcmp(name, "mode") ? rule_unknown : rule_max;
+}
+
+void
+control_foreach_route(control_state_cb cb, void *data)
+{
+}
+
+void
+control_foreach_rule(control_rule_cb cb, void *data)
+{
+}
+
+void
+control_foreach_elem(control_elem_cb cb, void *data)
+{
+}
+
+int
+control_get_outband(int *lineno, int *msec)
+{
+  return FALSE;
+}
+
+void
+context_foreach(control_state_cb cb, void *data)
+{
+}
+
+/** @} */
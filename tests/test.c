@@ -0,0 +1,63 @@
+/**
+ * @file test.c
+ * @copyright GNU GPLv2 or later
+ *
+ * Checks of the unit tests, counted and reported at the end.
+ *
+ * @{ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+
+/* Private structure */
+static struct {
+  int checks;
+  int failures;
+} priv;
+
+
+/**
+ * Count check, report it if it failed
+ *
+ * @param ok    result of the check
+ * @param file  source file of the check
+ * @param line  line of the check
+ * @param expr  the checked expression
+ */
+void
+test_check(int ok, const char *file, int line, const char *expr)
+{
+  if (!ok)
+  {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    priv.failures++;
+  }
+
+  priv.checks++;
+}
+
+/**
+ * Compare strings
+ * @return  TRUE if str is set and equal to expected
+ */
+int
+test_str_equal(const char *str, const char *expected)
+{
+  return str && !strcmp(str, expected);
+}
+
+/**
+ * Print the number of checks and failures
+ * @return  exit status of the test, 1 if a check failed
+ */
+int
+test_report()
+{
+  printf("%d checks, %d failed\n", priv.checks, priv.failures);
+
+  return priv.failures ? 1 : 0;
+}
+
+/** @} */
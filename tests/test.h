@@ -0,0 +1,32 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "queue.h"
+
+/** Count the check, and report it if expr is false */
+#define check(expr) test_check((expr), __FILE__, __LINE__, #expr)
+
+/** Check that str is set and equal to expected */
+#define check_str(str, expected) check(test_str_equal((str), (expected)))
+
+#define TEST_PUSHED_MAX 8
+
+/** Actions queued and acknowledgements of the decisions, by tests/stubs.c */
+struct test_queue {
+  struct action_data pushed[TEST_PUSHED_MAX];
+  int pushed_len;
+  int acks;
+  int ack_success;
+  unsigned int ack_txid;
+};
+
+extern struct test_queue test_queue;
+
+void test_check       (int ok, const char *file, int line,
+                       const char *expr);
+int  test_str_equal   (const char *str, const char *expected);
+int  test_report      (void);
+void test_queue_reset (void);
+
+
+#endif  /* TEST_H */